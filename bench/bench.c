@@ -0,0 +1,570 @@
+/*
+    Benchmark suite for hextoggle, run with `make benchmark`.
+
+    Kernel benchmarks call `bin_data_to_format_hex` and
+    `hex_data_to_bin` directly for both formats, on buffers small enough
+    to stay in cache and on buffers of `--size` MiB. End-to-end
+    benchmarks run the `hextoggle` binary on generated files, through
+    pipes and in place.
+
+    Results are written as JSON (one result per line), and compared with
+    a previous run if `--baseline` is given. Every result is the best of
+    `--repeat` runs, in GB/s of input.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "bin_to_hex.h"
+#include "hex_to_bin.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* input size of the kernel benchmarks that stay in cache */
+enum { CACHED_SIZE = 1 << 15 };
+
+/* kernel benchmarks repeat until they have run for this long */
+#define MIN_KERNEL_SECONDS 0.2
+
+enum { MAX_RESULTS = 64 };
+
+typedef struct {
+    char name[64];
+    double gbps;
+} Result;
+
+typedef struct {
+    const char *hextoggle;
+    const char *directory;
+    const char *baseline;
+    const char *output;
+    size_t size;
+    unsigned repeat;
+    double threshold; /* slowdown reported as a regression, in percent */
+
+    Result results[MAX_RESULTS];
+    size_t result_count;
+} Bench;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/* `bytes_per_second`: the best throughput of all runs */
+static void add_result(Bench *bench, const char *name,
+        double bytes_per_second) {
+    Result *result;
+    if (bench->result_count == MAX_RESULTS) {
+        return;
+    }
+    result = &bench->results[bench->result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->gbps = bytes_per_second * 1e-9;
+    fprintf(stderr, "%-40s %8.3f GB/s\n", result->name, result->gbps);
+}
+
+/* xorshift, so the corpora are the same on every run */
+static unsigned long long next_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void fill_random(char *data, size_t size) {
+    unsigned long long state = 0x9e3779b97f4a7c15ull;
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        data[i] = (char)(next_random(&state) >> 32);
+    }
+}
+
+static void fill_text(char *data, size_t size) {
+    static const char *words[] = {
+        "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+        "hex", "toggle", "binary", "file", "line", "byte", "and", "a"
+    };
+    unsigned long long state = 0x2545f4914f6cdd1dull;
+    size_t i = 0, length;
+    const char *word;
+
+    while (i < size) {
+        word = words[next_random(&state) % 16];
+        length = strlen(word);
+        if (length > size - i) {
+            length = size - i;
+        }
+        memcpy(data + i, word, length);
+        i += length;
+        if (i < size) {
+            data[i++] = next_random(&state) % 12 ? ' ' : '\n';
+        }
+    }
+}
+
+/* Encode `data` in `format` with the header, as hextoggle would.
+ * Returns a buffer allocated with malloc and sets `*hex_size`. */
+static char *encode(const char *data, size_t size, HextoggleFormat format,
+        size_t *hex_size) {
+    const char *header = format == HextoggleFormatPlain
+        ? HEXTOGGLE_PLAIN_HEADER "\n" : HEXTOGGLE_HEADER "\n";
+    size_t header_size = strlen(header);
+    char *hex = (char *)malloc(
+        header_size + (size_t)format_hex_size(format, size));
+    if (hex) {
+        memcpy(hex, header, header_size);
+        *hex_size = header_size + bin_data_to_format_hex(
+            format, data, size, 0, hex + header_size);
+    }
+    return hex;
+}
+
+/* Rewrite canonical hex the way people edit it: CRLF line endings,
+ * block comments, `|` comment lines and changed digits. Returns a
+ * buffer allocated with malloc and sets `*edited_size`. */
+static char *edit_hex(const char *hex, size_t size, size_t *edited_size) {
+    static const char comment[] = "[edited]";
+    static const char comment_line[] = "| a note about the next line\r\n";
+    char *edited = (char *)malloc(size * 2);
+    size_t i = 0, out = 0, line = 0, length;
+    const char *newline;
+
+    if (!edited) {
+        return NULL;
+    }
+    while (i < size) {
+        newline = (const char *)memchr(hex + i, '\n', size - i);
+        length = newline ? (size_t)(newline - (hex + i)) : size - i;
+        if (line % 64 == 1) {
+            memcpy(edited + out, comment_line, sizeof(comment_line) - 1);
+            out += sizeof(comment_line) - 1;
+        }
+        if (line % 16 == 1 && length > 24) {
+            /* a comment between the address and the data */
+            memcpy(edited + out, hex + i, 24);
+            memcpy(edited + out + 24, comment, sizeof(comment) - 1);
+            memcpy(edited + out + 24 + sizeof(comment) - 1,
+                hex + i + 24, length - 24);
+            out += length + sizeof(comment) - 1;
+        } else {
+            memcpy(edited + out, hex + i, length);
+            if (line % 8 == 1 && length > 30) {
+                /* a changed digit */
+                edited[out + 25] = edited[out + 25] == 'f' ? '0' : 'f';
+            }
+            out += length;
+        }
+        if (newline) {
+            edited[out++] = '\r';
+            edited[out++] = '\n';
+        }
+        i += length + 1;
+        ++line;
+    }
+    *edited_size = out;
+    return edited;
+}
+
+static void bench_encode_kernel(Bench *bench, const char *name,
+        HextoggleFormat format, const char *data, size_t size) {
+    char *output = (char *)malloc((size_t)format_hex_size(format, size));
+    unsigned long long bytes;
+    double start, elapsed, best = 0;
+    unsigned run;
+
+    if (!output) {
+        return;
+    }
+    for (run = 0; run < bench->repeat; ++run) {
+        bytes = 0;
+        start = now();
+        do {
+            bin_data_to_format_hex(format, data, size, 0, output);
+            bytes += size;
+            elapsed = now() - start;
+        } while (elapsed < MIN_KERNEL_SECONDS);
+        if (run == 0 || (double)bytes / elapsed > best) {
+            best = (double)bytes / elapsed;
+        }
+    }
+    add_result(bench, name, best);
+    free(output);
+}
+
+static void bench_decode_kernel(Bench *bench, const char *name,
+        const char *hex, size_t size) {
+    char *output = (char *)malloc(size / 2 + 1);
+    unsigned long long bytes;
+    double start, elapsed, best = 0;
+    size_t output_size;
+    FromHexData data;
+    unsigned run;
+
+    if (!output) {
+        return;
+    }
+    for (run = 0; run < bench->repeat; ++run) {
+        bytes = 0;
+        start = now();
+        do {
+            data = init_from_hex_data();
+            if (hex_data_to_bin(&data, hex, size, output, &output_size)) {
+                fprintf(stderr, "Error: %s: invalid input at line %llu\n",
+                    name, data.line_no);
+                free(output);
+                return;
+            }
+            bytes += size;
+            elapsed = now() - start;
+        } while (elapsed < MIN_KERNEL_SECONDS);
+        if (run == 0 || (double)bytes / elapsed > best) {
+            best = (double)bytes / elapsed;
+        }
+    }
+    add_result(bench, name, best);
+    free(output);
+}
+
+static char *corpus_path(const Bench *bench, const char *name) {
+    char *path = (char *)malloc(
+        strlen(bench->directory) + strlen(name) + 2);
+    if (path) {
+        sprintf(path, "%s/%s", bench->directory, name);
+    }
+    return path;
+}
+
+static BOOL write_file(const char *path, const char *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    BOOL written;
+    if (!file) {
+        fprintf(stderr, "Unable to open file `%s` for writing: %s\n",
+            path, strerror(errno));
+        return FALSE;
+    }
+    written = fwrite(data, 1, size, file) == size;
+    return !fclose(file) && written;
+}
+
+static BOOL copy_file(const char *from, const char *to) {
+    char buffer[1 << 16];
+    FILE *input, *output;
+    size_t length;
+    BOOL copied = TRUE;
+
+    input = fopen(from, "rb");
+    output = input ? fopen(to, "wb") : NULL;
+    if (!output) {
+        if (input) {
+            fclose(input);
+        }
+        return FALSE;
+    }
+    while ((length = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        copied = copied && fwrite(buffer, 1, length, output) == length;
+    }
+    fclose(input);
+    return !fclose(output) && copied;
+}
+
+/* Run `command` (through the shell) `bench->repeat` times and record
+ * the best time for `bytes` of input. If `copy_from` isn't NULL, it is
+ * copied to `copy_to` before each run, without being timed. */
+static void bench_command(Bench *bench, const char *name,
+        const char *command, unsigned long long bytes,
+        const char *copy_from, const char *copy_to) {
+    double start, elapsed, best = 0;
+    unsigned run;
+
+    for (run = 0; run < bench->repeat; ++run) {
+        if (copy_from && !copy_file(copy_from, copy_to)) {
+            fprintf(stderr, "Error: %s: unable to copy `%s`\n",
+                name, copy_from);
+            return;
+        }
+        start = now();
+        if (system(command)) {
+            fprintf(stderr, "Error: %s: `%s` failed\n", name, command);
+            return;
+        }
+        elapsed = now() - start;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    add_result(bench, name, (double)bytes / best);
+}
+
+/* End-to-end benchmarks of converting the corpus `input` (`size`
+ * bytes) with `flags`, and with the environment variables in `env`
+ * (e.g. "HEXTOGGLE_NO_SIMD=1 ", or ""). */
+static void bench_end_to_end(Bench *bench, const char *name,
+        const char *env, const char *flags,
+        const char *input, unsigned long long size) {
+    char command[4096], full_name[64];
+    char *output = corpus_path(bench, "output");
+    char *in_place = corpus_path(bench, "in_place");
+
+    if (!output || !in_place) {
+        free(output);
+        free(in_place);
+        return;
+    }
+    snprintf(full_name, sizeof(full_name), "%s/file", name);
+    snprintf(command, sizeof(command), "%s'%s' %s '%s' '%s'",
+        env, bench->hextoggle, flags, input, output);
+    bench_command(bench, full_name, command, size, NULL, NULL);
+
+    snprintf(full_name, sizeof(full_name), "%s/pipe", name);
+    snprintf(command, sizeof(command),
+        "cat '%s' | %s'%s' %s - | cat >/dev/null",
+        input, env, bench->hextoggle, flags);
+    bench_command(bench, full_name, command, size, NULL, NULL);
+
+    snprintf(full_name, sizeof(full_name), "%s/in-place", name);
+    snprintf(command, sizeof(command), "%s'%s' %s '%s'",
+        env, bench->hextoggle, flags, in_place);
+    bench_command(bench, full_name, command, size, input, in_place);
+
+    remove(output);
+    remove(in_place);
+    free(output);
+    free(in_place);
+}
+
+static void write_results(const Bench *bench, FILE *file) {
+    size_t i;
+    fprintf(file, "{\n  \"unit\": \"GB/s\",\n  \"size\": %llu,\n"
+        "  \"results\": [\n", (unsigned long long)bench->size);
+    for (i = 0; i < bench->result_count; ++i) {
+        fprintf(file, "    {\"name\": \"%s\", \"gbps\": %.3f}%s\n",
+            bench->results[i].name, bench->results[i].gbps,
+            i + 1 < bench->result_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/* Compare with the results in `bench->baseline`, which has the format
+ * written by `write_results`. Returns the number of regressions. */
+static unsigned compare_with_baseline(const Bench *bench) {
+    char line[256], name[64];
+    double gbps, change;
+    unsigned regressions = 0;
+    size_t i;
+    FILE *file = fopen(bench->baseline, "rb");
+
+    if (!file) {
+        fprintf(stderr, "No baseline `%s` to compare with\n",
+            bench->baseline);
+        return 0;
+    }
+    fprintf(stderr, "\nCompared with `%s`:\n", bench->baseline);
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, " {\"name\": \"%63[^\"]\", \"gbps\": %lf",
+                name, &gbps) != 2 || gbps <= 0) {
+            continue;
+        }
+        for (i = 0; i < bench->result_count; ++i) {
+            if (strcmp(bench->results[i].name, name)) {
+                continue;
+            }
+            change = (bench->results[i].gbps / gbps - 1) * 100;
+            fprintf(stderr, "%-40s %8.3f -> %8.3f GB/s %+7.1f%%%s\n",
+                name, gbps, bench->results[i].gbps, change,
+                change < -bench->threshold ? "  REGRESSION" : "");
+            regressions += change < -bench->threshold;
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "Usage: hextoggle-bench [options]\n"
+        "    --hextoggle PATH  # binary to run (./build/hextoggle)\n"
+        "    --dir DIR         # where to write corpora (./build/bench)\n"
+        "    --size N          # corpus size in MiB (64)\n"
+        "    --repeat N        # runs per benchmark (3)\n"
+        "    --output FILE     # write JSON results to FILE (stdout)\n"
+        "    --baseline FILE   # compare with earlier JSON results\n"
+        "    --threshold P     # slowdown in %% that is a regression (10)\n"
+        "Returns 1 if there are any regressions.\n");
+}
+
+static BOOL parse_options(Bench *bench, int argc, const char *argv[]) {
+    int i;
+    const char *value;
+
+    bench->hextoggle = "./build/hextoggle";
+    bench->directory = "./build/bench";
+    bench->baseline = NULL;
+    bench->output = NULL;
+    bench->size = (size_t)64 << 20;
+    bench->repeat = 3;
+    bench->threshold = 10;
+    bench->result_count = 0;
+    for (i = 1; i + 1 < argc; i += 2) {
+        value = argv[i + 1];
+        if (!strcmp(argv[i], "--hextoggle")) {
+            bench->hextoggle = value;
+        } else if (!strcmp(argv[i], "--dir")) {
+            bench->directory = value;
+        } else if (!strcmp(argv[i], "--size")) {
+            bench->size = (size_t)strtoul(value, NULL, 10) << 20;
+        } else if (!strcmp(argv[i], "--repeat")) {
+            bench->repeat = (unsigned)strtoul(value, NULL, 10);
+        } else if (!strcmp(argv[i], "--output")) {
+            bench->output = value;
+        } else if (!strcmp(argv[i], "--baseline")) {
+            bench->baseline = value;
+        } else if (!strcmp(argv[i], "--threshold")) {
+            bench->threshold = strtod(value, NULL);
+        } else {
+            return FALSE;
+        }
+    }
+    return i == argc && bench->size && bench->repeat;
+}
+
+int main(int argc, const char *argv[]) {
+    Bench bench;
+    char *random_data, *zeros, *text, *hex, *edited, *plain;
+    char *paths[6];
+    size_t hex_size, edited_size, plain_size, i;
+    FILE *output;
+    int status = 0;
+    static const char *corpora[6] = {
+        "random.bin", "zeros.bin", "text.bin", "random.hex", "edited.hex",
+        "plain.hex"
+    };
+
+    if (!parse_options(&bench, argc, argv)) {
+        print_usage();
+        return 1;
+    }
+    mkdir(bench.directory, 0777);
+
+    random_data = (char *)malloc(bench.size);
+    zeros = (char *)calloc(bench.size, 1);
+    text = (char *)malloc(bench.size);
+    if (!random_data || !zeros || !text) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+    fill_random(random_data, bench.size);
+    fill_text(text, bench.size);
+    hex = encode(random_data, bench.size, HextoggleFormatCanonical,
+        &hex_size);
+    edited = hex ? edit_hex(hex, hex_size, &edited_size) : NULL;
+    plain = encode(random_data, bench.size, HextoggleFormatPlain,
+        &plain_size);
+    if (!edited || !plain) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+
+    bench_encode_kernel(&bench, "kernel/encode/cached",
+        HextoggleFormatCanonical, random_data, CACHED_SIZE);
+    bench_encode_kernel(&bench, "kernel/encode/streaming",
+        HextoggleFormatCanonical, random_data, bench.size);
+    bench_encode_kernel(&bench, "kernel/encode-plain/cached",
+        HextoggleFormatPlain, random_data, CACHED_SIZE);
+    bench_encode_kernel(&bench, "kernel/encode-plain/streaming",
+        HextoggleFormatPlain, random_data, bench.size);
+    bench_decode_kernel(&bench, "kernel/decode/cached",
+        hex, (size_t)bin_to_hex_size(CACHED_SIZE));
+    bench_decode_kernel(&bench, "kernel/decode/streaming", hex, hex_size);
+    bench_decode_kernel(&bench, "kernel/decode-edited/cached",
+        edited, CACHED_SIZE * 6);
+    bench_decode_kernel(&bench, "kernel/decode-edited/streaming",
+        edited, edited_size);
+    bench_decode_kernel(&bench, "kernel/decode-plain/cached",
+        plain, (size_t)plain_hex_size(CACHED_SIZE));
+    bench_decode_kernel(&bench, "kernel/decode-plain/streaming",
+        plain, plain_size);
+
+    for (i = 0; i < 6; ++i) {
+        paths[i] = corpus_path(&bench, corpora[i]);
+        if (!paths[i]) {
+            fprintf(stderr, "Error: Unable to allocate buffers\n");
+            return 1;
+        }
+    }
+    if (!write_file(paths[0], random_data, bench.size)
+            || !write_file(paths[1], zeros, bench.size)
+            || !write_file(paths[2], text, bench.size)
+            || !write_file(paths[3], hex, hex_size)
+            || !write_file(paths[4], edited, edited_size)
+            || !write_file(paths[5], plain, plain_size)) {
+        fprintf(stderr, "Error: Unable to write corpora to `%s`\n",
+            bench.directory);
+        return 1;
+    }
+    free(random_data);
+    free(zeros);
+    free(text);
+    free(hex);
+    free(edited);
+    free(plain);
+
+    bench_end_to_end(&bench, "encode/random", "", "-e",
+        paths[0], bench.size);
+    bench_end_to_end(&bench, "encode/zeros", "", "-e",
+        paths[1], bench.size);
+    bench_end_to_end(&bench, "encode/text", "", "-e",
+        paths[2], bench.size);
+    bench_end_to_end(&bench, "decode/canonical", "", "-d",
+        paths[3], hex_size);
+    bench_end_to_end(&bench, "decode/edited", "", "-d",
+        paths[4], edited_size);
+    bench_end_to_end(&bench, "encode-plain/random", "",
+        "-e --format plain", paths[0], bench.size);
+    bench_end_to_end(&bench, "decode/plain", "", "-d",
+        paths[5], plain_size);
+    bench_end_to_end(&bench, "encode-elided/random", "", "-e --elide",
+        paths[0], bench.size);
+    bench_end_to_end(&bench, "encode-elided/zeros", "", "-e --elide",
+        paths[1], bench.size);
+    bench_end_to_end(&bench, "encode-j4/random", "", "-e -j 4",
+        paths[0], bench.size);
+    bench_end_to_end(&bench, "decode-j4/canonical", "", "-d -j 4",
+        paths[3], hex_size);
+    /* the fallbacks for each optimisation, and opt-in zero-copy pipe
+        output */
+    bench_end_to_end(&bench, "encode-scalar/random",
+        "HEXTOGGLE_NO_SIMD=1 ", "-e", paths[0], bench.size);
+    bench_end_to_end(&bench, "decode-scalar/canonical",
+        "HEXTOGGLE_NO_SIMD=1 ", "-d", paths[3], hex_size);
+    bench_end_to_end(&bench, "encode-splice/random",
+        "HEXTOGGLE_SPLICE=1 ", "-e", paths[0], bench.size);
+    bench_end_to_end(&bench, "encode-no-uring/random",
+        "HEXTOGGLE_NO_URING=1 ", "-e", paths[0], bench.size);
+    for (i = 0; i < 6; ++i) {
+        remove(paths[i]);
+        free(paths[i]);
+    }
+
+    output = bench.output ? fopen(bench.output, "wb") : stdout;
+    if (!output) {
+        fprintf(stderr, "Unable to open file `%s` for writing: %s\n",
+            bench.output, strerror(errno));
+        return 1;
+    }
+    write_results(&bench, output);
+    if (bench.output) {
+        fclose(output);
+    }
+    if (bench.baseline && compare_with_baseline(&bench)) {
+        status = 1;
+    }
+    return status;
+}
@@ -1,5 +1,7 @@
 #include "args.h"
 
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,35 +21,116 @@ static const char *USAGE_STRING =
 "Usage: hextoggle [file]            # toggle file in-place\n"
 "       hextoggle [input] [output]  # read `input`, write to `output`\n"
 "       hextoggle -                 # read from stdin/write to stdout\n"
+"       hextoggle --batch [files]   # toggle each file in-place\n"
+"       hextoggle --batch -         # read a NUL-separated file list\n"
+"       hextoggle --diff [old] [new] # write the lines that differ\n"
+"       hextoggle --apply [d] [file] # patch `file` with the diff `d`\n"
 "\n"
 "Options:\n"
-"       -d  --decode   # force decode (i.e. hex -> binary)\n"
-"       -e  --encode   # force encode (i.e. binary -> hex)\n"
-"       -h  --help     # show this usage information\n"
-"       -n  --dry-run  # discard results\n"
-"       -v  --verbose  # enable verbose output\n"
-"       -V  --version  # show version number and quit\n"
+"       -d  --decode       # force decode (i.e. hex -> binary)\n"
+"       -e  --encode       # force encode (i.e. binary -> hex)\n"
+"       -h  --help         # show this usage information\n"
+"       -j  --jobs N       # convert using N threads\n"
+"       -n  --dry-run      # discard results\n"
+"       -v  --verbose      # enable verbose output\n"
+"       -V  --version      # show version number and quit\n"
+"           --range S:N    # decode N bytes from address S\n"
+"           --index        # write a line index for --range\n"
+"           --skip N       # skip N bytes of input when encoding\n"
+"           --length N     # encode at most N bytes of input\n"
+"           --manifest     # write a manifest for patching the input\n"
+"           --batch        # convert many files, using -j N threads\n"
+"           --output-dir D # write batch results to directory D\n"
+"           --stats        # print I/O and timing statistics\n"
+"           --progress     # show progress while converting\n"
+"           --compress F   # compress hex output with F (gzip, zstd),\n"
+"                          # or F:LEVEL\n"
+"           --format F     # write hex output in format F\n"
+"                          # (canonical, plain)\n"
+"           --elide        # write runs of identical lines once\n"
+"           --sparse       # skip holes when encoding, leave holes\n"
+"                          # for blocks of zeros when decoding\n"
+"           --direct       # keep files out of the page cache\n"
+"           --diff         # compare two binary files line by line\n"
+"           --apply        # patch a file with the output of --diff\n"
+"           --search P     # write the lines around each match of the\n"
+"                          # hex pattern P (`?` matches any digit)\n"
+"           --follow       # keep encoding data appended to the input\n"
+"           --resume       # continue a conversion that was cut short\n"
 "\n";
 
 static void print_help_screen(FILE *file) {
+    int status;
     fprintf(file, "%s", USAGE_STRING);
     fprintf(file, "Return codes:\n");
-    fprintf(file, "  %i   success\n", EXIT_SUCCESS);
-    fprintf(file, "  %i   invalid arguments\n",
-        StatusCodeInvalidArgs);
-    fprintf(file, "  %i   failed to open input files\n",
-        StatusCodeFailedToOpenFiles);
-    fprintf(file, "  %i   failed to clean up files\n",
-        StatusCodeFailedCleanup);
-    fprintf(file, "  %i   invalid input\n",
-        StatusCodeInvalidInput);
-    fprintf(file, "  %i   internal assertion failed\n",
-        StatusCodeAssertionFailed);
+    for (status = EXIT_SUCCESS; status <= StatusCodeAssertionFailed;
+            ++status) {
+        fprintf(file, "  %i   %s\n", status,
+            status_code_description(status));
+    }
+}
+
+/* Parse the positive number following the option at `argv[*i]`, and
+skip over it. */
+static BOOL parse_count(int argc, const char *argv[], int *i,
+        unsigned *count) {
+    char *end;
+    unsigned long value;
+    if (*i + 1 >= argc) {
+        return FALSE;
+    }
+    ++*i;
+    value = strtoul(argv[*i], &end, 10);
+    if (*end || end == argv[*i] || value == 0 || value > 1024) {
+        return FALSE;
+    }
+    *count = (unsigned)value;
+    return TRUE;
+}
+
+/* Parse the size (in decimal, or in hex with a 0x prefix) following the
+option at `argv[*i]`, and skip over it. */
+static BOOL parse_size(int argc, const char *argv[], int *i,
+        unsigned long long *size) {
+    char *end;
+    if (*i + 1 >= argc) {
+        return FALSE;
+    }
+    ++*i;
+    if (!isdigit((unsigned char)argv[*i][0])) {
+        return FALSE;
+    }
+    *size = strtoull(argv[*i], &end, 0);
+    return !*end;
+}
+
+/* Parse the `START:LENGTH` argument following the option at
+`argv[*i]`, and skip over it. Both numbers can be decimal or hex (with a
+0x prefix). */
+static BOOL parse_range(int argc, const char *argv[], int *i,
+        unsigned long long *start, unsigned long long *length) {
+    char *end;
+    const char *arg;
+    if (*i + 1 >= argc) {
+        return FALSE;
+    }
+    arg = argv[++*i];
+    if (!isdigit((unsigned char)arg[0])) {
+        return FALSE;
+    }
+    *start = strtoull(arg, &end, 0);
+    if (*end != ':' || !isdigit((unsigned char)end[1])) {
+        return FALSE;
+    }
+    arg = end + 1;
+    *length = strtoull(arg, &end, 0);
+    return !*end && *start <= *start + *length;
 }
 
 Args parse_args(int argc, const char *argv[]) {
     Args result;
-    BOOL help_arg, dry_run, valid_args, raw_args, version_arg;
+    BOOL help_arg, dry_run, valid_args, raw_args, version_arg, extra_args;
+    BOOL stdin_arg, diff_arg, apply_arg;
     int i;
 
     enum {
@@ -64,16 +147,50 @@ Args parse_args(int argc, const char *argv[]) {
     result.input_filename = NULL;
     result.output_kind = OutputKindStdio;
     result.output_filename = NULL;
+    result.jobs = 1;
+    result.range = FALSE;
+    result.range_start = 0;
+    result.range_length = 0;
+    result.write_index = FALSE;
+    result.skip = 0;
+    result.length = ULLONG_MAX;
+    result.manifest = FALSE;
+    result.batch = FALSE;
+    result.batch_files = (const char **)malloc(
+        sizeof(const char *) * (size_t)argc);
+    result.batch_file_count = 0;
+    result.output_directory = NULL;
+    result.stats = FALSE;
+    result.progress = FALSE;
+    result.compression = CompressionNone;
+    result.compression_level = 0;
+    result.format = HextoggleFormatCanonical;
+    result.elide = FALSE;
+    result.sparse = FALSE;
+    result.direct = FALSE;
+    result.diff_filename = NULL;
+    result.apply = FALSE;
+    result.search = FALSE;
+    result.follow = FALSE;
+    result.resume = FALSE;
 
     help_arg = FALSE;
     version_arg = FALSE;
     dry_run = FALSE;
     valid_args = TRUE;
     raw_args = FALSE;
+    extra_args = FALSE;
+    stdin_arg = FALSE;
+    diff_arg = FALSE;
+    apply_arg = FALSE;
     for (i = 1; i < argc; ++i) {
         if (!valid_args) {
             continue;
         } else if (raw_args || strncmp("-", argv[i], 1)) {
+            /* every file is used in batch mode */
+            if (result.batch_files) {
+                result.batch_files[result.batch_file_count++] = argv[i];
+            }
             if (main_arg_step == MainArgStepInputFile) {
                 result.input_filename = argv[i];
                 result.input_kind = InputKindFileName;
@@ -85,8 +202,8 @@ Args parse_args(int argc, const char *argv[]) {
                 result.output_kind = OutputKindFileName;
                 main_arg_step = MainArgStepDone;
             } else {
-                /* too many args */
-                valid_args = FALSE;
+                /* too many args, unless this is a batch */
+                extra_args = TRUE;
             }
         } else if (!strcmp(argv[i], "--help")
                 || !strcmp(argv[i], "-h")) {
@@ -103,10 +220,85 @@ Args parse_args(int argc, const char *argv[]) {
         } else if (!strcmp(argv[i], "--verbose")
                 || !strcmp(argv[i], "-v")) {
             result.verbose = TRUE;
+        } else if (!strcmp(argv[i], "--jobs")
+                || !strcmp(argv[i], "-j")) {
+            if (!parse_count(argc, argv, &i, &result.jobs)) {
+                valid_args = FALSE;
+            }
+        } else if (!strcmp(argv[i], "--range")) {
+            result.range = TRUE;
+            if (!parse_range(argc, argv, &i,
+                    &result.range_start, &result.range_length)) {
+                valid_args = FALSE;
+            }
+        } else if (!strcmp(argv[i], "--index")) {
+            result.write_index = TRUE;
+        } else if (!strcmp(argv[i], "--skip")) {
+            if (!parse_size(argc, argv, &i, &result.skip)) {
+                valid_args = FALSE;
+            }
+        } else if (!strcmp(argv[i], "--length")) {
+            if (!parse_size(argc, argv, &i, &result.length)) {
+                valid_args = FALSE;
+            }
+        } else if (!strcmp(argv[i], "--manifest")) {
+            result.manifest = TRUE;
+        } else if (!strcmp(argv[i], "--batch")) {
+            result.batch = TRUE;
+        } else if (!strcmp(argv[i], "--output-dir")) {
+            if (i + 1 >= argc) {
+                valid_args = FALSE;
+            } else {
+                result.output_directory = argv[++i];
+            }
+        } else if (!strcmp(argv[i], "--stats")) {
+            result.stats = TRUE;
+        } else if (!strcmp(argv[i], "--progress")) {
+            result.progress = TRUE;
+        } else if (!strcmp(argv[i], "--compress")) {
+            if (i + 1 >= argc || !parse_compression(argv[++i],
+                    &result.compression, &result.compression_level)) {
+                valid_args = FALSE;
+            } else if (!compression_supported(result.compression)) {
+                fprintf(stderr, "Error: %s output is not supported by "
+                    "this build\n", compression_name(result.compression));
+                valid_args = FALSE;
+            }
+        } else if (!strcmp(argv[i], "--format")) {
+            if (i + 1 >= argc) {
+                valid_args = FALSE;
+            } else if (!strcmp(argv[++i], "plain")) {
+                result.format = HextoggleFormatPlain;
+            } else if (!strcmp(argv[i], "canonical")) {
+                result.format = HextoggleFormatCanonical;
+            } else {
+                valid_args = FALSE;
+            }
+        } else if (!strcmp(argv[i], "--elide")) {
+            result.elide = TRUE;
+        } else if (!strcmp(argv[i], "--sparse")) {
+            result.sparse = TRUE;
+        } else if (!strcmp(argv[i], "--direct")) {
+            result.direct = TRUE;
+        } else if (!strcmp(argv[i], "--diff")) {
+            diff_arg = TRUE;
+        } else if (!strcmp(argv[i], "--apply")) {
+            apply_arg = TRUE;
+        } else if (!strcmp(argv[i], "--follow")) {
+            result.follow = TRUE;
+        } else if (!strcmp(argv[i], "--resume")) {
+            result.resume = TRUE;
+        } else if (!strcmp(argv[i], "--search")) {
+            result.search = TRUE;
+            if (i + 1 >= argc || !parse_search_pattern(argv[++i],
+                    &result.search_pattern)) {
+                valid_args = FALSE;
+            }
         } else if (!strcmp(argv[i], "--version")
                 || !strcmp(argv[i], "-V")) {
             version_arg = TRUE;
         } else if (!strcmp(argv[i], "-")) {
+            stdin_arg = TRUE;
             if (main_arg_step == MainArgStepInputFile) {
                 result.input_kind = InputKindStdio;
                 result.output_kind = OutputKindStdio;
@@ -115,8 +307,8 @@ Args parse_args(int argc, const char *argv[]) {
                 result.output_kind = OutputKindStdio;
                 main_arg_step = MainArgStepDone;
             } else {
-                /* too many args */
-                valid_args = FALSE;
+                /* too many args, unless this is a batch */
+                extra_args = TRUE;
             }
         } else if (!strcmp(argv[i], "--")) {
             raw_args = TRUE;
@@ -126,6 +318,27 @@ Args parse_args(int argc, const char *argv[]) {
         }
     }
 
+    if (result.batch) {
+        /* `-` (or no files at all) reads the list from stdin, so it
+            can't be mixed with files */
+        if (!result.batch_files
+                || (stdin_arg && result.batch_file_count)) {
+            valid_args = FALSE;
+        }
+        if (!result.batch_file_count) {
+            free((void *)result.batch_files);
+            result.batch_files = NULL;
+        }
+        if (result.range || result.write_index || result.skip
+                || result.length != ULLONG_MAX || result.manifest
+                || result.stats || result.progress) {
+            valid_args = FALSE;
+        }
+        main_arg_step = MainArgStepDone;
+    } else if (extra_args || result.output_directory) {
+        valid_args = FALSE;
+    }
+
     if (main_arg_step == MainArgStepInputFile
             && result.conversion == ConversionAutoDetect
             && !help_arg
@@ -133,10 +346,183 @@ Args parse_args(int argc, const char *argv[]) {
         valid_args = FALSE;
     }
 
+    if (result.range || result.write_index) {
+        /* these only decode, and never in place */
+        if (result.conversion == ConversionOnlyEncode
+                || (result.range && result.write_index)
+                || (result.write_index
+                    && result.input_kind != InputKindFileName)) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyDecode;
+        if (result.write_index) {
+            result.output_kind = OutputKindNone;
+        } else if (main_arg_step == MainArgStepOutputFile) {
+            result.output_kind = OutputKindStdio;
+        }
+    }
+
+    if (result.skip || result.length != ULLONG_MAX) {
+        /* these only encode, and never in place */
+        if (result.conversion == ConversionOnlyDecode) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyEncode;
+        if (main_arg_step == MainArgStepOutputFile) {
+            result.output_kind = OutputKindStdio;
+        }
+    }
+
+    if (diff_arg || apply_arg) {
+        /* these read two files (the second of them by name), and
+            convert nothing */
+        if ((diff_arg && apply_arg) || result.batch
+                || result.conversion != ConversionAutoDetect
+                || main_arg_step != MainArgStepDone
+                || result.output_kind != OutputKindFileName
+                || result.range || result.write_index || result.skip
+                || result.length != ULLONG_MAX || result.manifest
+                || result.compression != CompressionNone
+                || result.format != HextoggleFormatCanonical
+                || result.elide || result.sparse || result.direct) {
+            valid_args = FALSE;
+        } else if (diff_arg) {
+            result.diff_filename = result.output_filename;
+            result.output_filename = NULL;
+            result.output_kind = OutputKindStdio;
+        } else {
+            /* a dry run only checks the diff */
+            result.apply = TRUE;
+        }
+    }
+
+    if (result.search) {
+        /* this only reads binary input, and never writes in place */
+        if (diff_arg || apply_arg || result.batch
+                || result.conversion != ConversionAutoDetect
+                || result.range || result.write_index || result.skip
+                || result.length != ULLONG_MAX || result.manifest
+                || result.compression != CompressionNone
+                || result.format != HextoggleFormatCanonical
+                || result.elide || result.sparse || result.direct) {
+            valid_args = FALSE;
+        }
+        if (main_arg_step == MainArgStepOutputFile) {
+            result.output_kind = OutputKindStdio;
+        }
+    }
+
+    if (result.follow) {
+        /* this encodes a file that never ends, so it can't be replaced
+            by its output */
+        if (result.conversion == ConversionOnlyDecode || result.batch
+                || result.input_kind != InputKindFileName
+                || (main_arg_step == MainArgStepDone
+                    && result.output_kind == OutputKindFileName
+                    && !strcmp(result.input_filename,
+                        result.output_filename))
+                || diff_arg || apply_arg || result.search
+                || result.range || result.write_index || result.skip
+                || result.length != ULLONG_MAX || result.manifest
+                || result.compression != CompressionNone
+                || result.format != HextoggleFormatCanonical
+                || result.elide || result.sparse || result.direct) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyEncode;
+        if (main_arg_step == MainArgStepOutputFile) {
+            result.output_kind = OutputKindStdio;
+        }
+    }
+
+    if (result.resume) {
+        /* the output so far is read back and checked against the input,
+            so both need to be named files, and not the same one */
+        if (result.batch || dry_run
+                || result.input_kind != InputKindFileName
+                || main_arg_step != MainArgStepDone
+                || result.output_kind != OutputKindFileName
+                || !strcmp(result.input_filename, result.output_filename)
+                || diff_arg || apply_arg || result.search || result.follow
+                || result.range || result.write_index || result.skip
+                || result.length != ULLONG_MAX || result.manifest
+                || result.compression != CompressionNone
+                || result.format != HextoggleFormatCanonical
+                || result.elide || result.sparse || result.direct) {
+            valid_args = FALSE;
+        }
+    }
+
     if (dry_run) {
         result.output_kind = OutputKindNone;
     }
 
+    if (result.manifest) {
+        /* the manifest describes the input, which needs to be kept */
+        if (result.conversion == ConversionOnlyDecode
+                || result.skip || result.length != ULLONG_MAX
+                || result.input_kind != InputKindFileName
+                || result.output_kind != OutputKindFileName
+                || !strcmp(result.input_filename, result.output_filename)) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyEncode;
+    }
+
+    if (result.compression != CompressionNone) {
+        /* this only encodes whole files */
+        if (result.conversion == ConversionOnlyDecode
+                || result.skip || result.length != ULLONG_MAX
+                || result.manifest) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyEncode;
+    }
+
+    if (result.format != HextoggleFormatCanonical) {
+        /* plain lines have no addresses, which ranges and manifests
+            need */
+        if (result.conversion == ConversionOnlyDecode
+                || result.skip || result.length != ULLONG_MAX
+                || result.manifest) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyEncode;
+    }
+
+    if (result.elide) {
+        /* `* N` lines follow canonical lines, and only the streaming
+            encoder writes them */
+        if (result.conversion == ConversionOnlyDecode
+                || result.skip || result.length != ULLONG_MAX
+                || result.manifest
+                || result.format != HextoggleFormatCanonical) {
+            valid_args = FALSE;
+        }
+        result.conversion = ConversionOnlyEncode;
+    }
+
+    if (result.sparse) {
+        /* holes are written as `* N` lines, and whole files are
+            decoded into regular files */
+        if (result.skip || result.length != ULLONG_MAX
+                || result.manifest || result.range || result.write_index
+                || result.compression != CompressionNone
+                || result.format != HextoggleFormatCanonical) {
+            valid_args = FALSE;
+        }
+    }
+
+    if (result.direct) {
+        /* only whole files are streamed around the page cache */
+        if (result.skip || result.length != ULLONG_MAX
+                || result.manifest || result.range || result.write_index
+                || result.compression != CompressionNone
+                || result.sparse) {
+            valid_args = FALSE;
+        }
+    }
+
     if (!valid_args) {
         print_help_screen(stderr);
         result.exit_with_error = StatusCodeInvalidArgs;
@@ -1,8 +1,13 @@
 #ifndef ARGS_H
 #define ARGS_H
 
+#include "compress.h"
+#include "hextoggle.h"
+#include "search.h"
 #include "utils.h"
 
+#include <stdlib.h>
+
 typedef enum Conversion {
     ConversionAutoDetect,
     ConversionOnlyDecode,
@@ -31,6 +36,34 @@ typedef struct {
     const char *input_filename;
     OutputKind output_kind;
     const char *output_filename; /* null if we're doing a dry run */
+    unsigned jobs; /* number of threads to use */
+    BOOL range; /* only decode `range_length` bytes at `range_start` */
+    unsigned long long range_start;
+    unsigned long long range_length;
+    BOOL write_index; /* write a line index for `range` instead */
+    unsigned long long skip; /* bytes of input to skip when encoding */
+    unsigned long long length; /* bytes to encode, or ULLONG_MAX */
+    BOOL manifest; /* write `output_filename`.manifest when encoding */
+    BOOL batch; /* convert each of `batch_files` on its own */
+    const char **batch_files; /* or NULL to read a list from stdin */
+    size_t batch_file_count;
+    const char *output_directory; /* for batches, or NULL for in-place */
+    BOOL stats; /* print statistics after converting */
+    BOOL progress; /* show a status line while converting */
+    Compression compression; /* of the hex output when encoding */
+    int compression_level; /* or 0 for the default */
+    HextoggleFormat format; /* of the hex output when encoding */
+    BOOL elide; /* write `* N` lines for repeated lines */
+    BOOL sparse; /* skip holes in the input, leave holes in the output */
+    BOOL direct; /* read and write around the page cache */
+    const char *diff_filename; /* compare the input (the old file) with
+                                  this file, or NULL */
+    BOOL apply; /* patch `output_filename` with the input (a diff),
+                   unless this is a dry run */
+    BOOL search; /* write the matches of `search_pattern` in the input */
+    SearchPattern search_pattern;
+    BOOL follow; /* keep encoding what is appended to the input */
+    BOOL resume; /* continue the conversion into `output_filename` */
 } Args;
 
 /** Validate the given command-line arguments,
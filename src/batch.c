@@ -0,0 +1,267 @@
+#include "batch.h"
+
+#include "cpu.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <sys/stat.h>
+#endif
+
+enum { LIST_BUFFER_SIZE = 1 << 16 };
+
+typedef struct {
+    Args args; /* shared by all files */
+    ConvertFn convert;
+    const char **files;
+    int *statuses;
+} Batch;
+
+/* Read a NUL-separated list of file names from stdin into `*buffer`,
+ * and return an array of pointers to them, or NULL on error. */
+static const char **read_file_list(char **buffer, size_t *count) {
+    char *data, *grown;
+    const char **files;
+    size_t length = 0, capacity = LIST_BUFFER_SIZE, read_length, i;
+
+    data = (char *)malloc(capacity);
+    while (data && (read_length = fread(
+            data + length, 1, capacity - length - 1, stdin)) > 0) {
+        length += read_length;
+        if (capacity - length - 1 == 0) {
+            capacity *= 2;
+            grown = (char *)realloc(data, capacity);
+            if (!grown) {
+                free(data);
+            }
+            data = grown;
+        }
+    }
+    if (!data) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return NULL;
+    } else if (ferror(stdin)) {
+        fprintf(stderr, "Error: Unable to read file list: %s\n",
+            strerror(errno));
+        free(data);
+        return NULL;
+    }
+    /* terminate the last name */
+    data[length] = '\0';
+
+    *count = 0;
+    for (i = 0; i < length; ++i) {
+        if (data[i] && (i == 0 || !data[i - 1])) {
+            ++*count;
+        }
+    }
+    files = (const char **)malloc((*count + 1) * sizeof(const char *));
+    if (!files) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        free(data);
+        return NULL;
+    }
+    *count = 0;
+    for (i = 0; i < length; ++i) {
+        if (data[i] && (i == 0 || !data[i - 1])) {
+            files[(*count)++] = data + i;
+        }
+    }
+    *buffer = data;
+    return files;
+}
+
+/* The name of `file` without its directory. */
+static const char *base_name(const char *file) {
+    const char *name = strrchr(file, '/');
+#ifdef _MSC_VER
+    const char *backslash = strrchr(file, '\\');
+    if (backslash && (!name || backslash > name)) {
+        name = backslash;
+    }
+#endif
+    return name ? name + 1 : file;
+}
+
+static int compare_base_names(const void *first, const void *second) {
+    return strcmp(base_name(*(const char *const *)first),
+        base_name(*(const char *const *)second));
+}
+
+static int compare_names(const void *first, const void *second) {
+    return strcmp(*(const char *const *)first,
+        *(const char *const *)second);
+}
+
+/* Check that no two files of the batch are written to the same output,
+ * which their jobs would write at the same time. Files written to
+ * `directory` (or in place, if it's NULL) only keep their base names.
+ * Returns FALSE after reporting the first clash. */
+static BOOL check_outputs(const char **files, size_t count,
+        const char *directory) {
+    const char **sorted;
+    size_t i;
+    BOOL unique = TRUE;
+
+    sorted = (const char **)malloc((count + 1) * sizeof(const char *));
+    if (!sorted) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return FALSE;
+    }
+    memcpy(sorted, files, count * sizeof(const char *));
+    qsort(sorted, count, sizeof(const char *),
+        directory ? compare_base_names : compare_names);
+    for (i = 1; i < count && unique; ++i) {
+        if (directory && !compare_base_names(&sorted[i - 1], &sorted[i])) {
+            fprintf(stderr, "Error: `%s` and `%s` would both be written "
+                "to `%s/%s`\n", sorted[i - 1], sorted[i], directory,
+                base_name(sorted[i]));
+            unique = FALSE;
+        } else if (!directory && !compare_names(&sorted[i - 1], &sorted[i])) {
+            fprintf(stderr, "Error: `%s` is in the batch twice\n",
+                sorted[i]);
+            unique = FALSE;
+        }
+    }
+    free((void *)sorted);
+    return unique;
+}
+
+/* Build the path of the file `file` in `directory`. Returns a buffer
+ * allocated with malloc, or NULL on error. */
+static char *output_path(const char *directory, const char *file) {
+    const char *name = base_name(file);
+    char *path;
+
+    path = (char *)malloc(strlen(directory) + strlen(name) + 2);
+    if (path) {
+        sprintf(path, "%s/%s", directory, name);
+    }
+    return path;
+}
+
+/* Whether `first` and `second` name the same existing file, even when
+ * the names differ (like `a.bin` and `./a.bin`). */
+static BOOL is_same_file(const char *first, const char *second) {
+#ifndef _MSC_VER
+    struct stat first_info, second_info;
+
+    return !stat(first, &first_info) && !stat(second, &second_info)
+        && first_info.st_dev == second_info.st_dev
+        && first_info.st_ino == second_info.st_ino;
+#else
+    /* Windows doesn't report inode numbers */
+    return !strcmp(first, second);
+#endif
+}
+
+static void convert_job(void *context, size_t job, unsigned worker) {
+    Batch *batch = (Batch *)context;
+    Args args = batch->args;
+    char *path = NULL;
+
+    (void)worker;
+    args.batch = FALSE;
+    args.jobs = 1;
+    args.input_kind = InputKindFileName;
+    args.input_filename = batch->files[job];
+    if (args.output_kind != OutputKindNone) {
+        args.output_kind = OutputKindFileName;
+        args.output_filename = args.input_filename;
+        if (args.output_directory) {
+            path = output_path(args.output_directory, args.input_filename);
+            if (!path) {
+                batch->statuses[job] = StatusCodeFailedToOpenFiles;
+                return;
+            }
+            /* a file that is already in the output directory is
+                converted in place, through a temporary file */
+            if (!is_same_file(path, args.input_filename)) {
+                args.output_filename = path;
+            }
+        }
+    }
+    batch->statuses[job] = batch->convert(args);
+    free(path);
+}
+
+int run_batch(Args args, ConvertFn convert) {
+    Batch batch;
+    ThreadPool *pool = NULL;
+    char *list = NULL;
+    size_t count, i, failures = 0;
+    int result = EXIT_SUCCESS;
+
+    batch.args = args;
+    batch.convert = convert;
+    if (args.batch_files) {
+        batch.files = args.batch_files;
+        count = args.batch_file_count;
+    } else {
+        batch.files = read_file_list(&list, &count);
+        if (!batch.files) {
+            return StatusCodeFailedToOpenFiles;
+        }
+    }
+    if (args.output_kind != OutputKindNone
+            && !check_outputs(batch.files, count, args.output_directory)) {
+        if (list) {
+            free((void *)batch.files);
+            free(list);
+        }
+        return StatusCodeInvalidArgs;
+    }
+    batch.statuses = (int *)calloc(count + 1, sizeof(int));
+    if (!batch.statuses) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        if (list) {
+            free((void *)batch.files);
+            free(list);
+        }
+        return StatusCodeFailedToOpenFiles;
+    }
+
+    if (args.jobs > 1 && count > 1) {
+        /* detect the SIMD kernels before any worker threads use them */
+        cpu_features();
+        pool = thread_pool_create(
+            count < args.jobs ? (unsigned)count : args.jobs);
+    }
+    if (pool) {
+        thread_pool_run(pool, convert_job, &batch, count);
+        thread_pool_destroy(pool);
+    } else {
+        for (i = 0; i < count; ++i) {
+            convert_job(&batch, i, 0);
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (batch.statuses[i] != EXIT_SUCCESS) {
+            fprintf(stderr, "Error: Unable to convert `%s`: %s\n",
+                batch.files[i], status_code_description(batch.statuses[i]));
+            ++failures;
+            if (batch.statuses[i] > result) {
+                result = batch.statuses[i];
+            }
+        }
+    }
+    if (failures) {
+        fprintf(stderr, "%llu of %llu files failed\n",
+            (unsigned long long)failures, (unsigned long long)count);
+    } else if (args.verbose) {
+        fprintf(stderr, "Converted %llu files\n",
+            (unsigned long long)count);
+    }
+
+    free(batch.statuses);
+    if (list) {
+        free((void *)batch.files);
+        free(list);
+    }
+    return result;
+}
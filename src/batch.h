@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/* converting many files in one process */
+
+#include "args.h"
+
+/* Convert the single file described by `args`. Returns EXIT_SUCCESS or
+a `StatusCode`. */
+typedef int (*ConvertFn)(Args args);
+
+/**
+ * Convert every file of the batch described by `args` with `convert`,
+ * using `args.jobs` threads. Each file is toggled in place, or written
+ * to `args.output_directory` under the same name. Files that fail are
+ * reported with the description of their status code. Nothing is
+ * converted if two files would be written to the same output.
+ *
+ * Return value: EXIT_SUCCESS if every file was converted, or the
+ *     largest `StatusCode` of any file */
+int run_batch(Args args, ConvertFn convert);
+
+#endif /* BATCH_H */
@@ -1,7 +1,16 @@
 #include "bin_to_hex.h"
 
+#include "cpu.h"
 #include "utils.h"
 
+#include <string.h>
+
+#ifdef CPU_X86
+#  include <immintrin.h>
+#endif
+
+static const char HEX_DIGITS[17] = "0123456789abcdef";
+
 static char char_to_hex(char input, BOOL first) {
     if (first) {
         return int_to_hex_char((int)((input >> 4) & 0xF));
@@ -10,17 +19,8 @@ static char char_to_hex(char input, BOOL first) {
     }
 }
 
-/** Convert (up to) 16 bytes of binary data
- *      to (up to) 81 bytes of output.
- * `input` needs to point to `input_size` bytes of data (up to 16),
- * `addr` describes the overall offset in the input file, and `output`
- *      needs to point to 81 bytes of writable space. */
-static size_t bin_block_to_hex(
-        const char *input,
-        size_t input_size,
-        unsigned long long addr,
-        char *output) {
-    size_t output_size = 81;
+/* Write the 24-character address column for `addr` to `output`. */
+static void format_address(unsigned long long addr, char *output) {
     output[0] = '[';
     output[1] = int_to_hex_char((addr >> 36) & 0xF);
     output[2] = int_to_hex_char((addr >> 32) & 0xF);
@@ -45,6 +45,333 @@ static size_t bin_block_to_hex(
     output[21] = '0' + addr / 10 % 10;
     output[22] = '0' + addr % 10;
     output[23] = ']';
+}
+
+/* Advance a formatted address column by one line (16 bytes) without
+ * redoing the divisions in `format_address`. Both columns wrap the same
+ * way `format_address` does because overflow out of the most
+ * significant digit is dropped. */
+static void next_address(char *address) {
+    int i, digit, carry;
+    for (i = 9; i >= 1; --i) {
+        if (address[i] == '9') {
+            address[i] = 'a';
+            break;
+        } else if (address[i] != 'f') {
+            ++address[i];
+            break;
+        }
+        address[i] = '0';
+    }
+    carry = 16;
+    for (i = 22; i >= 12 && carry; --i) {
+        digit = address[i] - '0' + carry;
+        address[i] = (char)('0' + digit % 10);
+        carry = digit / 10;
+    }
+}
+
+/* Kernels that convert `line_count` complete lines (16 bytes of input
+ * each, 81 bytes of output each). `address` holds the formatted address
+ * column of the first line and is advanced past the last one. */
+typedef void (*EncodeLinesFn)(
+    const char *input,
+    size_t line_count,
+    char *address,
+    char *output);
+
+#ifdef CPU_X86
+
+/* Shuffle masks that place the hex digits of a line into the 16-byte
+ * output ranges starting at columns 24, 40 and 56. `FIRST` masks
+ * select from the 16 digits of bytes 0-7, `SECOND` masks from the 16
+ * digits of bytes 8-15. Negative entries produce zero bytes, which are
+ * then filled in from the matching `FILL` array. */
+static const signed char LAYOUT_24_FIRST[16] = {
+    0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12 };
+static const signed char LAYOUT_40_FIRST[16] = {
+    13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+static const signed char LAYOUT_40_SECOND[16] = {
+    -1, -1, -1, -1, 0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9 };
+static const signed char LAYOUT_56_SECOND[16] = {
+    10, 11, -1, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+static const char FILL_24[16] = {
+    0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0 };
+static const char FILL_40[16] = {
+    0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0 };
+static const char FILL_56[16] = {
+    0, 0, ' ', 0, 0, 0, 0, '|', 0, 0, 0, 0, 0, 0, 0, 0 };
+#define LOAD_128(array) _mm_loadu_si128((const __m128i *)(array))
+
+/* vectorised `safe_char` */
+CPU_TARGET("sse2")
+static __m128i safe_chars_sse2(__m128i bytes) {
+    __m128i printable = _mm_and_si128(
+        _mm_cmpgt_epi8(bytes, _mm_set1_epi8(' ' - 1)),
+        _mm_cmplt_epi8(bytes, _mm_set1_epi8('~' + 1)));
+    return _mm_or_si128(
+        _mm_and_si128(printable, bytes),
+        _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+}
+
+/* convert values between 0 and 15 to hex digits */
+CPU_TARGET("sse2")
+static __m128i nibbles_to_hex_sse2(__m128i nibbles) {
+    __m128i letters = _mm_and_si128(
+        _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+        _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(
+        _mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/* SSE2 has no byte shuffle, so the digit groups are copied out of a
+ * temporary buffer */
+CPU_TARGET("sse2")
+static void encode_lines_sse2(
+        const char *input,
+        size_t line_count,
+        char *address,
+        char *output) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    char digits[32];
+    size_t line;
+    int group;
+
+    for (line = 0; line < line_count; ++line) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)input);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask);
+        __m128i low = _mm_and_si128(bytes, low_mask);
+        _mm_storeu_si128((__m128i *)digits,
+            nibbles_to_hex_sse2(_mm_unpacklo_epi8(high, low)));
+        _mm_storeu_si128((__m128i *)(digits + 16),
+            nibbles_to_hex_sse2(_mm_unpackhi_epi8(high, low)));
+        memcpy(output, address, ADDRESS_LENGTH);
+        for (group = 0; group < 8; ++group) {
+            memcpy(output + 24 + 5 * group, digits + 4 * group, 4);
+            output[28 + 5 * group] = ' ';
+        }
+        output[63] = '|';
+        _mm_storeu_si128((__m128i *)(output + 64), safe_chars_sse2(bytes));
+        output[80] = '\n';
+        next_address(address);
+        input += 16;
+        output += 81;
+    }
+}
+
+/* Convert a single line given its hex digits (`first` for bytes 0-7,
+ * `second` for bytes 8-15) and its input `bytes`. */
+CPU_TARGET("ssse3")
+static void store_line_ssse3(
+        __m128i first,
+        __m128i second,
+        __m128i bytes,
+        const char *address,
+        char *output) {
+    memcpy(output, address, ADDRESS_LENGTH);
+    _mm_storeu_si128((__m128i *)(output + 24), _mm_or_si128(
+        _mm_shuffle_epi8(first, LOAD_128(LAYOUT_24_FIRST)),
+        LOAD_128(FILL_24)));
+    _mm_storeu_si128((__m128i *)(output + 40), _mm_or_si128(
+        _mm_or_si128(
+            _mm_shuffle_epi8(first, LOAD_128(LAYOUT_40_FIRST)),
+            _mm_shuffle_epi8(second, LOAD_128(LAYOUT_40_SECOND))),
+        LOAD_128(FILL_40)));
+    /* this also writes columns 64-71, which the ASCII column below
+        overwrites */
+    _mm_storeu_si128((__m128i *)(output + 56), _mm_or_si128(
+        _mm_shuffle_epi8(second, LOAD_128(LAYOUT_56_SECOND)),
+        LOAD_128(FILL_56)));
+    _mm_storeu_si128((__m128i *)(output + 64), safe_chars_sse2(bytes));
+    output[80] = '\n';
+}
+
+CPU_TARGET("ssse3")
+static void encode_lines_ssse3(
+        const char *input,
+        size_t line_count,
+        char *address,
+        char *output) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i digits = LOAD_128(HEX_DIGITS);
+    size_t line;
+
+    for (line = 0; line < line_count; ++line) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)input);
+        __m128i high = _mm_shuffle_epi8(digits,
+            _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask));
+        __m128i low = _mm_shuffle_epi8(digits,
+            _mm_and_si128(bytes, low_mask));
+        store_line_ssse3(
+            _mm_unpacklo_epi8(high, low),
+            _mm_unpackhi_epi8(high, low),
+            bytes, address, output);
+        next_address(address);
+        input += 16;
+        output += 81;
+    }
+}
+
+/* Two lines at a time: each 128-bit lane of the AVX2 registers holds
+ * one line, so the SSSE3 shuffle masks apply unchanged. */
+CPU_TARGET("avx2")
+static void encode_lines_avx2(
+        const char *input,
+        size_t line_count,
+        char *address,
+        char *output) {
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i digits = _mm256_broadcastsi128_si256(
+        LOAD_128(HEX_DIGITS));
+    size_t line;
+
+    for (line = 0; line + 2 <= line_count; line += 2) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)input);
+        __m256i high = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_mask));
+        __m256i low = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(bytes, low_mask));
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        store_line_ssse3(
+            _mm256_castsi256_si128(first),
+            _mm256_castsi256_si128(second),
+            _mm256_castsi256_si128(bytes),
+            address, output);
+        next_address(address);
+        store_line_ssse3(
+            _mm256_extracti128_si256(first, 1),
+            _mm256_extracti128_si256(second, 1),
+            _mm256_extracti128_si256(bytes, 1),
+            address, output + 81);
+        next_address(address);
+        input += 32;
+        output += 162;
+    }
+    if (line < line_count) {
+        encode_lines_ssse3(input, line_count - line, address, output);
+    }
+}
+
+/* Four lines at a time. The hex digits are looked up with a single
+ * VPERMB, and each line's columns 24-80 (hex digits, `|`, ASCII column
+ * and newline) are assembled with two more byte permutes and written
+ * with one masked store. */
+CPU_TARGET("avx512f,avx512bw,avx512vbmi")
+static void encode_lines_avx512vbmi(
+        const char *input,
+        size_t line_count,
+        char *address,
+        char *output) {
+    /* indices for line 0, adding 16 * n selects line n */
+    unsigned char digit_index[64], ascii_index[64];
+    char fill[64];
+    unsigned long long digit_mask = 0, ascii_mask = 0;
+    const __mmask64 store_mask = (1ull << 57) - 1;
+    const __m512i low_mask = _mm512_set1_epi8(0x0f);
+    __m512i digits, digit_indices, ascii_indices, fill_chars;
+    size_t line;
+    int i;
+
+    memset(digit_index, 0, sizeof(digit_index));
+    memset(ascii_index, 0, sizeof(ascii_index));
+    memset(fill, 0, sizeof(fill));
+    for (i = 0; i < 39; ++i) {
+        int digit = i / 5 * 4 + i % 5;
+        if (i % 5 == 4) {
+            fill[i] = ' ';
+        } else {
+            /* bit 6 selects the digits of bytes 8-15 */
+            digit_index[i] = (unsigned char)(digit < 16
+                ? digit
+                : 64 + digit - 16);
+            digit_mask |= 1ull << i;
+        }
+    }
+    fill[39] = '|';
+    for (i = 40; i < 56; ++i) {
+        ascii_index[i] = (unsigned char)(i - 40);
+        ascii_mask |= 1ull << i;
+    }
+    fill[56] = '\n';
+
+    digits = _mm512_broadcast_i32x4(LOAD_128(HEX_DIGITS));
+    digit_indices = _mm512_loadu_si512((const void *)digit_index);
+    ascii_indices = _mm512_loadu_si512((const void *)ascii_index);
+    fill_chars = _mm512_loadu_si512((const void *)fill);
+
+    for (line = 0; line + 4 <= line_count; line += 4) {
+        __m512i bytes = _mm512_loadu_si512((const void *)input);
+        __m512i high = _mm512_permutexvar_epi8(
+            _mm512_and_si512(_mm512_srli_epi16(bytes, 4), low_mask),
+            digits);
+        __m512i low = _mm512_permutexvar_epi8(
+            _mm512_and_si512(bytes, low_mask), digits);
+        __m512i first = _mm512_unpacklo_epi8(high, low);
+        __m512i second = _mm512_unpackhi_epi8(high, low);
+        __mmask64 printable =
+            _mm512_cmpgt_epi8_mask(bytes, _mm512_set1_epi8(' ' - 1))
+            & _mm512_cmplt_epi8_mask(bytes, _mm512_set1_epi8('~' + 1));
+        __m512i ascii = _mm512_mask_blend_epi8(
+            printable, _mm512_set1_epi8('.'), bytes);
+        int n;
+        for (n = 0; n < 4; ++n) {
+            __m512i offset = _mm512_set1_epi8((char)(16 * n));
+            __m512i columns = _mm512_maskz_permutex2var_epi8(
+                (__mmask64)digit_mask,
+                first,
+                _mm512_add_epi8(digit_indices, offset),
+                second);
+            columns = _mm512_mask_permutexvar_epi8(
+                columns,
+                (__mmask64)ascii_mask,
+                _mm512_add_epi8(ascii_indices, offset),
+                ascii);
+            memcpy(output, address, ADDRESS_LENGTH);
+            _mm512_mask_storeu_epi8(output + 24, store_mask,
+                _mm512_or_si512(columns, fill_chars));
+            next_address(address);
+            output += 81;
+        }
+        input += 64;
+    }
+    if (line < line_count) {
+        encode_lines_avx2(input, line_count - line, address, output);
+    }
+}
+
+#endif /* CPU_X86 */
+
+/* pick the fastest kernel supported by this CPU, or NULL to use the
+ * scalar `bin_block_to_hex` */
+static EncodeLinesFn select_encode_kernel(void) {
+#ifdef CPU_X86
+    unsigned features = cpu_features();
+    if (features & CpuFeatureAVX512VBMI) {
+        return encode_lines_avx512vbmi;
+    } else if (features & CpuFeatureAVX2) {
+        return encode_lines_avx2;
+    } else if (features & CpuFeatureSSSE3) {
+        return encode_lines_ssse3;
+    } else if (features & CpuFeatureSSE2) {
+        return encode_lines_sse2;
+    }
+#endif
+    return NULL;
+}
+
+/** Convert (up to) 16 bytes of binary data
+ *      to (up to) 81 bytes of output.
+ * `input` needs to point to `input_size` bytes of data (up to 16),
+ * `addr` describes the overall offset in the input file, and `output`
+ *      needs to point to 81 bytes of writable space. */
+static size_t bin_block_to_hex(
+        const char *input,
+        size_t input_size,
+        unsigned long long addr,
+        char *output) {
+    size_t output_size = 81;
+    format_address(addr, output);
     output[24] = 0 < input_size ? char_to_hex(input[0], TRUE) : ' ';
     output[25] = 0 < input_size ? char_to_hex(input[0], FALSE) : ' ';
     output[26] = 1 < input_size ? char_to_hex(input[1], TRUE) : ' ';
@@ -116,16 +443,230 @@ size_t bin_data_to_hex(
         char *output) {
     size_t output_size = 0;
     size_t input_offset = 0;
+    size_t line_count = input_size / 16;
+    EncodeLinesFn encode_lines = select_encode_kernel();
+    if (encode_lines && line_count) {
+        char address[ADDRESS_LENGTH];
+        format_address(addr, address);
+        encode_lines(input, line_count, address, output);
+        input_offset = 16 * line_count;
+        output_size = 81 * line_count;
+        input += input_offset;
+        addr += input_offset;
+    }
     while (input_offset < input_size) {
-        size_t block_size = 16;
         if (input_size - input_offset < 16) {
-            block_size = input_size - input_offset;
+            /* partial lines are formatted like complete ones and then
+                cut short, which could write past the end of `output` */
+            char line[81];
+            size_t line_size = bin_block_to_hex(
+                input, input_size - input_offset, addr, line);
+            memcpy(output + output_size, line, line_size);
+            output_size += line_size;
+            break;
         }
         output_size += bin_block_to_hex(
-            input, block_size, addr, output + output_size);
+            input, 16, addr, output + output_size);
         input += 16;
         input_offset += 16;
         addr += 16;
     }
     return output_size;
 }
+
+unsigned long long bin_to_hex_size(unsigned long long input_size) {
+    unsigned long long size = input_size / 16 * 81;
+    if (input_size % 16) {
+        size += 65 + input_size % 16;
+    }
+    return size;
+}
+
+/* Kernels that convert `line_count` complete lines of the plain format
+ * (32 bytes of input each, 65 bytes of output each). */
+typedef void (*EncodePlainLinesFn)(
+    const char *input,
+    size_t line_count,
+    char *output);
+
+static void encode_plain_lines_scalar(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    size_t line;
+    int i;
+
+    for (line = 0; line < line_count; ++line) {
+        for (i = 0; i < PLAIN_LINE_BYTES; ++i) {
+            unsigned char byte = (unsigned char)input[i];
+            output[2 * i] = HEX_DIGITS[byte >> 4];
+            output[2 * i + 1] = HEX_DIGITS[byte & 0xf];
+        }
+        output[2 * PLAIN_LINE_BYTES] = '\n';
+        input += PLAIN_LINE_BYTES;
+        output += PLAIN_LINE_LENGTH;
+    }
+}
+
+#ifdef CPU_X86
+
+/* Plain lines need no shuffles, since the interleaved digits are
+ * already in output order. */
+CPU_TARGET("sse2")
+static void encode_plain_lines_sse2(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    size_t line;
+    int half;
+
+    for (line = 0; line < line_count; ++line) {
+        for (half = 0; half < 2; ++half) {
+            __m128i bytes = _mm_loadu_si128(
+                (const __m128i *)(input + 16 * half));
+            __m128i high = _mm_and_si128(
+                _mm_srli_epi16(bytes, 4), low_mask);
+            __m128i low = _mm_and_si128(bytes, low_mask);
+            _mm_storeu_si128((__m128i *)(output + 32 * half),
+                nibbles_to_hex_sse2(_mm_unpacklo_epi8(high, low)));
+            _mm_storeu_si128((__m128i *)(output + 32 * half + 16),
+                nibbles_to_hex_sse2(_mm_unpackhi_epi8(high, low)));
+        }
+        output[64] = '\n';
+        input += PLAIN_LINE_BYTES;
+        output += PLAIN_LINE_LENGTH;
+    }
+}
+
+/* One line per iteration. The unpacks work within 128-bit lanes, so
+ * `first` holds the digits of bytes 0-7 and 16-23, and `second` those
+ * of bytes 8-15 and 24-31. */
+CPU_TARGET("avx2")
+static void encode_plain_lines_avx2(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i digits = _mm256_broadcastsi128_si256(
+        LOAD_128(HEX_DIGITS));
+    size_t line;
+
+    for (line = 0; line < line_count; ++line) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)input);
+        __m256i high = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_mask));
+        __m256i low = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(bytes, low_mask));
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256((__m256i *)output,
+            _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *)(output + 32),
+            _mm256_permute2x128_si256(first, second, 0x31));
+        output[64] = '\n';
+        input += PLAIN_LINE_BYTES;
+        output += PLAIN_LINE_LENGTH;
+    }
+}
+
+#endif /* CPU_X86 */
+
+static EncodePlainLinesFn select_plain_encode_kernel(void) {
+#ifdef CPU_X86
+    unsigned features = cpu_features();
+    if (features & CpuFeatureAVX2) {
+        return encode_plain_lines_avx2;
+    } else if (features & CpuFeatureSSE2) {
+        return encode_plain_lines_sse2;
+    }
+#endif
+    return encode_plain_lines_scalar;
+}
+
+size_t bin_data_to_plain_hex(
+        const char *input,
+        size_t input_size,
+        char *output) {
+    size_t line_count = input_size / PLAIN_LINE_BYTES;
+    size_t rest = input_size % PLAIN_LINE_BYTES;
+    size_t output_size = line_count * PLAIN_LINE_LENGTH;
+    size_t i;
+
+    select_plain_encode_kernel()(input, line_count, output);
+    if (rest) {
+        input += line_count * PLAIN_LINE_BYTES;
+        output += output_size;
+        for (i = 0; i < rest; ++i) {
+            output[2 * i] = char_to_hex(input[i], TRUE);
+            output[2 * i + 1] = char_to_hex(input[i], FALSE);
+        }
+        output[2 * rest] = '\n';
+        output_size += 2 * rest + 1;
+    }
+    return output_size;
+}
+
+unsigned long long plain_hex_size(unsigned long long input_size) {
+    unsigned long long size
+        = input_size / PLAIN_LINE_BYTES * PLAIN_LINE_LENGTH;
+    if (input_size % PLAIN_LINE_BYTES) {
+        size += 2 * (input_size % PLAIN_LINE_BYTES) + 1;
+    }
+    return size;
+}
+
+size_t bin_data_to_format_hex(
+        HextoggleFormat format,
+        const char *input,
+        size_t input_size,
+        unsigned long long addr,
+        char *output) {
+    if (format == HextoggleFormatPlain) {
+        return bin_data_to_plain_hex(input, input_size, output);
+    }
+    return bin_data_to_hex(input, input_size, addr, output);
+}
+
+unsigned long long format_hex_size(
+        HextoggleFormat format,
+        unsigned long long input_size) {
+    if (format == HextoggleFormatPlain) {
+        return plain_hex_size(input_size);
+    }
+    return bin_to_hex_size(input_size);
+}
+
+/* Compare two lines as two 64-bit words each, which is cheap enough to
+ * do for every line. */
+static BOOL same_line(const char *a, const char *b) {
+    unsigned long long a0, a1, b0, b1;
+    memcpy(&a0, a, 8);
+    memcpy(&a1, a + 8, 8);
+    memcpy(&b0, b, 8);
+    memcpy(&b1, b + 8, 8);
+    return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+}
+
+size_t count_repeated_lines(
+        const char *input,
+        size_t line_count,
+        const char *line) {
+    size_t i;
+    for (i = 0; i < line_count; ++i) {
+        if (!same_line(input + 16 * i, line)) {
+            break;
+        }
+    }
+    return i;
+}
+
+size_t count_distinct_lines(const char *input, size_t line_count) {
+    size_t i;
+    for (i = 1; i < line_count; ++i) {
+        if (same_line(input + 16 * i, input + 16 * (i - 1))) {
+            return i;
+        }
+    }
+    return line_count;
+}
@@ -1,6 +1,9 @@
 #ifndef BIN_TO_HEX_H
 #define BIN_TO_HEX_H
 
+#include "hextoggle.h"
+#include "utils.h"
+
 #include <stdlib.h>
 
 /*
@@ -18,6 +21,12 @@ The decimal address is 11 characters long and wraps at 10^11 bytes
     (100 GB, or approx. 93 GiB).
 */
 
+/* length of a complete line and of its `[hex dec]` address column */
+enum { LINE_LENGTH = 81, ADDRESS_LENGTH = 24 };
+
+/* the bits of an address that the hex column shows */
+#define ADDRESS_MASK ((1ull << 40) - 1)
+
 /**
  * Convert binary data to hex. This function can take an arbitrary
  * amount of binary input in multiples of 16 (unless we're at the end
@@ -27,8 +36,8 @@ The decimal address is 11 characters long and wraps at 10^11 bytes
  *     unless near EOF)
  * `input_size`: size of the specified input
  * `addr`: address in overall data
- * `output`: space we can use for output, should be equal to
- *     81 * ceil(input_size / 16) bytes
+ * `output`: space we can use for output, should be at least
+ *     `bin_to_hex_size(input_size)` bytes
  * Return value: amount of data written to output */
 size_t bin_data_to_hex(
     const char *input,
@@ -36,4 +45,72 @@ size_t bin_data_to_hex(
     unsigned long long addr,
     char *output);
 
+/* Size of the output of `bin_data_to_hex` for `input_size` bytes of
+input, i.e. 81 bytes per complete line, plus 65 bytes and one byte per
+input byte for a trailing partial line. */
+unsigned long long bin_to_hex_size(unsigned long long input_size);
+
+/*
+Plain format (HextoggleFormatPlain), after its header:
+48656c6c6f2c20576f726c64210a0a2348656c6c6f2c20576f726c64210a0a23\n
+
+Each line holds 32 bytes as 64 hex digits. The last line can be shorter.
+*/
+enum { PLAIN_LINE_BYTES = 32, PLAIN_LINE_LENGTH = 65 };
+
+/* Convert binary data to the plain format, like `bin_data_to_hex`
+(`input_size` must be a multiple of 32 unless near EOF). `output` should
+be at least `plain_hex_size(input_size)` bytes. */
+size_t bin_data_to_plain_hex(
+    const char *input,
+    size_t input_size,
+    char *output);
+
+/* Size of the output of `bin_data_to_plain_hex`: 65 bytes per complete
+line, plus two bytes per input byte and a newline for a partial line. */
+unsigned long long plain_hex_size(unsigned long long input_size);
+
+/* `bin_data_to_hex` or `bin_data_to_plain_hex`, depending on `format`.
+`input_size` must be a multiple of the line size unless near EOF. */
+size_t bin_data_to_format_hex(
+    HextoggleFormat format,
+    const char *input,
+    size_t input_size,
+    unsigned long long addr,
+    char *output);
+
+/* `bin_to_hex_size` or `plain_hex_size`. For input sizes that are a
+multiple of the line size, this is also the offset of the line at that
+address. */
+unsigned long long format_hex_size(
+    HextoggleFormat format,
+    unsigned long long input_size);
+
+/* Number of lines (16 bytes each) at the start of the `line_count`
+lines of `input` that are the same as the 16 bytes at `line`. */
+size_t count_repeated_lines(
+    const char *input,
+    size_t line_count,
+    const char *line);
+
+/* Number of lines at the start of `input` before the first line that
+is the same as the one before it (`line_count` if there is none). */
+size_t count_distinct_lines(const char *input, size_t line_count);
+
+/* longest `* N` line written by elided encoders, for a 64-bit count */
+enum { REPEAT_LINE_LENGTH = 23 };
+
+/* library encoder context, see hextoggle.h */
+struct HextoggleEncoder {
+    HextoggleFormat format;
+    unsigned long long address; /* of the next line */
+    char pending[PLAIN_LINE_BYTES]; /* the start of the next line */
+    size_t pending_length;
+    BOOL write_header; /* the header hasn't been written yet */
+    BOOL elide; /* replace repeated lines with `* N` lines */
+    BOOL has_previous; /* whether `previous` holds a line */
+    char previous[16]; /* the last complete line */
+    unsigned long long repeats; /* copies of it that were left out */
+};
+
 #endif /* BIN_TO_HEX_H */
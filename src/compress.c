@@ -0,0 +1,462 @@
+#include "compress.h"
+
+#include "stats.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HEXTOGGLE_ZLIB
+#  include <zlib.h>
+#endif
+#ifdef HEXTOGGLE_ZSTD
+#  include <zstd.h>
+#endif
+
+/* READ_SIZE is the amount of input read at once. The other buffers
+    hold what it is converted to: BUFFER_SIZE bytes of compressed data
+    or decompressed hex data at a time. */
+enum { READ_SIZE = 1 << 16, BUFFER_SIZE = 1 << 16 };
+
+/* Hex digits of random data leave deflate with few matches to find, and
+    its higher levels search so long for them that gzip would run at a
+    few MB/s, for output that is less than 10% smaller. zstd's default
+    level is fast already. */
+enum { DEFAULT_GZIP_LEVEL = 1 };
+
+BOOL parse_compression(const char *name, Compression *compression,
+        int *level) {
+    const char *colon = strchr(name, ':');
+    size_t length = colon ? (size_t)(colon - name) : strlen(name);
+    char *end;
+    long value = 0;
+
+    if (length == 4 && !strncmp(name, "gzip", 4)) {
+        *compression = CompressionGzip;
+    } else if (length == 4 && !strncmp(name, "zstd", 4)) {
+        *compression = CompressionZstd;
+    } else {
+        return FALSE;
+    }
+    if (colon) {
+        value = strtol(colon + 1, &end, 10);
+        if (*end || end == colon + 1 || value < 1
+                || value > (*compression == CompressionGzip ? 9 : 22)) {
+            return FALSE;
+        }
+    }
+    *level = (int)value;
+    return TRUE;
+}
+
+const char *compression_name(Compression compression) {
+    switch (compression) {
+        case CompressionGzip: return "gzip";
+        case CompressionZstd: return "zstd";
+        default: return "uncompressed";
+    }
+}
+
+BOOL compression_supported(Compression compression) {
+#ifdef HEXTOGGLE_ZLIB
+    if (compression == CompressionGzip) {
+        return TRUE;
+    }
+#endif
+#ifdef HEXTOGGLE_ZSTD
+    if (compression == CompressionZstd) {
+        return TRUE;
+    }
+#endif
+    (void)compression;
+    return FALSE;
+}
+
+Compression detect_compression(const char *data, size_t length) {
+    if (length >= 4 && !memcmp(data, "\x1f\x8b\x08", 3)) {
+        return CompressionGzip;
+    } else if (length >= 4 && !memcmp(data, "\x28\xb5\x2f\xfd", 4)) {
+        return CompressionZstd;
+    }
+    return CompressionNone;
+}
+
+/* a compressor or decompressor for one of the supported formats */
+typedef struct {
+    Compression compression;
+    BOOL compressing;
+    /* BUFFER_SIZE bytes for the output of `stream_run` */
+    char *buffer;
+    /* the rest of the input given to `stream_run` */
+    const char *input;
+    size_t input_length;
+    /* the compressed data is complete: everything was flushed when
+        compressing, or the end of a gzip member or zstd frame was
+        reached when decompressing */
+    BOOL ended;
+#ifdef HEXTOGGLE_ZLIB
+    z_stream zlib;
+#endif
+#ifdef HEXTOGGLE_ZSTD
+    ZSTD_CCtx *zstd_compressor;
+    ZSTD_DCtx *zstd_decompressor;
+#endif
+} Stream;
+
+static void stream_close(Stream *stream) {
+#ifdef HEXTOGGLE_ZLIB
+    if (stream->compression == CompressionGzip) {
+        if (stream->compressing) {
+            deflateEnd(&stream->zlib);
+        } else {
+            inflateEnd(&stream->zlib);
+        }
+    }
+#endif
+#ifdef HEXTOGGLE_ZSTD
+    if (stream->compression == CompressionZstd) {
+        ZSTD_freeCCtx(stream->zstd_compressor);
+        ZSTD_freeDCtx(stream->zstd_decompressor);
+    }
+#endif
+    free(stream->buffer);
+}
+
+/* `level` is only used for compressing, 0 selects the default */
+static BOOL stream_open(Stream *stream, Compression compression,
+        BOOL compressing, int level) {
+    BOOL opened = FALSE;
+
+    stream->compression = compression;
+    stream->compressing = compressing;
+    stream->input = NULL;
+    stream->input_length = 0;
+    stream->ended = FALSE;
+    stream->buffer = (char *)malloc(BUFFER_SIZE);
+    if (!stream->buffer) {
+        return FALSE;
+    }
+#ifdef HEXTOGGLE_ZLIB
+    if (compression == CompressionGzip) {
+        memset(&stream->zlib, 0, sizeof(stream->zlib));
+        /* 16 selects the gzip wrapper instead of zlib's own */
+        opened = (compressing
+            ? deflateInit2(&stream->zlib,
+                level ? level : DEFAULT_GZIP_LEVEL,
+                Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+            : inflateInit2(&stream->zlib, 15 + 16)) == Z_OK;
+    }
+#endif
+#ifdef HEXTOGGLE_ZSTD
+    if (compression == CompressionZstd) {
+        stream->zstd_compressor = NULL;
+        stream->zstd_decompressor = NULL;
+        if (compressing) {
+            stream->zstd_compressor = ZSTD_createCCtx();
+            opened = stream->zstd_compressor != NULL
+                && (!level || !ZSTD_isError(ZSTD_CCtx_setParameter(
+                    stream->zstd_compressor, ZSTD_c_compressionLevel,
+                    level)));
+        } else {
+            stream->zstd_decompressor = ZSTD_createDCtx();
+            opened = stream->zstd_decompressor != NULL;
+        }
+    }
+#endif
+    if (!opened) {
+        stream_close(stream);
+    }
+    (void)level;
+    return opened;
+}
+
+/* Convert as much of the input as fits into `capacity` bytes of
+ * `output`, ending the compressed data once all input is used if
+ * `finish` is set. Returns FALSE if the compressed data is invalid. */
+static BOOL stream_run(Stream *stream, BOOL finish,
+        char *output, size_t capacity, size_t *output_length) {
+#ifdef HEXTOGGLE_ZLIB
+    int result;
+#endif
+#ifdef HEXTOGGLE_ZSTD
+    size_t remaining;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+#endif
+
+    *output_length = 0;
+#ifdef HEXTOGGLE_ZLIB
+    if (stream->compression == CompressionGzip) {
+        if (!stream->compressing && stream->ended
+                && stream->input_length) {
+            /* another member follows */
+            inflateReset(&stream->zlib);
+            stream->ended = FALSE;
+        }
+        stream->zlib.next_in = (Bytef *)stream->input;
+        stream->zlib.avail_in = (uInt)stream->input_length;
+        stream->zlib.next_out = (Bytef *)output;
+        stream->zlib.avail_out = (uInt)capacity;
+        result = stream->compressing
+            ? deflate(&stream->zlib, finish ? Z_FINISH : Z_NO_FLUSH)
+            : inflate(&stream->zlib, Z_NO_FLUSH);
+        stream->input = (const char *)stream->zlib.next_in;
+        stream->input_length = stream->zlib.avail_in;
+        *output_length = capacity - stream->zlib.avail_out;
+        stream->ended = result == Z_STREAM_END;
+        /* Z_BUF_ERROR only means that nothing could be done */
+        return result == Z_OK || result == Z_STREAM_END
+            || result == Z_BUF_ERROR;
+    }
+#endif
+#ifdef HEXTOGGLE_ZSTD
+    if (stream->compression == CompressionZstd) {
+        in.src = stream->input;
+        in.size = stream->input_length;
+        in.pos = 0;
+        out.dst = output;
+        out.size = capacity;
+        out.pos = 0;
+        remaining = stream->compressing
+            ? ZSTD_compressStream2(stream->zstd_compressor, &out, &in,
+                finish ? ZSTD_e_end : ZSTD_e_continue)
+            : ZSTD_decompressStream(stream->zstd_decompressor, &out, &in);
+        stream->input += in.pos;
+        stream->input_length -= in.pos;
+        *output_length = out.pos;
+        if (ZSTD_isError(remaining)) {
+            return FALSE;
+        }
+        /* 0 means that the frame is complete and flushed */
+        stream->ended = remaining == 0
+            && (finish || !stream->compressing);
+        return TRUE;
+    }
+#endif
+    (void)finish;
+    (void)output;
+    (void)capacity;
+    return FALSE;
+}
+
+BOOL is_compressed_hex(Compression compression,
+        const char *data, size_t length) {
+    Stream stream;
+    char header[HEXTOGGLE_HEADER_LENGTH];
+    size_t header_length = 0, output_length, input_length;
+    BOOL valid = TRUE;
+
+    if (!stream_open(&stream, compression, FALSE, 0)) {
+        return FALSE;
+    }
+    stream.input = data;
+    stream.input_length = length;
+    /* decompressors can return after reading a header without any
+        output, so only stop once they make no progress */
+    while (valid && header_length < HEXTOGGLE_HEADER_LENGTH) {
+        input_length = stream.input_length;
+        valid = stream_run(&stream, FALSE, header + header_length,
+            HEXTOGGLE_HEADER_LENGTH - header_length, &output_length);
+        if (!output_length && input_length == stream.input_length) {
+            break;
+        }
+        header_length += output_length;
+    }
+    stream_close(&stream);
+    return valid
+        && hextoggle_detect(header, header_length) == HextoggleDetectHex;
+}
+
+/* Compress all input of `stream`, and everything that is still pending
+ * if `finish` is set, into `output_file`. Returns 0 or 1 on error. */
+static int write_compressed(Stream *stream, BOOL finish,
+        FILE *output_file) {
+    size_t length;
+    double start;
+
+    while (stream->input_length || (finish && !stream->ended)) {
+        start = stats_clock();
+        if (!stream_run(stream, finish,
+                stream->buffer, BUFFER_SIZE, &length)) {
+            fprintf(stderr, "Error: Unable to compress output\n");
+            return 1;
+        }
+        /* the bytes were counted when they were encoded */
+        stats_end(StatsConvert, start, 0);
+        if (output_file && length) {
+            start = stats_clock();
+            fwrite(stream->buffer, length, 1, output_file);
+            stats_end(StatsWrite, start, length);
+        }
+    }
+    return 0;
+}
+
+int compressed_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        Compression compression,
+        int level,
+        HextoggleFormat format,
+        BOOL elide) {
+    Stream stream;
+    HextoggleEncoder *encoder;
+    char *input, *hex;
+    size_t length, read_length, hex_length;
+    BOOL end = FALSE;
+    int status = 0;
+    double start;
+
+    encoder = hextoggle_encoder_create(1);
+    if (!encoder) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+    hextoggle_encoder_set_format(encoder, format);
+    hextoggle_encoder_set_elide(encoder, elide);
+    input = (char *)malloc(READ_SIZE
+        + hextoggle_encode_bound(encoder, READ_SIZE));
+    if (!input || !stream_open(&stream, compression, TRUE, level)) {
+        fprintf(stderr, "Error: Unable to start %s compression\n",
+            compression_name(compression));
+        free(input);
+        hextoggle_encoder_destroy(encoder);
+        return 1;
+    }
+    hex = input + READ_SIZE;
+
+    while (!end && !status) {
+        /* use up the prefix, which can be larger than READ_SIZE, before
+            reading more */
+        length = prefix_length < READ_SIZE ? prefix_length : READ_SIZE;
+        memcpy(input, prefix, length);
+        prefix += length;
+        prefix_length -= length;
+        if (!prefix_length) {
+            start = stats_clock();
+            read_length = fread(input + length, 1, READ_SIZE - length,
+                input_file);
+            stats_end(StatsRead, start, read_length);
+            length += read_length;
+        }
+        end = length < READ_SIZE;
+
+        start = stats_clock();
+        hex_length = hextoggle_encode(encoder, input, length, hex);
+        if (end) {
+            hex_length += hextoggle_encode_finish(
+                encoder, hex + hex_length);
+        }
+        stats_end(StatsConvert, start, length);
+        if (elide) {
+            stats_count_lines(hex, hex_length);
+        }
+        stream.input = hex;
+        stream.input_length = hex_length;
+        status = write_compressed(&stream, end, output_file);
+    }
+    if (ferror(input_file)) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+        status = 1;
+    }
+    stream_close(&stream);
+    free(input);
+    hextoggle_encoder_destroy(encoder);
+    return status;
+}
+
+int compressed_from_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        Compression compression,
+        HextoggleDecoder *decoder) {
+    Stream stream;
+    char *input, *output;
+    size_t length, hex_length, output_length, offset, repeat_length;
+    unsigned long long before, after, line_no, column;
+    BOOL full = FALSE;
+    int status = 0;
+    double start;
+
+    input = (char *)malloc(READ_SIZE
+        + hextoggle_decode_bound(BUFFER_SIZE));
+    if (!input || !stream_open(&stream, compression, FALSE, 0)) {
+        fprintf(stderr, "Error: Unable to start %s decompression\n",
+            compression_name(compression));
+        free(input);
+        return 2;
+    }
+    output = input + READ_SIZE;
+
+    stream.input = prefix;
+    stream.input_length = prefix_length;
+    while (!status) {
+        /* a full buffer means that more output may be pending */
+        if (!stream.input_length && !full) {
+            start = stats_clock();
+            length = fread(input, 1, READ_SIZE, input_file);
+            stats_end(StatsRead, start, length);
+            if (!length) {
+                break;
+            }
+            stream.input = input;
+            stream.input_length = length;
+        }
+
+        start = stats_clock();
+        length = stream.input_length;
+        if (!stream_run(&stream, FALSE,
+                stream.buffer, BUFFER_SIZE, &hex_length)) {
+            fprintf(stderr, "Error: Invalid %s data\n",
+                compression_name(compression));
+            status = 2;
+            break;
+        }
+        full = hex_length == BUFFER_SIZE;
+        offset = 0;
+        do {
+            /* decoding stops after each `* N` line */
+            hextoggle_decoder_position(decoder, &before, &line_no, &column);
+            status = hextoggle_decode(decoder, stream.buffer + offset,
+                hex_length - offset, output, &output_length);
+            hextoggle_decoder_position(decoder, &after, &line_no, &column);
+            offset += (size_t)(after - before);
+            stats_end(StatsConvert, start, length - stream.input_length);
+            length = stream.input_length;
+
+            if (output_file && output_length) {
+                start = stats_clock();
+                fwrite(output, output_length, 1, output_file);
+                stats_end(StatsWrite, start, output_length);
+            }
+            while (status == HEXTOGGLE_REPEAT && (repeat_length
+                    = hextoggle_decode_repeat(decoder, output,
+                        hextoggle_decode_bound(BUFFER_SIZE))) > 0) {
+                start = stats_clock();
+                if (output_file) {
+                    fwrite(output, repeat_length, 1, output_file);
+                }
+                stats_end(StatsWrite, start, repeat_length);
+            }
+            if (status == HEXTOGGLE_REPEAT) {
+                status = 0;
+            }
+            start = stats_clock();
+        } while (!status && offset < hex_length);
+    }
+    if (ferror(input_file)) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+        status = 2;
+    } else if (!status && !stream.ended) {
+        fprintf(stderr, "Error: Truncated %s data\n",
+            compression_name(compression));
+        status = 2;
+    }
+    stream_close(&stream);
+    free(input);
+    return status;
+}
@@ -0,0 +1,76 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+/* hex files compressed with gzip or zstd, which are converted in a
+single pass without an uncompressed copy. Each format is only available
+if its library was found at build time (HEXTOGGLE_ZLIB, HEXTOGGLE_ZSTD). */
+
+#include "hextoggle.h"
+#include "utils.h"
+
+#include <stdio.h>
+
+typedef enum {
+    CompressionNone,
+    CompressionGzip,
+    CompressionZstd
+} Compression;
+
+/* Amount of input to read for `is_compressed_hex`. zstd only produces
+output once a whole block (up to 128 KiB) has been read, and gzip
+headers can contain a file name. */
+enum { COMPRESSION_PROBE_SIZE = (1 << 17) + 4096 };
+
+/* Parse a format name ("gzip" or "zstd"), optionally followed by a
+colon and a compression level. `level` is set to 0 for the default
+level. Returns FALSE for anything else. */
+BOOL parse_compression(const char *name, Compression *compression,
+    int *level);
+
+const char *compression_name(Compression compression);
+
+/* Whether this build can read and write `compression`. */
+BOOL compression_supported(Compression compression);
+
+/* Recognise compressed data by its magic bytes. This needs at least 4
+bytes of data, and returns CompressionNone for anything else. */
+Compression detect_compression(const char *data, size_t length);
+
+/* Whether the `length` bytes at `data`, which start a file in the
+supported format `compression`, decompress to the hextoggle header. */
+BOOL is_compressed_hex(Compression compression,
+    const char *data, size_t length);
+
+/**
+ * Encode `input_file` in `format`, header included, and write the hex
+ * output compressed with `compression`.
+ *
+ * `prefix`: data already read from `input_file`
+ * `level`: the compression level, or 0 for the default
+ * `elide`: whether to elide repeated lines (see
+ *     `hextoggle_encoder_set_elide`)
+ * Return value: 0 on success, 1 on error */
+int compressed_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length,
+    Compression compression,
+    int level,
+    HextoggleFormat format,
+    BOOL elide);
+
+/**
+ * Decompress `input_file` and decode the hex data with `decoder`.
+ * Concatenated gzip members or zstd frames are read one after another.
+ *
+ * `prefix`: data already read from `input_file`, including the magic
+ * Return value: 0 on success, 1 if the hex data is invalid (see
+ *     `hextoggle_decoder_position`), or 2 on any other error */
+int compressed_from_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length,
+    Compression compression,
+    HextoggleDecoder *decoder);
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,106 @@
+#include "cpu.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+#  include <intrin.h>
+#elif defined(CPU_X86)
+#  include <cpuid.h>
+#endif
+
+static BOOL features_detected = FALSE;
+static unsigned detected_features = 0;
+static unsigned feature_mask = ~0u;
+
+#ifdef CPU_X86
+
+static void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    regs[0] = (unsigned)info[0];
+    regs[1] = (unsigned)info[1];
+    regs[2] = (unsigned)info[2];
+    regs[3] = (unsigned)info[3];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* register state the OS saves on context switches (XCR0) */
+static unsigned long long xgetbv(void) {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static unsigned detect_features(void) {
+    unsigned regs[4];
+    unsigned max_leaf, result = 0;
+    unsigned long long xcr0 = 0;
+
+    cpuid(0, 0, regs);
+    max_leaf = regs[0];
+    if (max_leaf < 1) {
+        return 0;
+    }
+
+    cpuid(1, 0, regs);
+    if (regs[3] & (1u << 26)) {
+        result |= CpuFeatureSSE2;
+    }
+    if (regs[2] & (1u << 9)) {
+        result |= CpuFeatureSSSE3;
+    }
+    /* OSXSAVE: AVX registers are only usable if the OS saves them */
+    if (regs[2] & (1u << 27)) {
+        xcr0 = xgetbv();
+    }
+    if (max_leaf < 7) {
+        return result;
+    }
+
+    cpuid(7, 0, regs);
+    /* XMM and YMM state */
+    if ((xcr0 & 0x6) == 0x6 && (regs[1] & (1u << 5))) {
+        result |= CpuFeatureAVX2;
+    }
+    /* opmask, ZMM0-15 and ZMM16-31 state, AVX512F and AVX512BW */
+    if ((xcr0 & 0xe6) == 0xe6
+            && (regs[1] & (1u << 16))
+            && (regs[1] & (1u << 30))) {
+        result |= CpuFeatureAVX512BW;
+        if (regs[2] & (1u << 1)) {
+            result |= CpuFeatureAVX512VBMI;
+        }
+    }
+    return result;
+}
+
+#else
+
+static unsigned detect_features(void) {
+    return 0;
+}
+
+#endif /* CPU_X86 */
+
+unsigned cpu_features(void) {
+    if (!features_detected) {
+        detected_features = getenv("HEXTOGGLE_NO_SIMD")
+            ? 0
+            : detect_features();
+        features_detected = TRUE;
+    }
+    return detected_features & feature_mask;
+}
+
+void cpu_restrict_features(unsigned mask) {
+    feature_mask = mask;
+}
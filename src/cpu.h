@@ -0,0 +1,37 @@
+#ifndef CPU_H
+#define CPU_H
+
+/* runtime detection of the CPU features used by the SIMD kernels */
+
+#if defined(__x86_64__) || defined(__i386__) \
+    || defined(_M_X64) || defined(_M_IX86)
+#  define CPU_X86 1
+#endif
+
+/* Mark a function as compiled for the given instruction set extensions
+(e.g. CPU_TARGET("avx2")). MSVC doesn't need this because it allows
+intrinsics for any instruction set in any function. */
+#if defined(__GNUC__) || defined(__clang__)
+#  define CPU_TARGET(features) __attribute__((target(features)))
+#else
+#  define CPU_TARGET(features)
+#endif
+
+typedef enum {
+    CpuFeatureSSE2 = 1 << 0,
+    CpuFeatureSSSE3 = 1 << 1,
+    CpuFeatureAVX2 = 1 << 2,
+    CpuFeatureAVX512BW = 1 << 3,
+    CpuFeatureAVX512VBMI = 1 << 4
+} CpuFeature;
+
+/* Returns a bitmask of `CpuFeature` values supported by both the CPU
+and the operating system. Setting the `HEXTOGGLE_NO_SIMD` environment
+variable disables all of them. */
+unsigned cpu_features(void);
+
+/* Only report features that are also present in `mask`. Used to
+exercise the fallback kernels. */
+void cpu_restrict_features(unsigned mask);
+
+#endif /* CPU_H */
@@ -0,0 +1,432 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "diff.h"
+
+#include "bin_to_hex.h"
+#include "hex_to_bin.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *diff_header = "| hextoggle diff file";
+
+/* CHUNK_SIZE is the amount of each file compared by each job, which is
+    a whole number of lines */
+enum { CHUNK_SIZE = 1 << 20, CHUNK_LINES = CHUNK_SIZE / 16 };
+
+/* Blocks of BLOCK_SIZE bytes are compared at once, and only the lines
+    of blocks that differ are compared one by one. */
+enum { BLOCK_SIZE = 4096 };
+
+/* longest line of a diff that isn't a comment */
+enum { DIFF_LINE_SIZE = 4096 };
+
+typedef struct {
+    /* one buffer per job slot: CHUNK_SIZE bytes of the old file
+        followed by CHUNK_SIZE bytes of the new one */
+    char **buffers;
+    size_t *old_lengths;
+    size_t *new_lengths;
+    unsigned **lines; /* per job: the lines that differ, in order */
+    size_t *line_counts;
+} DiffJobs;
+
+/* Length of the line at `offset` in `length` bytes of data. */
+static size_t line_length(size_t length, size_t offset) {
+    if (offset >= length) {
+        return 0;
+    }
+    return length - offset < 16 ? length - offset : 16;
+}
+
+static void compare_chunk(void *context, size_t job, unsigned worker) {
+    DiffJobs *jobs = (DiffJobs *)context;
+    const char *old_data = jobs->buffers[job];
+    const char *new_data = old_data + CHUNK_SIZE;
+    size_t old_length = jobs->old_lengths[job];
+    size_t new_length = jobs->new_lengths[job];
+    size_t length = old_length > new_length ? old_length : new_length;
+    size_t common = old_length < new_length ? old_length : new_length;
+    size_t block, offset, end, old_line;
+    size_t count = 0;
+    (void)worker;
+
+    for (block = 0; block < length; block += BLOCK_SIZE) {
+        end = block + BLOCK_SIZE;
+        if (end <= common
+                && !memcmp(old_data + block, new_data + block, BLOCK_SIZE)) {
+            continue;
+        }
+        for (offset = block; offset < end && offset < length; offset += 16) {
+            old_line = line_length(old_length, offset);
+            if (old_line != line_length(new_length, offset)
+                    || memcmp(old_data + offset, new_data + offset,
+                        old_line)) {
+                jobs->lines[job][count++] = (unsigned)(offset / 16);
+            }
+        }
+    }
+    jobs->line_counts[job] = count;
+}
+
+static void write_identical(FILE *output_file, unsigned long long count) {
+    if (output_file && count) {
+        fprintf(output_file, "| %llu identical line%s\n",
+            count, count == 1 ? "" : "s");
+    }
+}
+
+/* Write the old version of a line as a comment, followed by the new
+ * version. Either of them can be empty. */
+static void write_line_pair(FILE *output_file,
+        const char *old_data, size_t old_length,
+        const char *new_data, size_t new_length,
+        unsigned long long address) {
+    char output[2 + 2 * LINE_LENGTH];
+    size_t length = 0;
+
+    if (old_length) {
+        output[0] = '|';
+        output[1] = '-';
+        length = 2 + bin_data_to_hex(old_data, old_length, address,
+            output + 2);
+    }
+    if (new_length) {
+        length += bin_data_to_hex(new_data, new_length, address,
+            output + length);
+    }
+    if (output_file) {
+        fwrite(output, length, 1, output_file);
+    }
+    stats_count(StatsWrite, length);
+}
+
+int diff_files(FILE *old_file,
+        const char *old_filename,
+        const char *new_filename,
+        FILE *output_file,
+        unsigned jobs,
+        BOOL verbose) {
+    FILE *new_file;
+    DiffJobs state;
+    ThreadPool *pool = NULL;
+    unsigned long long old_size = 0, new_size = 0, read_length, compared;
+    unsigned long long first_line = 0, next_line = 0, line;
+    unsigned long long differing = 0, total_lines;
+    size_t i, job, job_count, offset;
+    BOOL allocated, done = FALSE;
+    int result = 2;
+    double start;
+
+    new_file = fopen(new_filename, "rb");
+    if (!new_file) {
+        fprintf(stderr, "Unable to open file `%s` for reading: %s\n",
+            new_filename, strerror(errno));
+        return 1;
+    }
+
+    state.buffers = (char **)calloc(jobs, sizeof(char *));
+    state.old_lengths = (size_t *)calloc(jobs, sizeof(size_t));
+    state.new_lengths = (size_t *)calloc(jobs, sizeof(size_t));
+    state.lines = (unsigned **)calloc(jobs, sizeof(unsigned *));
+    state.line_counts = (size_t *)calloc(jobs, sizeof(size_t));
+    allocated = state.buffers && state.old_lengths && state.new_lengths
+        && state.lines && state.line_counts;
+    for (i = 0; allocated && i < jobs; ++i) {
+        state.buffers[i] = (char *)malloc(2 * (size_t)CHUNK_SIZE);
+        state.lines[i] = (unsigned *)malloc(
+            CHUNK_LINES * sizeof(unsigned));
+        allocated = state.buffers[i] && state.lines[i];
+    }
+    if (!allocated) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        goto cleanup;
+    }
+    if (jobs > 1 && !(pool = thread_pool_create(jobs))) {
+        goto cleanup;
+    }
+
+    if (output_file) {
+        fprintf(output_file, "%s\n| --- %s\n| +++ %s\n", diff_header,
+            old_filename ? old_filename : "-", new_filename);
+    }
+    while (!done) {
+        /* read a chunk of both files per job, until both have ended */
+        start = stats_clock();
+        read_length = 0;
+        compared = 0;
+        for (job_count = 0; job_count < jobs && !done; ) {
+            state.old_lengths[job_count] = fread(
+                state.buffers[job_count], 1, CHUNK_SIZE, old_file);
+            state.new_lengths[job_count] = fread(
+                state.buffers[job_count] + CHUNK_SIZE, 1, CHUNK_SIZE,
+                new_file);
+            old_size += state.old_lengths[job_count];
+            new_size += state.new_lengths[job_count];
+            read_length += state.old_lengths[job_count]
+                + state.new_lengths[job_count];
+            /* progress is measured in the longer file */
+            compared += state.old_lengths[job_count]
+                > state.new_lengths[job_count]
+                ? state.old_lengths[job_count]
+                : state.new_lengths[job_count];
+            done = state.old_lengths[job_count] < CHUNK_SIZE
+                && state.new_lengths[job_count] < CHUNK_SIZE;
+            if (state.old_lengths[job_count]
+                    || state.new_lengths[job_count]) {
+                ++job_count;
+            }
+        }
+        stats_end(StatsRead, start, read_length);
+        if (ferror(old_file) || ferror(new_file)) {
+            fprintf(stderr, "Error: Unable to read input: %s\n",
+                strerror(errno));
+            goto cleanup;
+        }
+
+        start = stats_clock();
+        if (pool) {
+            thread_pool_run(pool, compare_chunk, &state, job_count);
+        } else {
+            for (job = 0; job < job_count; ++job) {
+                compare_chunk(&state, job, 0);
+            }
+        }
+        stats_end(StatsConvert, start, compared);
+
+        /* write the lines that differ in order */
+        for (job = 0; job < job_count; ++job) {
+            differing += state.line_counts[job];
+            for (i = 0; i < state.line_counts[job]; ++i) {
+                line = first_line + state.lines[job][i];
+                offset = (size_t)state.lines[job][i] * 16;
+                write_identical(output_file, line - next_line);
+                write_line_pair(output_file,
+                    state.buffers[job] + offset,
+                    line_length(state.old_lengths[job], offset),
+                    state.buffers[job] + CHUNK_SIZE + offset,
+                    line_length(state.new_lengths[job], offset),
+                    line * 16);
+                next_line = line + 1;
+            }
+            first_line += CHUNK_LINES;
+        }
+    }
+
+    total_lines = ((old_size > new_size ? old_size : new_size) + 15) / 16;
+    write_identical(output_file, total_lines - next_line);
+    if (output_file) {
+        fprintf(output_file, "| %llu bytes before, %llu bytes after\n",
+            old_size, new_size);
+    }
+    if (verbose) {
+        fprintf(stderr, "%llu of %llu lines differ\n",
+            differing, total_lines);
+    }
+    result = 0;
+
+cleanup:
+    if (pool) {
+        thread_pool_destroy(pool);
+    }
+    for (i = 0; state.buffers && state.lines && i < jobs; ++i) {
+        free(state.buffers[i]);
+        free(state.lines[i]);
+    }
+    free(state.buffers);
+    free(state.old_lengths);
+    free(state.new_lengths);
+    free(state.lines);
+    free(state.line_counts);
+    fclose(new_file);
+    return result;
+}
+
+/* Parse the hex address column at the start of `line`. */
+static BOOL parse_address(const char *line, unsigned long long *address) {
+    unsigned long long value = 0;
+    int i;
+
+    if (line[0] != '[') {
+        return FALSE;
+    }
+    for (i = 1; i <= 10; ++i) {
+        if (!isxdigit((unsigned char)line[i])) {
+            return FALSE;
+        }
+        value = value * 16 + (unsigned)hex_char_to_int(line[i]);
+    }
+    *address = value;
+    return line[11] == ' ';
+}
+
+/* Go through the lines of `diff_file`, checking the old versions
+ * against `target` if `check` is set, or otherwise writing the new
+ * versions to it. The sizes of the last line are stored in `before` and
+ * `after`. Returns 0, or 2 on error. */
+static int apply_lines(FILE *diff_file,
+        FILE *target,
+        const char *target_filename,
+        BOOL check,
+        unsigned long long *before,
+        unsigned long long *after) {
+    char line[DIFF_LINE_SIZE];
+    char data[DIFF_LINE_SIZE / 2], current[DIFF_LINE_SIZE / 2];
+    const char *text;
+    unsigned long long line_no = 0, address = 0, column;
+    size_t length, data_length, header_length = strlen(diff_header);
+    BOOL old_version, sizes_found = FALSE;
+    FromHexData hex;
+    int ch;
+
+    while (fgets(line, sizeof(line), diff_file)) {
+        ++line_no;
+        length = strlen(line);
+        old_version = line[0] == '|' && line[1] == '-';
+        if (line_no == 1 && (strncmp(line, diff_header, header_length)
+                || !isspace((unsigned char)line[header_length]))) {
+            fprintf(stderr, "Error: the input is not a hextoggle diff\n");
+            return 2;
+        } else if (!length || (line[length - 1] != '\n'
+                && length < sizeof(line) - 1 && !feof(diff_file))) {
+            /* fgets only stops early at a newline, so the line has a
+                NUL byte */
+            fprintf(stderr, "Error: invalid diff at line %llu\n", line_no);
+            return 2;
+        } else if (line[length - 1] != '\n' && !feof(diff_file)) {
+            /* only comments can be this long */
+            if (line[0] != '|' || old_version) {
+                fprintf(stderr, "Error: line %llu of the diff is too "
+                    "long\n", line_no);
+                return 2;
+            }
+            while ((ch = getc(diff_file)) != EOF && ch != '\n') {
+            }
+            continue;
+        }
+
+        if (sscanf(line, "| %llu bytes before, %llu bytes after",
+                before, after) == 2) {
+            sizes_found = TRUE;
+            continue;
+        } else if ((line[0] == '|' && !old_version)
+                || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        /* the address column wraps, but the lines are in order */
+        text = old_version ? line + 2 : line;
+        if (!parse_address(text, &column)) {
+            fprintf(stderr, "Error: invalid diff at line %llu\n", line_no);
+            return 2;
+        }
+        column |= address & ~ADDRESS_MASK;
+        if (column < address) {
+            column += ADDRESS_MASK + 1;
+        }
+        address = column;
+        hex = init_from_hex_data();
+        if (hex_data_to_bin(&hex, text, strlen(text), data,
+                &data_length)) {
+            fprintf(stderr, "Error: invalid diff at line %llu, col %llu\n",
+                line_no, from_hex_column(&hex) + (old_version ? 2 : 0));
+            return 2;
+        }
+
+        if (check && old_version) {
+            if (!seek_to(target, address)
+                    || fread(current, 1, data_length, target) != data_length
+                    || memcmp(current, data, data_length)) {
+                fprintf(stderr, "Error: `%s` doesn't match line %llu of "
+                    "the diff\n", target_filename, line_no);
+                return 2;
+            }
+        } else if (!check && !old_version && data_length) {
+            if (!seek_to(target, address)
+                    || fwrite(data, data_length, 1, target) != 1) {
+                fprintf(stderr, "Error: Unable to write to `%s`: %s\n",
+                    target_filename, strerror(errno));
+                return 2;
+            }
+        }
+    }
+
+    if (ferror(diff_file)) {
+        fprintf(stderr, "Error: Unable to read the diff: %s\n",
+            strerror(errno));
+        return 2;
+    } else if (!sizes_found) {
+        fprintf(stderr, "Error: the diff is incomplete\n");
+        return 2;
+    }
+    return 0;
+}
+
+int apply_diff(FILE *diff_file,
+        const char *target_filename,
+        BOOL write,
+        BOOL verbose) {
+    FILE *target;
+    unsigned long long start, size = 0, before, after;
+    int result;
+
+#ifdef _MSC_VER
+    __int64 position = _ftelli64(diff_file);
+#else
+    off_t position = ftello(diff_file);
+#endif
+    if (position < 0) {
+        fprintf(stderr, "Error: the diff needs to be seekable\n");
+        return 2;
+    }
+    start = (unsigned long long)position;
+
+    target = fopen(target_filename, write ? "r+b" : "rb");
+    if (!target) {
+        fprintf(stderr, "Unable to open file `%s` for %s: %s\n",
+            target_filename, write ? "writing" : "reading",
+            strerror(errno));
+        return 1;
+    }
+
+    /* check everything before writing anything */
+    result = apply_lines(diff_file, target, target_filename, TRUE,
+        &before, &after);
+    if (!result && (!get_file_size(target, &size) || size != before)) {
+        fprintf(stderr, "Error: `%s` has %llu bytes instead of %llu\n",
+            target_filename, size, before);
+        result = 2;
+    }
+    if (!result && write) {
+        if (!seek_to(diff_file, start)) {
+            fprintf(stderr, "Error: the diff needs to be seekable\n");
+            result = 2;
+        } else {
+            result = apply_lines(diff_file, target, target_filename, FALSE,
+                &before, &after);
+        }
+        if (!result && !truncate_file(target, after)) {
+            fprintf(stderr, "Error: Unable to resize `%s`: %s\n",
+                target_filename, strerror(errno));
+            result = 2;
+        }
+    }
+    if (!result && verbose) {
+        fprintf(stderr, "%s `%s` (%llu bytes)\n",
+            write ? "Patched" : "The diff applies to", target_filename,
+            after);
+    }
+
+    if (fclose(target) && !result) {
+        fprintf(stderr, "Error: Unable to write to `%s`: %s\n",
+            target_filename, strerror(errno));
+        result = 2;
+    }
+    return result;
+}
@@ -0,0 +1,56 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+/* binary diffs: the lines where two binary files differ, written in the
+canonical hex format with both versions of each line. Only the new
+versions are hex data, so decoding a diff gives the changed lines. */
+
+#include "utils.h"
+
+#include <stdio.h>
+
+/*
+Format:
+| hextoggle diff file
+| --- old.bin
+| +++ new.bin
+| 4 identical lines
+|-[0000000040 00000000064]4865 6c6c 6f2c 2057 6f72 6c64 210a 0a23|Hell...
+[0000000040 00000000064]4865 6c6c 6f2c 2057 6f72 6c64 2121 0a23|Hell...
+| 1022 identical lines
+| 16400 bytes before, 16400 bytes after
+
+Lines that only one of the files has are only written in one version.
+*/
+
+/**
+ * Compare `old_file` with the file `new_filename` 16-byte line by line,
+ * and write the diff to `output_file` (if it isn't NULL). Both files
+ * are read a chunk per job at a time, and the chunks are compared on
+ * `jobs` threads.
+ *
+ * `old_filename`: the name written to the diff, can be NULL for stdin
+ * Return value: 0 on success (whether or not the files differ), 1 if
+ *     the new file can't be opened, or 2 on any other error */
+int diff_files(FILE *old_file,
+    const char *old_filename,
+    const char *new_filename,
+    FILE *output_file,
+    unsigned jobs,
+    BOOL verbose);
+
+/**
+ * Apply the diff `diff_file` to the file `target_filename`, which needs
+ * to match the old versions of the lines in it (and have the old size).
+ * The whole diff is checked before anything is written, so the diff
+ * needs to be seekable. If `write` isn't set, it's only checked.
+ *
+ * Return value: 0 on success, 1 if the target can't be opened, or 2 if
+ *     the diff is invalid, doesn't match the target or can't be
+ *     applied */
+int apply_diff(FILE *diff_file,
+    const char *target_filename,
+    BOOL write,
+    BOOL verbose);
+
+#endif /* DIFF_H */
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "direct_io.h"
+
+#include "bin_to_hex.h"
+#include "hex_to_bin.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __linux__
+
+int direct_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        HextoggleFormat format,
+        BOOL elide) {
+    (void)input_file;
+    (void)output_file;
+    (void)prefix;
+    (void)prefix_length;
+    (void)format;
+    (void)elide;
+    return DIRECT_IO_UNSUPPORTED;
+}
+
+int direct_from_hex(FILE *input_file,
+        FILE *output_file,
+        HextoggleDecoder *decoder) {
+    (void)input_file;
+    (void)output_file;
+    (void)decoder;
+    return DIRECT_IO_UNSUPPORTED;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* O_DIRECT needs buffers, offsets and lengths that are multiples of the
+    logical block size of the device, which is at most this */
+enum { DIRECT_ALIGNMENT = 4096 };
+
+/* READ_SIZE is the amount of input to convert at once. */
+enum { READ_SIZE = 1 << 20 };
+
+typedef enum {
+    CacheStdio, /* not a regular file, so the FILE is used as usual */
+    CacheDirect, /* O_DIRECT is set */
+    CacheAdvise /* pages are dropped with posix_fadvise after use */
+} CacheMode;
+
+/* a file that is read or written around the page cache */
+typedef struct {
+    FILE *file;
+    int fd;
+    int flags; /* the file status flags without O_DIRECT */
+    CacheMode mode;
+    unsigned long long offset; /* of the next read, or of `buffer` */
+    unsigned long long dropped; /* written pages before this are gone */
+    char *buffer; /* aligned output buffer */
+    size_t size;
+    size_t length;
+    size_t head; /* bytes in the buffer that were written before */
+    int error; /* the first errno value of a failed write */
+} DirectFile;
+
+static BOOL is_regular_file(FILE *file) {
+    struct stat info;
+    return file && !fstat(fileno(file), &info) && S_ISREG(info.st_mode);
+}
+
+/* Set up `direct` for reading from (or for writing to, if
+ * `output_size` isn't 0) the current position of `file`, with an output
+ * buffer that can take `output_size` bytes at a time. */
+static BOOL direct_open(DirectFile *direct, FILE *file,
+        size_t output_size) {
+    off_t offset;
+    size_t head;
+    void *buffer = NULL;
+
+    memset(direct, 0, sizeof(*direct));
+    direct->file = file;
+    direct->mode = CacheStdio;
+    if (output_size) {
+        direct->size = (output_size / DIRECT_ALIGNMENT + 2)
+            * DIRECT_ALIGNMENT;
+        if (posix_memalign(&buffer, DIRECT_ALIGNMENT, direct->size)) {
+            return FALSE;
+        }
+        direct->buffer = (char *)buffer;
+    }
+    if (!is_regular_file(file)) {
+        return TRUE;
+    }
+    direct->fd = fileno(file);
+    if ((output_size && fflush(file))
+            || (offset = ftello(file)) < 0
+            || (direct->flags = fcntl(direct->fd, F_GETFL)) < 0) {
+        free(buffer);
+        return FALSE;
+    }
+    direct->offset = (unsigned long long)offset;
+    if (output_size) {
+        /* start at a block boundary, with what's already before the
+            current position (the header) at the start of the buffer */
+        head = (size_t)(direct->offset % DIRECT_ALIGNMENT);
+        if (pread(direct->fd, direct->buffer, head,
+                (off_t)(direct->offset - head)) != (ssize_t)head) {
+            free(buffer);
+            return FALSE;
+        }
+        direct->offset -= head;
+        direct->length = head;
+        direct->head = head;
+    }
+    direct->dropped = direct->offset;
+    direct->mode = CacheAdvise;
+    if (!getenv("HEXTOGGLE_NO_O_DIRECT")
+            && !fcntl(direct->fd, F_SETFL, direct->flags | O_DIRECT)) {
+        direct->mode = CacheDirect;
+    }
+    return TRUE;
+}
+
+/* Go back to using the page cache, for unaligned writes and for file
+ * systems that turn out not to support O_DIRECT after all. */
+static void stop_direct(DirectFile *direct) {
+    if (direct->mode == CacheDirect) {
+        fcntl(direct->fd, F_SETFL, direct->flags);
+        direct->mode = CacheAdvise;
+    }
+}
+
+/* Read up to `size` bytes (a multiple of DIRECT_ALIGNMENT) into the
+ * aligned `buffer`. Returns the amount of data read, which starts at
+ * `*data`, or -1 on error. */
+static ssize_t direct_read(DirectFile *direct, char *buffer, size_t size,
+        char **data) {
+    unsigned long long start;
+    ssize_t result;
+    size_t skip = 0;
+    double start_time = stats_clock();
+
+    *data = buffer;
+    if (direct->mode == CacheStdio) {
+        result = (ssize_t)fread(buffer, 1, size, direct->file);
+        stats_end(StatsRead, start_time, (size_t)result);
+        return ferror(direct->file) ? -1 : result;
+    }
+    for (;;) {
+        if (direct->mode == CacheDirect) {
+            /* read whole blocks, and skip the start of the first one */
+            skip = (size_t)(direct->offset % DIRECT_ALIGNMENT);
+        }
+        start = direct->offset - skip;
+        result = pread(direct->fd, buffer, size, (off_t)start);
+        if (result < 0 && errno == EINVAL && direct->mode == CacheDirect) {
+            stop_direct(direct);
+            skip = 0;
+        } else if (result >= 0 || errno != EINTR) {
+            break;
+        }
+    }
+    if (result < 0) {
+        return -1;
+    }
+    if (direct->mode == CacheAdvise && result) {
+        posix_fadvise(direct->fd, (off_t)start, (off_t)result,
+            POSIX_FADV_DONTNEED);
+    }
+    result = (size_t)result > skip ? result - (ssize_t)skip : 0;
+    *data = buffer + skip;
+    direct->offset += (size_t)result;
+    stats_end(StatsRead, start_time, (size_t)result);
+    return result;
+}
+
+/* Drop the pages written before `end` from the page cache, which needs
+ * them to be written back first. Writeback of the latest pages is only
+ * started, and they are dropped on the next call, unless `all` is set. */
+static void drop_written(DirectFile *direct, unsigned long long end,
+        BOOL all) {
+    unsigned long long last = direct->offset;
+    if (all) {
+        last = end;
+    } else {
+        sync_file_range(direct->fd, (off_t)last, (off_t)(end - last),
+            SYNC_FILE_RANGE_WRITE);
+    }
+    if (last > direct->dropped) {
+        sync_file_range(direct->fd, (off_t)direct->dropped,
+            (off_t)(last - direct->dropped),
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(direct->fd, (off_t)direct->dropped,
+            (off_t)(last - direct->dropped), POSIX_FADV_DONTNEED);
+        direct->dropped = last;
+    }
+}
+
+/* Write the whole blocks in the output buffer, or everything if `all`
+ * is set, and keep the rest at the start of the buffer. */
+static void direct_flush(DirectFile *direct, BOOL all) {
+    size_t length = direct->length;
+    double start = stats_clock();
+
+    if (direct->mode == CacheDirect && !all) {
+        length -= length % DIRECT_ALIGNMENT;
+    }
+    if (direct->error || !length) {
+        return;
+    } else if (direct->mode == CacheStdio) {
+        if (direct->file && fwrite(direct->buffer, length, 1,
+                direct->file) != 1) {
+            direct->error = errno ? errno : EIO;
+        }
+    } else {
+        if (length % DIRECT_ALIGNMENT) {
+            /* the unaligned end of the file */
+            stop_direct(direct);
+        }
+        direct->error = write_at(direct->fd, direct->buffer, length,
+            direct->offset);
+        if (direct->error == EINVAL && direct->mode == CacheDirect) {
+            stop_direct(direct);
+            direct->error = write_at(direct->fd, direct->buffer, length,
+                direct->offset);
+        }
+        if (direct->mode == CacheAdvise) {
+            drop_written(direct, direct->offset + length, all);
+        }
+    }
+    stats_end(StatsWrite, start, length - direct->head);
+    direct->head = 0;
+    memmove(direct->buffer, direct->buffer + length,
+        direct->length - length);
+    direct->length -= length;
+    direct->offset += length;
+}
+
+/* Get room for `size` more bytes of output (at most the output size
+ * given to `direct_open`), writing what's in the buffer if needed. */
+static char *direct_space(DirectFile *direct, size_t size) {
+    if (direct->size - direct->length < size) {
+        direct_flush(direct, FALSE);
+        if (direct->size - direct->length < size) {
+            /* only after an error, whose output is discarded anyway */
+            direct->length = 0;
+        }
+    }
+    return direct->buffer + direct->length;
+}
+
+/* Finish writing (if `direct` is an output), and leave the file as it
+ * was apart from its position. Returns 0 or an errno value. */
+static int direct_close(DirectFile *direct) {
+    int error;
+    if (direct->buffer) {
+        /* the whole blocks, then the rest */
+        direct_flush(direct, FALSE);
+        direct_flush(direct, TRUE);
+    }
+    if (direct->mode != CacheStdio) {
+        stop_direct(direct);
+        fseeko(direct->file, (off_t)direct->offset, SEEK_SET);
+    }
+    error = direct->error;
+    free(direct->buffer);
+    direct->buffer = NULL;
+    return error;
+}
+
+static int report_write_error(int error) {
+    fprintf(stderr, "Error: Unable to write output: %s\n",
+        strerror(error));
+    return 1;
+}
+
+int direct_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        HextoggleFormat format,
+        BOOL elide) {
+    DirectFile input, output;
+    HextoggleEncoder encoder;
+    size_t bound, part, length;
+    ssize_t read_length = 0;
+    char *read_buffer, *data, *out;
+    void *buffer;
+    int error;
+    double start;
+
+    if (!is_regular_file(input_file) && !is_regular_file(output_file)) {
+        return DIRECT_IO_UNSUPPORTED;
+    }
+    hextoggle_encoder_reset(&encoder, FALSE);
+    hextoggle_encoder_set_format(&encoder, format);
+    hextoggle_encoder_set_elide(&encoder, elide);
+    bound = hextoggle_encode_bound(&encoder, READ_SIZE);
+    if (posix_memalign(&buffer, DIRECT_ALIGNMENT, READ_SIZE)) {
+        return DIRECT_IO_UNSUPPORTED;
+    }
+    read_buffer = (char *)buffer;
+    if (!direct_open(&output, output_file, bound)) {
+        free(read_buffer);
+        return DIRECT_IO_UNSUPPORTED;
+    } else if (!direct_open(&input, input_file, 0)) {
+        direct_close(&output);
+        free(read_buffer);
+        return DIRECT_IO_UNSUPPORTED;
+    }
+
+    while (prefix_length) {
+        part = prefix_length < READ_SIZE ? prefix_length : READ_SIZE;
+        out = direct_space(&output, bound);
+        output.length += hextoggle_encode(&encoder, prefix, part, out);
+        stats_count(StatsConvert, part);
+        prefix += part;
+        prefix_length -= part;
+    }
+    while (!output.error && (read_length = direct_read(
+            &input, read_buffer, READ_SIZE, &data)) > 0) {
+        out = direct_space(&output, bound);
+        start = stats_clock();
+        length = hextoggle_encode(&encoder, data, (size_t)read_length, out);
+        stats_end(StatsConvert, start, (size_t)read_length);
+        if (elide) {
+            stats_count_lines(out, length);
+        }
+        output.length += length;
+    }
+    out = direct_space(&output, bound);
+    length = hextoggle_encode_finish(&encoder, out);
+    if (elide) {
+        stats_count_lines(out, length);
+    }
+    output.length += length;
+
+    if (read_length < 0) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+    }
+    direct_close(&input);
+    error = direct_close(&output);
+    free(read_buffer);
+    if (error) {
+        return report_write_error(error);
+    }
+    return read_length < 0;
+}
+
+int direct_from_hex(FILE *input_file,
+        FILE *output_file,
+        HextoggleDecoder *decoder) {
+    DirectFile input, output;
+    size_t bound, done, length;
+    ssize_t read_length = 0;
+    unsigned long long before, after, line_no, column;
+    char *read_buffer, *data, *out;
+    void *buffer;
+    int status = 0, error;
+    double start;
+
+    if (!is_regular_file(input_file) && !is_regular_file(output_file)) {
+        return DIRECT_IO_UNSUPPORTED;
+    }
+    bound = hextoggle_decode_bound(READ_SIZE);
+    if (posix_memalign(&buffer, DIRECT_ALIGNMENT, READ_SIZE)) {
+        return DIRECT_IO_UNSUPPORTED;
+    }
+    read_buffer = (char *)buffer;
+    if (!direct_open(&output, output_file, bound)) {
+        free(read_buffer);
+        return DIRECT_IO_UNSUPPORTED;
+    } else if (!direct_open(&input, input_file, 0)) {
+        direct_close(&output);
+        free(read_buffer);
+        return DIRECT_IO_UNSUPPORTED;
+    }
+
+    while (!status && !output.error && (read_length = direct_read(
+            &input, read_buffer, READ_SIZE, &data)) > 0) {
+        done = 0;
+        do {
+            /* decoding stops after each `* N` line */
+            hextoggle_decoder_position(decoder, &before, &line_no, &column);
+            out = direct_space(&output, bound);
+            start = stats_clock();
+            status = hextoggle_decode(decoder, data + done,
+                (size_t)read_length - done, out, &length);
+            hextoggle_decoder_position(decoder, &after, &line_no, &column);
+            done += (size_t)(after - before);
+            stats_end(StatsConvert, start, after - before);
+            output.length += length;
+            while (status == HEXTOGGLE_REPEAT && !output.error
+                    && (length = hextoggle_decode_repeat(decoder,
+                        direct_space(&output, bound), bound)) > 0) {
+                output.length += length;
+            }
+            if (status == HEXTOGGLE_REPEAT) {
+                status = 0;
+            }
+        } while (!status && done < (size_t)read_length);
+    }
+
+    if (!status && read_length < 0) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+        status = 2;
+    }
+    direct_close(&input);
+    error = direct_close(&output);
+    free(read_buffer);
+    if (error && status != 1) {
+        report_write_error(error);
+        status = 2;
+    }
+    return status;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,45 @@
+#ifndef DIRECT_IO_H
+#define DIRECT_IO_H
+
+/* conversions that keep regular files out of the page cache (Linux),
+so that converting a file larger than memory doesn't evict everything
+else. Files are read and written with O_DIRECT through aligned buffers,
+or with posix_fadvise(POSIX_FADV_DONTNEED) after each buffer on file
+systems without O_DIRECT (or if HEXTOGGLE_NO_O_DIRECT is set). Pipes and
+terminals are read and written as usual. */
+
+#include "hextoggle.h"
+#include "utils.h"
+
+#include <stdio.h>
+
+/* Returned by the functions below if neither file is a regular file, or
+the system can't bypass the page cache. Nothing has been read or written
+in that case. */
+enum { DIRECT_IO_UNSUPPORTED = -1 };
+
+/**
+ * Encode `input_file` in `format` (eliding lines if `elide` is set),
+ * after the header that has already been written to `output_file`.
+ * `prefix` contains the first `prefix_length` bytes of input, which
+ * were already read.
+ *
+ * Return value: 0 on success, 1 on error, or DIRECT_IO_UNSUPPORTED */
+int direct_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length,
+    HextoggleFormat format,
+    BOOL elide);
+
+/**
+ * Decode the rest of `input_file` into `output_file` with `decoder`.
+ *
+ * Return value: 0 on success, 1 if the input is invalid (see
+ *     `hextoggle_decoder_position`), 2 on any other error, or
+ *     DIRECT_IO_UNSUPPORTED */
+int direct_from_hex(FILE *input_file,
+    FILE *output_file,
+    HextoggleDecoder *decoder);
+
+#endif /* DIRECT_IO_H */
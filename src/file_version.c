@@ -0,0 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "file_version.h"
+
+#include "utils.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _MSC_VER
+
+BOOL get_file_version(FILE *file, FileVersion *version) {
+    struct _stat64 info;
+
+    if (_fstat64(_fileno(file), &info)) {
+        return FALSE;
+    }
+    version->mtime = (long long)info.st_mtime;
+    version->mtime_nsec = 0;
+    version->ctime = (long long)info.st_ctime;
+    version->ctime_nsec = 0;
+    version->inode = 0;
+    return TRUE;
+}
+
+#else
+
+#include <unistd.h>
+
+BOOL get_file_version(FILE *file, FileVersion *version) {
+    struct stat info;
+
+    if (fstat(fileno(file), &info)) {
+        return FALSE;
+    }
+    version->mtime = (long long)info.st_mtime;
+    version->ctime = (long long)info.st_ctime;
+    version->inode = (unsigned long long)info.st_ino;
+#if defined(__APPLE__)
+    version->mtime_nsec = (long)info.st_mtimespec.tv_nsec;
+    version->ctime_nsec = (long)info.st_ctimespec.tv_nsec;
+#elif defined(_POSIX_VERSION) && _POSIX_VERSION >= 200809L
+    version->mtime_nsec = (long)info.st_mtim.tv_nsec;
+    version->ctime_nsec = (long)info.st_ctim.tv_nsec;
+#else
+    version->mtime_nsec = 0;
+    version->ctime_nsec = 0;
+#endif
+    return TRUE;
+}
+
+#endif /* _MSC_VER */
+
+BOOL is_file_version(FILE *file, const FileVersion *version) {
+    FileVersion current;
+
+    return get_file_version(file, &current)
+        && current.mtime == version->mtime
+        && current.mtime_nsec == version->mtime_nsec
+        && current.ctime == version->ctime
+        && current.ctime_nsec == version->ctime_nsec
+        && current.inode == version->inode;
+}
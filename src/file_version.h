@@ -0,0 +1,35 @@
+#ifndef FILE_VERSION_H
+#define FILE_VERSION_H
+
+/* tell versions of a file apart, to notice when what was derived from
+it (a manifest or a line index) is out of date */
+
+#include "utils.h"
+
+#include <stdio.h>
+
+/* rewriting a file at the same size within a second still changes the
+    nanoseconds and the change time, and replacing it changes the inode */
+typedef struct {
+    long long mtime;
+    long mtime_nsec; /* or 0 where the system only has seconds */
+    long long ctime;
+    long ctime_nsec;
+    unsigned long long inode; /* or 0 on Windows */
+} FileVersion;
+
+/* how a FileVersion is written to and read from text files, with the
+    fields in the order above */
+#define FILE_VERSION_FORMAT "%lld %ld %lld %ld %llu"
+
+/*
+Get the version of the open file `file`.
+@return FALSE if it can't be found. */
+BOOL get_file_version(FILE *file, FileVersion *version);
+
+/*
+Check whether the open file `file` is still at `version`.
+@return FALSE if it isn't, or if that can't be found. */
+BOOL is_file_version(FILE *file, const FileVersion *version);
+
+#endif /* FILE_VERSION_H */
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "follow.h"
+
+#include "bin_to_hex.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __linux__
+
+int follow_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    (void)input_file;
+    (void)output_file;
+    (void)prefix;
+    (void)prefix_length;
+    return FOLLOW_UNSUPPORTED;
+}
+
+#else
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* READ_SIZE is the amount of input encoded at once, a whole number of
+    lines. */
+enum { READ_SIZE = 1 << 16 };
+
+/* milliseconds without new data before an incomplete line is written */
+enum { FLUSH_TIMEOUT = 1000 };
+
+/* milliseconds between checks for new data without inotify */
+enum { POLL_INTERVAL = 200 };
+
+typedef struct {
+    FILE *output_file; /* or NULL for a dry run */
+    BOOL seekable; /* whether lines written early can be rewritten */
+    char *output; /* for the lines of READ_SIZE bytes of input */
+    unsigned long long address; /* of `line` */
+    char line[16]; /* the start of the next line */
+    size_t line_length;
+    size_t shown; /* bytes of `line` that were written early */
+    off_t shown_offset; /* where they were written if `seekable` */
+    BOOL error;
+} Follower;
+
+static long long milliseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Write `length` bytes of output, and make them visible at once. */
+static void write_output(Follower *follower, size_t length) {
+    double start;
+    if (!follower->output_file || !length) {
+        return;
+    }
+    start = stats_clock();
+    if (fwrite(follower->output, length, 1, follower->output_file) != 1
+            || fflush(follower->output_file)) {
+        follower->error = TRUE;
+    }
+    stats_end(StatsWrite, start, length);
+}
+
+/* Go back to the start of the line that was written early, to write it
+ * again. */
+static BOOL rewind_line(Follower *follower) {
+    if (!follower->output_file) {
+        return TRUE;
+    } else if (!follower->shown) {
+        follower->shown_offset = ftello(follower->output_file);
+        return follower->shown_offset >= 0;
+    }
+    return !fseeko(follower->output_file, follower->shown_offset,
+        SEEK_SET);
+}
+
+/* Write the part of the next line that hasn't been written yet, or all
+ * of it if it can be rewritten. */
+static void write_line(Follower *follower) {
+    size_t length;
+    if (follower->seekable) {
+        if (!rewind_line(follower)) {
+            follower->error = TRUE;
+            return;
+        }
+        length = bin_data_to_hex(follower->line, follower->line_length,
+            follower->address, follower->output);
+    } else {
+        length = bin_data_to_hex(follower->line + follower->shown,
+            follower->line_length - follower->shown,
+            follower->address + follower->shown, follower->output);
+    }
+    write_output(follower, length);
+}
+
+/* Encode `length` bytes of input appended after the data so far. */
+static void encode_appended(Follower *follower,
+        const char *input, size_t length) {
+    size_t part, input_length = length;
+    double start = stats_clock();
+
+    if (follower->line_length) {
+        /* complete the line that was held back */
+        part = 16 - follower->line_length;
+        part = part < length ? part : length;
+        memcpy(follower->line + follower->line_length, input, part);
+        follower->line_length += part;
+        input += part;
+        length -= part;
+        if (follower->line_length == 16) {
+            write_line(follower);
+            follower->address += 16;
+            follower->line_length = 0;
+            follower->shown = 0;
+        }
+    }
+
+    if (length) {
+        part = length / 16 * 16;
+        if (part) {
+            write_output(follower, bin_data_to_hex(input, part,
+                follower->address, follower->output));
+            follower->address += part;
+        }
+        memcpy(follower->line, input + part, length - part);
+        follower->line_length = length - part;
+    }
+    stats_end(StatsConvert, start, input_length);
+}
+
+/* Set up an inotify watch for changes to `fd`. Returns the inotify
+ * descriptor, or -1 to check for changes by polling. */
+static int watch_input(int fd) {
+    char path[64];
+    int notify;
+
+    if (getenv("HEXTOGGLE_NO_INOTIFY")) {
+        return -1;
+    }
+    notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify < 0) {
+        return -1;
+    }
+    /* the watch follows the link to the file that's open */
+    sprintf(path, "/proc/self/fd/%d", fd);
+    if (inotify_add_watch(notify, path, IN_MODIFY | IN_ATTRIB) < 0) {
+        close(notify);
+        return -1;
+    }
+    return notify;
+}
+
+/* Wait until the input may have changed, or up to `timeout`
+ * milliseconds (-1 for no limit). */
+static void wait_for_input(int notify, int timeout) {
+    char events[4096];
+    struct pollfd watch;
+
+    if (notify < 0) {
+        poll(NULL, 0, timeout >= 0 && timeout < POLL_INTERVAL
+            ? timeout : POLL_INTERVAL);
+        return;
+    }
+    watch.fd = notify;
+    watch.events = POLLIN;
+    if (poll(&watch, 1, timeout) > 0) {
+        /* the events only say that something happened */
+        while (read(notify, events, sizeof(events)) > 0) {
+        }
+    }
+}
+
+int follow_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    Follower follower;
+    struct stat info;
+    char *input;
+    off_t offset;
+    ssize_t length;
+    long long last_data, waited;
+    int fd = fileno(input_file), notify;
+    double start;
+
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)
+            || (offset = ftello(input_file)) < 0) {
+        return FOLLOW_UNSUPPORTED;
+    }
+    input = (char *)malloc(READ_SIZE + bin_to_hex_size(READ_SIZE));
+    if (!input) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+    follower.output_file = output_file;
+    /* writes to a file opened for appending (like `>> out.hex`) go to
+        its end wherever it was seeked to */
+    follower.seekable = output_file && !fstat(fileno(output_file), &info)
+        && S_ISREG(info.st_mode)
+        && !(fcntl(fileno(output_file), F_GETFL) & O_APPEND);
+    follower.output = input + READ_SIZE;
+    follower.address = 0;
+    follower.line_length = 0;
+    follower.shown = 0;
+    follower.shown_offset = 0;
+    follower.error = FALSE;
+    notify = watch_input(fd);
+
+    encode_appended(&follower, prefix, prefix_length);
+    last_data = milliseconds();
+    while (!follower.error) {
+        start = stats_clock();
+        length = pread(fd, input, READ_SIZE, offset);
+        stats_end(StatsRead, start, length > 0 ? (size_t)length : 0);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        } else if (length < 0) {
+            fprintf(stderr, "Error: Unable to read input: %s\n",
+                strerror(errno));
+            break;
+        } else if (length) {
+            encode_appended(&follower, input, (size_t)length);
+            offset += length;
+            last_data = milliseconds();
+            continue;
+        }
+
+        /* at the end of the input for now */
+        if (!fstat(fd, &info) && info.st_size < offset) {
+            fprintf(stderr, "Error: the input was truncated\n");
+            break;
+        }
+        waited = milliseconds() - last_data;
+        if (follower.shown == follower.line_length) {
+            wait_for_input(notify, -1);
+        } else if (waited < FLUSH_TIMEOUT) {
+            wait_for_input(notify, (int)(FLUSH_TIMEOUT - waited));
+        } else {
+            write_line(&follower);
+            follower.shown = follower.line_length;
+        }
+    }
+
+    if (follower.error) {
+        fprintf(stderr, "Error: Unable to write output: %s\n",
+            strerror(errno));
+    }
+    if (notify >= 0) {
+        close(notify);
+    }
+    free(input);
+    return 1;
+}
+
+#endif /* __linux__ */
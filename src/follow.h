@@ -0,0 +1,38 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+/* encoding a file that is still growing, like `tail -f` (Linux). New
+data is noticed with inotify, or by checking the size of the file a few
+times a second if inotify is unavailable (or HEXTOGGLE_NO_INOTIFY is
+set). */
+
+#include <stdio.h>
+
+/* Returned by `follow_to_hex` if the input isn't a regular file (or the
+system isn't supported). Nothing has been read or written in that
+case. */
+enum { FOLLOW_UNSUPPORTED = -1 };
+
+/**
+ * Encode the regular file `input_file` in the canonical format, and
+ * then keep encoding whatever is appended to it, continuing with the
+ * next address. The header has already been written, and `prefix`
+ * contains the first `prefix_length` bytes of input, which were already
+ * read.
+ *
+ * The last line is held back until it's complete, or until no data has
+ * been appended for a second. If the output is a regular file, a line
+ * written early is rewritten once it's complete, so the output is the
+ * same as that of encoding the whole file at once. Otherwise the rest
+ * of the line is written as a line of its own.
+ *
+ * This only returns on error (e.g. when the input is truncated), so it
+ * can be stopped with a signal.
+ *
+ * Return value: 1 on error, or FOLLOW_UNSUPPORTED */
+int follow_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length);
+
+#endif /* FOLLOW_H */
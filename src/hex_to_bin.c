@@ -0,0 +1,587 @@
+#include "hex_to_bin.h"
+
+#include "bin_to_hex.h"
+#include "cpu.h"
+
+#include <limits.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#  include <immintrin.h>
+#endif
+
+/* Character classes used by the decoder. Hex digits store their value
+in the low nibble. */
+enum {
+    HexClassInvalid = 0,
+    HexClassSpace,
+    HexClassNewline,
+    HexClassPipe,
+    HexClassOpen,
+    HexClassClose,
+    HexClassStar,
+    HexClassDigit = 0x10
+};
+
+static const unsigned char HEX_CLASS[256] = {
+    [' '] = HexClassSpace, ['\t'] = HexClassSpace, ['\r'] = HexClassSpace,
+    ['\n'] = HexClassNewline,
+    ['|'] = HexClassPipe,
+    ['['] = HexClassOpen,
+    [']'] = HexClassClose,
+    ['*'] = HexClassStar,
+    ['0'] = HexClassDigit | 0, ['1'] = HexClassDigit | 1,
+    ['2'] = HexClassDigit | 2, ['3'] = HexClassDigit | 3,
+    ['4'] = HexClassDigit | 4, ['5'] = HexClassDigit | 5,
+    ['6'] = HexClassDigit | 6, ['7'] = HexClassDigit | 7,
+    ['8'] = HexClassDigit | 8, ['9'] = HexClassDigit | 9,
+    ['a'] = HexClassDigit | 10, ['A'] = HexClassDigit | 10,
+    ['b'] = HexClassDigit | 11, ['B'] = HexClassDigit | 11,
+    ['c'] = HexClassDigit | 12, ['C'] = HexClassDigit | 12,
+    ['d'] = HexClassDigit | 13, ['D'] = HexClassDigit | 13,
+    ['e'] = HexClassDigit | 14, ['E'] = HexClassDigit | 14,
+    ['f'] = HexClassDigit | 15, ['F'] = HexClassDigit | 15
+};
+
+#define CLASS_OF(c) HEX_CLASS[(unsigned char)(c)]
+
+FromHexData init_from_hex_data(void) {
+    FromHexData result;
+    result.prev_byte = 0;
+    result.skip_line = FALSE;
+    result.inside_comment = 0;
+    result.allow_repeat = FALSE;
+    result.inside_repeat = FALSE;
+    result.repeat = 0;
+    result.last_length = 0;
+    result.char_no = 0;
+    result.line_no = 1;
+    result.line_start = 0;
+    return result;
+}
+
+unsigned long long from_hex_column(const FromHexData *data) {
+    return data->char_no + 1 - data->line_start;
+}
+
+/* Canonical lines are laid out exactly like the output of
+ * `bin_data_to_hex` (see bin_to_hex.h): a 24-character address column
+ * (`[`, 22 characters that the decoder ignores, `]`), 32 hex digits in
+ * groups of four separated by single spaces, `|`, 16 characters of
+ * ASCII column and a newline. */
+enum { CANONICAL_LINE_LENGTH = 81 };
+
+/* Kernels that decode up to `line_count` consecutive canonical lines
+ * to 16 bytes each. They stop at the first line that doesn't match the
+ * canonical layout, and return the number of lines decoded. */
+typedef size_t (*DecodeLinesFn)(
+    const char *input,
+    size_t line_count,
+    char *output);
+
+/* characters that end the address column or the ASCII column early */
+static BOOL is_structural(char c) {
+    unsigned char cls = CLASS_OF(c);
+    return cls == HexClassNewline
+        || cls == HexClassPipe
+        || cls == HexClassOpen
+        || cls == HexClassClose;
+}
+
+static size_t decode_lines_scalar(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    size_t line;
+    int i;
+    for (line = 0; line < line_count; ++line) {
+        char decoded[16];
+        if (input[0] != '[' || input[23] != ']'
+                || input[63] != '|' || input[80] != '\n') {
+            return line;
+        }
+        for (i = 1; i < 23; ++i) {
+            if (is_structural(input[i])) {
+                return line;
+            }
+        }
+        for (i = 0; i < 16; ++i) {
+            /* byte `i` is at column 24 + 5 * (i / 2) + 2 * (i % 2) */
+            const char *digits = input + 24 + i / 2 * 5 + i % 2 * 2;
+            unsigned char high = CLASS_OF(digits[0]);
+            unsigned char low = CLASS_OF(digits[1]);
+            if (!(high & low & HexClassDigit)) {
+                return line;
+            }
+            decoded[i] = (char)(((high & 0xf) << 4) | (low & 0xf));
+        }
+        for (i = 28; i < 63; i += 5) {
+            if (input[i] != ' ') {
+                return line;
+            }
+        }
+        for (i = 64; i < 80; ++i) {
+            if (input[i] == '\n') {
+                return line;
+            }
+        }
+        memcpy(output, decoded, 16);
+        input += CANONICAL_LINE_LENGTH;
+        output += 16;
+    }
+    return line_count;
+}
+
+/* The same for lines of the plain format (see bin_to_hex.h), which are
+ * 64 hex digits and a newline. */
+static size_t decode_plain_lines_scalar(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    size_t line;
+    int i;
+    for (line = 0; line < line_count; ++line) {
+        char decoded[PLAIN_LINE_BYTES];
+        if (input[2 * PLAIN_LINE_BYTES] != '\n') {
+            return line;
+        }
+        for (i = 0; i < PLAIN_LINE_BYTES; ++i) {
+            unsigned char high = CLASS_OF(input[2 * i]);
+            unsigned char low = CLASS_OF(input[2 * i + 1]);
+            if (!(high & low & HexClassDigit)) {
+                return line;
+            }
+            decoded[i] = (char)(((high & 0xf) << 4) | (low & 0xf));
+        }
+        memcpy(output, decoded, PLAIN_LINE_BYTES);
+        input += PLAIN_LINE_LENGTH;
+        output += PLAIN_LINE_BYTES;
+    }
+    return line_count;
+}
+
+#ifdef CPU_X86
+
+/* Expected contents of the 16-byte ranges starting at columns 24, 40
+ * and 48 (the last one overlaps to end at the `|`). Zeros mark hex
+ * digits. */
+static const char EXPECT_24[16] = {
+    0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0 };
+static const char EXPECT_40[16] = {
+    0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0 };
+static const char EXPECT_48[16] = {
+    ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0, '|' };
+
+/* Shuffle masks gathering the digit values into digits 0-15 (`FIRST`)
+ * and 16-31 (`SECOND`) of the line. */
+static const signed char GATHER_24_FIRST[16] = {
+    0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, 15, -1, -1, -1 };
+static const signed char GATHER_40_FIRST[16] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 2 };
+static const signed char GATHER_40_SECOND[16] = {
+    4, 5, 6, 7, 9, 10, 11, 12, 14, 15, -1, -1, -1, -1, -1, -1 };
+static const signed char GATHER_48_SECOND[16] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, 9, 11, 12, 13, 14 };
+/* plain lines only have hex digits */
+static const char EXPECT_DIGITS[16] = { 0 };
+
+#define LOAD_128(array) _mm_loadu_si128((const __m128i *)(array))
+
+/* Check that `chars` matches `expected` (where hex digits are expected
+ * at the zero bytes) and convert the digits to their values. Returns
+ * FALSE if it doesn't match. */
+CPU_TARGET("ssse3")
+static BOOL digit_values_ssse3(
+        __m128i chars,
+        const char *expected,
+        __m128i *values) {
+    __m128i pattern = LOAD_128(expected);
+    __m128i want_digit = _mm_cmpeq_epi8(pattern, _mm_setzero_si128());
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    __m128i decimal = _mm_and_si128(
+        _mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+        _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    __m128i letter = _mm_and_si128(
+        _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    /* NUL bytes equal the zeros of `pattern`, so only compare the other
+        positions */
+    __m128i matches = _mm_or_si128(
+        _mm_and_si128(want_digit, _mm_or_si128(decimal, letter)),
+        _mm_andnot_si128(want_digit, _mm_cmpeq_epi8(chars, pattern)));
+    if (_mm_movemask_epi8(matches) != 0xffff) {
+        return FALSE;
+    }
+    /* '0'-'9' have their value in the low nibble, 'a'-'f' and 'A'-'F'
+        have their value minus 9 */
+    *values = _mm_add_epi8(
+        _mm_and_si128(chars, _mm_set1_epi8(0x0f)),
+        _mm_and_si128(letter, _mm_set1_epi8(9)));
+    return TRUE;
+}
+
+/* bitmask of `is_structural` characters */
+CPU_TARGET("ssse3")
+static int structural_mask_ssse3(__m128i chars) {
+    return _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')),
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8('|'))),
+        _mm_or_si128(
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8('[')),
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8(']')))));
+}
+
+CPU_TARGET("ssse3")
+static size_t decode_lines_ssse3(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    /* multiplies each pair of digit values into high * 16 + low */
+    const __m128i combine = _mm_set1_epi16(0x0110);
+    size_t line;
+
+    for (line = 0; line < line_count; ++line) {
+        __m128i values_24, values_40, values_48, first, second;
+        if (input[0] != '[' || input[80] != '\n'
+                || structural_mask_ssse3(LOAD_128(input)) != 0x0001
+                || structural_mask_ssse3(LOAD_128(input + 8)) != 0x8000
+                || input[23] != ']'
+                || !digit_values_ssse3(
+                    LOAD_128(input + 24), EXPECT_24, &values_24)
+                || !digit_values_ssse3(
+                    LOAD_128(input + 40), EXPECT_40, &values_40)
+                || !digit_values_ssse3(
+                    LOAD_128(input + 48), EXPECT_48, &values_48)
+                || _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    LOAD_128(input + 64), _mm_set1_epi8('\n')))) {
+            return line;
+        }
+        first = _mm_or_si128(
+            _mm_shuffle_epi8(values_24, LOAD_128(GATHER_24_FIRST)),
+            _mm_shuffle_epi8(values_40, LOAD_128(GATHER_40_FIRST)));
+        second = _mm_or_si128(
+            _mm_shuffle_epi8(values_40, LOAD_128(GATHER_40_SECOND)),
+            _mm_shuffle_epi8(values_48, LOAD_128(GATHER_48_SECOND)));
+        _mm_storeu_si128((__m128i *)output, _mm_packus_epi16(
+            _mm_maddubs_epi16(first, combine),
+            _mm_maddubs_epi16(second, combine)));
+        input += CANONICAL_LINE_LENGTH;
+        output += 16;
+    }
+    return line_count;
+}
+
+/* Plain lines are just digit pairs, which are combined and packed
+ * without any shuffles. */
+CPU_TARGET("ssse3")
+static size_t decode_plain_lines_ssse3(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    const __m128i combine = _mm_set1_epi16(0x0110);
+    size_t line;
+
+    for (line = 0; line < line_count; ++line) {
+        __m128i values[4];
+        int i;
+        if (input[64] != '\n') {
+            return line;
+        }
+        for (i = 0; i < 4; ++i) {
+            if (!digit_values_ssse3(LOAD_128(input + 16 * i),
+                    EXPECT_DIGITS, &values[i])) {
+                return line;
+            }
+        }
+        _mm_storeu_si128((__m128i *)output, _mm_packus_epi16(
+            _mm_maddubs_epi16(values[0], combine),
+            _mm_maddubs_epi16(values[1], combine)));
+        _mm_storeu_si128((__m128i *)(output + 16), _mm_packus_epi16(
+            _mm_maddubs_epi16(values[2], combine),
+            _mm_maddubs_epi16(values[3], combine)));
+        input += PLAIN_LINE_LENGTH;
+        output += PLAIN_LINE_BYTES;
+    }
+    return line_count;
+}
+
+/* `digit_values_ssse3` for 32 characters that all need to be digits */
+CPU_TARGET("avx2")
+static BOOL plain_values_avx2(__m256i chars, __m256i *values) {
+    __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    __m256i decimal = _mm256_and_si256(
+        _mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    __m256i letter = _mm256_and_si256(
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    if (_mm256_movemask_epi8(_mm256_or_si256(decimal, letter)) != -1) {
+        return FALSE;
+    }
+    *values = _mm256_add_epi8(
+        _mm256_and_si256(chars, _mm256_set1_epi8(0x0f)),
+        _mm256_and_si256(letter, _mm256_set1_epi8(9)));
+    return TRUE;
+}
+
+/* The pack works within 128-bit lanes, leaving the four 8-byte groups
+ * in the order 0, 2, 1, 3 until the final permute. */
+CPU_TARGET("avx2")
+static size_t decode_plain_lines_avx2(
+        const char *input,
+        size_t line_count,
+        char *output) {
+    const __m256i combine = _mm256_set1_epi16(0x0110);
+    size_t line;
+
+    for (line = 0; line < line_count; ++line) {
+        __m256i first, second;
+        if (input[64] != '\n'
+                || !plain_values_avx2(
+                    _mm256_loadu_si256((const __m256i *)input), &first)
+                || !plain_values_avx2(
+                    _mm256_loadu_si256((const __m256i *)(input + 32)),
+                    &second)) {
+            return line;
+        }
+        _mm256_storeu_si256((__m256i *)output, _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(
+                _mm256_maddubs_epi16(first, combine),
+                _mm256_maddubs_epi16(second, combine)),
+            0xd8));
+        input += PLAIN_LINE_LENGTH;
+        output += PLAIN_LINE_BYTES;
+    }
+    return line_count;
+}
+
+#endif /* CPU_X86 */
+
+static DecodeLinesFn select_plain_decode_kernel(void) {
+#ifdef CPU_X86
+    unsigned features = cpu_features();
+    if (features & CpuFeatureAVX2) {
+        return decode_plain_lines_avx2;
+    } else if (features & CpuFeatureSSSE3) {
+        return decode_plain_lines_ssse3;
+    }
+#endif
+    return decode_plain_lines_scalar;
+}
+
+static DecodeLinesFn select_decode_kernel(void) {
+#ifdef CPU_X86
+    if (cpu_features() & CpuFeatureSSSE3) {
+        return decode_lines_ssse3;
+    }
+#endif
+    return decode_lines_scalar;
+}
+
+/* the largest count of a `*` line, so that the bytes can be counted */
+#define MAX_REPEAT (ULLONG_MAX / 16)
+
+/* The general decoder state machine. Processes `input` up to `end`,
+ * writing decoded bytes to `*output` and advancing it. On error, `*pos`
+ * points to the invalid character. `output_start` is where the output
+ * of this call to `hex_data_to_bin` starts. */
+static int hex_to_chars(
+        FromHexData *data,
+        const char **pos,
+        const char *end,
+        const char *output_start,
+        char **output) {
+    const char *p = *pos;
+    char *out = *output;
+    unsigned char cls;
+    int status = 0;
+
+    while (p < end) {
+        if (data->skip_line) {
+            /* It's important to process skipped lines BEFORE block
+                comments because otherwise '[' and ']' characters on the
+                right-hand side can unintentionally break the file. */
+            p = memchr(p, '\n', (size_t)(end - p));
+            if (!p) {
+                p = end;
+                break;
+            }
+        }
+        cls = CLASS_OF(*p);
+        if (cls == HexClassNewline) {
+            ++data->line_no;
+            data->line_start = data->char_no + (size_t)(p - *pos) + 1;
+        }
+
+        if (data->inside_repeat) {
+            /* the count of a `* N` line */
+            if (cls == HexClassNewline && data->repeat) {
+                data->inside_repeat = FALSE;
+                status = HEX_TO_BIN_REPEAT;
+                ++p;
+                break;
+            } else if (*p >= '0' && *p <= '9'
+                    && data->repeat <= (MAX_REPEAT - 9) / 10) {
+                data->repeat = data->repeat * 10 + (unsigned)(*p - '0');
+            } else if (cls != HexClassSpace) {
+                status = 1;
+                break;
+            }
+            ++p;
+            continue;
+        }
+
+        if (data->prev_byte) {
+            if (!(cls & HexClassDigit)) {
+                status = 1;
+                break;
+            }
+            *out++ = (char)(((CLASS_OF(data->prev_byte) & 0xf) << 4)
+                | (cls & 0xf));
+            data->prev_byte = 0;
+            ++p;
+            continue;
+        }
+
+        switch (cls) {
+            case HexClassNewline:
+                data->skip_line = FALSE;
+                break;
+            case HexClassPipe:
+                data->skip_line = TRUE;
+                break;
+            case HexClassOpen:
+                ++data->inside_comment;
+                break;
+            case HexClassClose:
+                if (data->inside_comment) {
+                    --data->inside_comment;
+                } else {
+                    status = 1;
+                }
+                break;
+            case HexClassSpace:
+                break;
+            case HexClassStar:
+                /* only valid at the start of a line, after a line */
+                if (data->inside_comment) {
+                    break;
+                } else if (!data->allow_repeat
+                        || data->char_no + (size_t)(p - *pos)
+                            != data->line_start
+                        || data->last_length
+                            + (size_t)(out - output_start) < 16) {
+                    status = 1;
+                } else {
+                    data->inside_repeat = TRUE;
+                    data->repeat = 0;
+                }
+                break;
+            case HexClassInvalid:
+                if (!data->inside_comment) {
+                    status = 1;
+                }
+                break;
+            default: /* hex digit */
+                if (!data->inside_comment) {
+                    data->prev_byte = *p;
+                }
+                break;
+        }
+        if (status) {
+            break;
+        }
+        ++p;
+        if (cls == HexClassNewline && !data->inside_comment) {
+            /* give the caller a chance to decode the following
+                lines with `decode_canonical_lines` */
+            break;
+        }
+    }
+
+    data->char_no += (size_t)(p - *pos);
+    *pos = p;
+    *output = out;
+    return status;
+}
+
+/* Keep the last 16 bytes of output for `hex_repeat_to_bin`. */
+static void remember_last_bytes(FromHexData *data,
+        const char *output, size_t length) {
+    size_t keep;
+    if (length >= 16) {
+        memcpy(data->last_bytes, output + length - 16, 16);
+        data->last_length = 16;
+        return;
+    }
+    keep = 16 - length < data->last_length
+        ? 16 - length : data->last_length;
+    memmove(data->last_bytes,
+        data->last_bytes + data->last_length - keep, keep);
+    memcpy(data->last_bytes + keep, output, length);
+    data->last_length = keep + length;
+}
+
+int hex_data_to_bin(
+        FromHexData *data,
+        const char *input,
+        size_t input_size,
+        char *output,
+        size_t *output_size) {
+    const char *pos = input;
+    const char *end = input + input_size;
+    char *out = output;
+    int status = 0;
+    size_t lines, length;
+    DecodeLinesFn decode_canonical_lines = select_decode_kernel();
+    DecodeLinesFn decode_plain_lines = select_plain_decode_kernel();
+
+    while (pos < end) {
+        if (!data->prev_byte && !data->skip_line && !data->inside_comment
+                && data->char_no == data->line_start) {
+            lines = decode_canonical_lines(pos,
+                (size_t)(end - pos) / CANONICAL_LINE_LENGTH, out);
+            length = lines * CANONICAL_LINE_LENGTH;
+            out += lines * 16;
+            if (!lines) {
+                lines = decode_plain_lines(pos,
+                    (size_t)(end - pos) / PLAIN_LINE_LENGTH, out);
+                length = lines * PLAIN_LINE_LENGTH;
+                out += lines * PLAIN_LINE_BYTES;
+            }
+            pos += length;
+            data->char_no += length;
+            data->line_no += lines;
+            data->line_start = data->char_no;
+        }
+        /* hand-edited lines, comments and partial lines */
+        status = hex_to_chars(data, &pos, end, output, &out);
+        if (status) {
+            break;
+        }
+    }
+    *output_size = (size_t)(out - output);
+    remember_last_bytes(data, output, *output_size);
+    return status;
+}
+
+size_t hex_repeat_to_bin(FromHexData *data, char *output,
+        size_t output_size) {
+    size_t lines = output_size / 16, length, filled;
+    if (lines > data->repeat) {
+        lines = (size_t)data->repeat;
+    }
+    if (!lines) {
+        return 0;
+    }
+    length = lines * 16;
+    memcpy(output, data->last_bytes, 16);
+    /* double the copied part until it's complete */
+    for (filled = 16; filled < length; filled *= 2) {
+        memcpy(output + filled, output,
+            filled < length - filled ? filled : length - filled);
+    }
+    data->repeat -= lines;
+    return length;
+}
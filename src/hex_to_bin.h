@@ -0,0 +1,75 @@
+#ifndef HEX_TO_BIN_H
+#define HEX_TO_BIN_H
+
+#include "utils.h"
+
+#include <stdlib.h>
+
+/* Decoder state. This is carried across calls to `hex_data_to_bin`,
+so input can be split into buffers at arbitrary positions. */
+typedef struct {
+    int inside_comment; /* potentially nested comments */
+    BOOL skip_line;
+    char prev_byte; /* first hex digit of an incomplete byte, or 0 */
+
+    /* `*` lines (see `hex_repeat_to_bin`) */
+    BOOL allow_repeat; /* otherwise `*` is an invalid character */
+    BOOL inside_repeat; /* reading the count of a `*` line */
+    unsigned long long repeat; /* that count, or the lines left to write */
+    char last_bytes[16]; /* the last 16 bytes decoded */
+    size_t last_length; /* how many of them there are (up to 16) */
+
+    /* position of the next input character (or of the invalid
+        character after an error), used for error messages */
+    unsigned long long char_no;   /* starting at 0 */
+    unsigned long long line_no;   /* starting at 1 */
+    unsigned long long line_start; /* `char_no` at the start of the
+                                      current line */
+} FromHexData;
+
+/* A state for decoding from the start of a file. Repeats are not
+allowed. */
+FromHexData init_from_hex_data(void);
+
+/* Returned by `hex_data_to_bin` after a `*` line. */
+enum { HEX_TO_BIN_REPEAT = 2 };
+
+/* library decoder context, see hextoggle.h */
+struct HextoggleDecoder {
+    FromHexData data;
+};
+
+/* Column of `data->char_no` (starting at 1, or 0 for a newline). */
+unsigned long long from_hex_column(const FromHexData *data);
+
+/**
+ * Convert hex data back to binary, continuing from the state in
+ * `data`.
+ *
+ * `input`: points to `input_size` characters of hex data
+ * `output`: space for the decoded data, should be at least
+ *     (input_size + 1) / 2 bytes
+ * `output_size`: set to the amount of data written to `output`
+ * Return value: 0 on success, or 1 if the input is invalid. On error,
+ *     `data` describes the position of the invalid character and
+ *     `output` contains everything decoded before it.
+ *
+ * In elided files, a line of the form `* N` stands for N more copies
+ * of the last 16 bytes. If `data->allow_repeat` is set, decoding stops
+ * after such a line and returns HEX_TO_BIN_REPEAT, with `data->char_no`
+ * pointing after it. The repeated bytes are then written with
+ * `hex_repeat_to_bin` before decoding the rest of the input. */
+int hex_data_to_bin(
+    FromHexData *data,
+    const char *input,
+    size_t input_size,
+    char *output,
+    size_t *output_size);
+
+/* Write as many of the repeated lines of a `*` line as fit into
+`output_size` bytes (at least 16) of `output`. Returns the amount
+written, or 0 once they have all been written. */
+size_t hex_repeat_to_bin(FromHexData *data, char *output,
+    size_t output_size);
+
+#endif /* HEX_TO_BIN_H */
@@ -0,0 +1,281 @@
+#include "hextoggle.h"
+
+#include "bin_to_hex.h"
+#include "hex_to_bin.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static HextoggleDetection detect_header(const char *input,
+        size_t input_size, const char *header, size_t header_length) {
+    size_t length = input_size < header_length
+        ? input_size : header_length;
+    if (memcmp(input, header, length)) {
+        return HextoggleDetectBinary;
+    }
+    return length < header_length
+        ? HextoggleDetectMore : HextoggleDetectHex;
+}
+
+HextoggleDetection hextoggle_detect(const char *input, size_t input_size) {
+    HextoggleDetection result = detect_header(input, input_size,
+        HEXTOGGLE_HEADER, HEXTOGGLE_HEADER_LENGTH);
+    if (result == HextoggleDetectBinary) {
+        result = detect_header(input, input_size,
+            HEXTOGGLE_PLAIN_HEADER, HEXTOGGLE_PLAIN_HEADER_LENGTH);
+    }
+    if (result == HextoggleDetectBinary) {
+        result = detect_header(input, input_size,
+            HEXTOGGLE_ELIDED_HEADER, HEXTOGGLE_ELIDED_HEADER_LENGTH);
+    }
+    return result;
+}
+
+HextoggleEncoder *hextoggle_encoder_create(int write_header) {
+    HextoggleEncoder *encoder
+        = (HextoggleEncoder *)malloc(sizeof(HextoggleEncoder));
+    if (encoder) {
+        encoder->format = HextoggleFormatCanonical;
+        encoder->elide = FALSE;
+        hextoggle_encoder_reset(encoder, write_header);
+    }
+    return encoder;
+}
+
+void hextoggle_encoder_destroy(HextoggleEncoder *encoder) {
+    free(encoder);
+}
+
+void hextoggle_encoder_reset(HextoggleEncoder *encoder, int write_header) {
+    encoder->address = 0;
+    encoder->pending_length = 0;
+    encoder->write_header = write_header ? TRUE : FALSE;
+    encoder->has_previous = FALSE;
+    encoder->repeats = 0;
+}
+
+void hextoggle_encoder_set_format(HextoggleEncoder *encoder,
+        HextoggleFormat format) {
+    encoder->format = format;
+}
+
+void hextoggle_encoder_set_elide(HextoggleEncoder *encoder, int elide) {
+    encoder->elide = elide ? TRUE : FALSE;
+}
+
+/* whether runs of lines are elided */
+static BOOL elides(const HextoggleEncoder *encoder) {
+    return encoder->elide && encoder->format == HextoggleFormatCanonical;
+}
+
+/* bytes of input per line */
+static size_t line_size(const HextoggleEncoder *encoder) {
+    return encoder->format == HextoggleFormatPlain ? PLAIN_LINE_BYTES : 16;
+}
+
+size_t hextoggle_encode_bound(const HextoggleEncoder *encoder,
+        size_t input_size) {
+    size_t size = (size_t)format_hex_size(encoder->format,
+        encoder->pending_length + input_size);
+    if (encoder->write_header) {
+        size += HEXTOGGLE_HEADER_LENGTH + 1;
+    }
+    if (elides(encoder)) {
+        /* the `* N` line of a run that ended, since lines that are left
+            out make room for any others */
+        size += REPEAT_LINE_LENGTH;
+    }
+    return size;
+}
+
+static size_t write_header(HextoggleEncoder *encoder, char *output) {
+    if (!encoder->write_header) {
+        return 0;
+    }
+    encoder->write_header = FALSE;
+    if (encoder->format == HextoggleFormatPlain) {
+        memcpy(output, HEXTOGGLE_PLAIN_HEADER "\n",
+            HEXTOGGLE_PLAIN_HEADER_LENGTH + 1);
+        return HEXTOGGLE_PLAIN_HEADER_LENGTH + 1;
+    } else if (elides(encoder)) {
+        memcpy(output, HEXTOGGLE_ELIDED_HEADER "\n",
+            HEXTOGGLE_ELIDED_HEADER_LENGTH + 1);
+        return HEXTOGGLE_ELIDED_HEADER_LENGTH + 1;
+    }
+    memcpy(output, HEXTOGGLE_HEADER "\n", HEXTOGGLE_HEADER_LENGTH + 1);
+    return HEXTOGGLE_HEADER_LENGTH + 1;
+}
+
+/* Write the `* N` line for the lines left out since the last line that
+was written, if any. */
+static size_t write_repeats(HextoggleEncoder *encoder, char *output) {
+    char line[REPEAT_LINE_LENGTH + 1];
+    size_t length;
+    if (!encoder->repeats) {
+        return 0;
+    }
+    length = (size_t)sprintf(line, "* %llu\n", encoder->repeats);
+    memcpy(output, line, length);
+    encoder->repeats = 0;
+    return length;
+}
+
+/* Encode `length` bytes of complete lines, leaving out the lines that
+are the same as the one before them. */
+static size_t encode_elided(HextoggleEncoder *encoder,
+        const char *data, size_t length, char *output) {
+    size_t line_count = length / 16, lines, output_size = 0;
+    while (line_count) {
+        if (encoder->has_previous) {
+            lines = count_repeated_lines(data, line_count,
+                encoder->previous);
+            encoder->repeats += lines;
+            encoder->address += lines * 16;
+            data += lines * 16;
+            line_count -= lines;
+            if (!line_count) {
+                break;
+            }
+            output_size += write_repeats(encoder, output + output_size);
+        }
+        lines = count_distinct_lines(data, line_count);
+        output_size += bin_data_to_hex(data, lines * 16, encoder->address,
+            output + output_size);
+        encoder->address += lines * 16;
+        memcpy(encoder->previous, data + (lines - 1) * 16, 16);
+        encoder->has_previous = TRUE;
+        data += lines * 16;
+        line_count -= lines;
+    }
+    return output_size;
+}
+
+/* Encode `length` bytes of complete lines. */
+static size_t encode_lines(HextoggleEncoder *encoder,
+        const char *data, size_t length, char *output) {
+    size_t output_size;
+    if (elides(encoder)) {
+        return encode_elided(encoder, data, length, output);
+    }
+    output_size = bin_data_to_format_hex(encoder->format, data,
+        length, encoder->address, output);
+    encoder->address += length;
+    return output_size;
+}
+
+size_t hextoggle_encode(HextoggleEncoder *encoder,
+        const void *input, size_t input_size, char *output) {
+    const char *data = (const char *)input;
+    size_t line = line_size(encoder);
+    size_t output_size, length;
+
+    output_size = write_header(encoder, output);
+    if (encoder->pending_length) {
+        /* complete the line started by the last call */
+        length = line - encoder->pending_length;
+        if (length > input_size) {
+            length = input_size;
+        }
+        memcpy(encoder->pending + encoder->pending_length, data, length);
+        encoder->pending_length += length;
+        data += length;
+        input_size -= length;
+        if (encoder->pending_length < line) {
+            return output_size;
+        }
+        output_size += encode_lines(encoder, encoder->pending, line,
+            output + output_size);
+        encoder->pending_length = 0;
+    }
+    length = input_size - input_size % line;
+    output_size += encode_lines(encoder, data, length,
+        output + output_size);
+    encoder->pending_length = input_size - length;
+    memcpy(encoder->pending, data + length, encoder->pending_length);
+    return output_size;
+}
+
+size_t hextoggle_encode_zeros(HextoggleEncoder *encoder,
+        unsigned long long size, char *output) {
+    static const char zeros[32];
+    size_t head = (16 - encoder->pending_length) % 16 + 16;
+    size_t output_size;
+    unsigned long long lines;
+
+    /* finish the current line and encode a line of zeros, which the
+        rest repeats */
+    if (head > size) {
+        head = (size_t)size;
+    }
+    output_size = hextoggle_encode(encoder, zeros, head, output);
+    size -= head;
+    lines = size / 16;
+    encoder->repeats += lines;
+    encoder->address += lines * 16;
+    output_size += hextoggle_encode(encoder, zeros, (size_t)(size % 16),
+        output + output_size);
+    return output_size;
+}
+
+size_t hextoggle_encode_finish(HextoggleEncoder *encoder, char *output) {
+    size_t output_size = write_header(encoder, output);
+    output_size += write_repeats(encoder, output + output_size);
+    output_size += bin_data_to_format_hex(encoder->format,
+        encoder->pending, encoder->pending_length, encoder->address,
+        output + output_size);
+    encoder->address += encoder->pending_length;
+    encoder->pending_length = 0;
+    return output_size;
+}
+
+HextoggleDecoder *hextoggle_decoder_create(void) {
+    HextoggleDecoder *decoder
+        = (HextoggleDecoder *)malloc(sizeof(HextoggleDecoder));
+    if (decoder) {
+        hextoggle_decoder_reset(decoder);
+    }
+    return decoder;
+}
+
+void hextoggle_decoder_destroy(HextoggleDecoder *decoder) {
+    free(decoder);
+}
+
+void hextoggle_decoder_reset(HextoggleDecoder *decoder) {
+    decoder->data = init_from_hex_data();
+    decoder->data.allow_repeat = TRUE;
+}
+
+size_t hextoggle_decode_bound(size_t input_size) {
+    return input_size / 2 + 1;
+}
+
+int hextoggle_decode(HextoggleDecoder *decoder,
+        const char *input, size_t input_size,
+        void *output, size_t *output_size) {
+    switch (hex_data_to_bin(&decoder->data, input, input_size,
+            (char *)output, output_size)) {
+        case 0:
+            return 0;
+        case HEX_TO_BIN_REPEAT:
+            return HEXTOGGLE_REPEAT;
+        default:
+            return HEXTOGGLE_INVALID;
+    }
+}
+
+size_t hextoggle_decode_repeat(HextoggleDecoder *decoder,
+        void *output, size_t output_size) {
+    return hex_repeat_to_bin(&decoder->data, (char *)output, output_size);
+}
+
+void hextoggle_decoder_position(const HextoggleDecoder *decoder,
+        unsigned long long *character,
+        unsigned long long *line,
+        unsigned long long *column) {
+    *character = decoder->data.char_no;
+    *line = decoder->data.line_no;
+    *column = from_hex_column(&decoder->data);
+}
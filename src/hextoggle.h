@@ -0,0 +1,186 @@
+#ifndef HEXTOGGLE_H
+#define HEXTOGGLE_H
+
+/*
+libhextoggle: streaming conversion between binary data and the hextoggle
+format, for programs that want to convert in memory instead of running
+the `hextoggle` command.
+
+Encoders and decoders are created once and can be fed buffers of any
+size. Output goes to buffers provided by the caller, which need to be as
+large as the `*_bound` functions say. Nothing is allocated after a
+context has been created, so contexts can be reused for many inputs with
+`hextoggle_encoder_reset` and `hextoggle_decoder_reset`.
+
+Encoding:
+    HextoggleEncoder *encoder = hextoggle_encoder_create(1);
+    out = malloc(hextoggle_encode_bound(encoder, CHUNK_SIZE));
+    for each chunk:
+        n = hextoggle_encode(encoder, chunk, chunk_size, out);
+        (use the n bytes of output)
+    n = hextoggle_encode_finish(encoder, out);
+    hextoggle_encoder_destroy(encoder);
+
+Decoding:
+    HextoggleDecoder *decoder = hextoggle_decoder_create();
+    out = malloc(hextoggle_decode_bound(CHUNK_SIZE));
+    for each chunk:
+        if (hextoggle_decode(decoder, chunk, chunk_size, out, &n))
+            hextoggle_decoder_position(decoder, &ch, &line, &col);
+    hextoggle_decoder_destroy(decoder);
+*/
+
+#include <stddef.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define HEXTOGGLE_API __attribute__((visibility("default")))
+#else
+#  define HEXTOGGLE_API
+#endif
+
+/* the first line of encoded output (followed by a newline) */
+#define HEXTOGGLE_HEADER "| hextoggle output file"
+enum { HEXTOGGLE_HEADER_LENGTH = 23 };
+
+/* the first line of output in the plain format */
+#define HEXTOGGLE_PLAIN_HEADER "| hextoggle plain file"
+enum { HEXTOGGLE_PLAIN_HEADER_LENGTH = 22 };
+
+/* the first line of canonical output with elided lines, which can
+contain `* N` lines for N more copies of the line above */
+#define HEXTOGGLE_ELIDED_HEADER "| hextoggle elided file"
+enum { HEXTOGGLE_ELIDED_HEADER_LENGTH = 23 };
+
+/* Returned by `hextoggle_decode` for invalid input. */
+enum { HEXTOGGLE_INVALID = 1 };
+
+/* Returned by `hextoggle_decode` after a `* N` line. */
+enum { HEXTOGGLE_REPEAT = 2 };
+
+typedef enum {
+    HextoggleDetectMore, /* too short to tell, but it might be hex */
+    HextoggleDetectHex, /* starts with the header */
+    HextoggleDetectBinary
+} HextoggleDetection;
+
+/**
+ * Decide whether data starting with `input` should be decoded, by
+ * checking for either header. This needs at most HEXTOGGLE_HEADER_LENGTH
+ * bytes of input, and inputs that end while the result is still
+ * HextoggleDetectMore are binary. */
+HEXTOGGLE_API HextoggleDetection hextoggle_detect(
+    const char *input, size_t input_size);
+
+typedef enum {
+    /* address column, 16 bytes as hex digits and an ASCII column */
+    HextoggleFormatCanonical,
+    /* only hex digits, 32 bytes per line, which is less than half the
+        size (decoders read both formats) */
+    HextoggleFormatPlain
+} HextoggleFormat;
+
+typedef struct HextoggleEncoder HextoggleEncoder;
+
+/**
+ * Create an encoder, or return NULL if out of memory.
+ *
+ * `write_header`: whether to start the output with the header line */
+HEXTOGGLE_API HextoggleEncoder *hextoggle_encoder_create(int write_header);
+
+HEXTOGGLE_API void hextoggle_encoder_destroy(HextoggleEncoder *encoder);
+
+/* Start encoding new data, at address 0. */
+HEXTOGGLE_API void hextoggle_encoder_reset(HextoggleEncoder *encoder,
+    int write_header);
+
+/* Select the output format, which is HextoggleFormatCanonical for new
+encoders. This needs to happen before encoding anything, and is kept by
+`hextoggle_encoder_reset`. */
+HEXTOGGLE_API void hextoggle_encoder_set_format(HextoggleEncoder *encoder,
+    HextoggleFormat format);
+
+/* Replace runs of identical lines by the first line and a `* N` line,
+and write HEXTOGGLE_ELIDED_HEADER instead of the usual header. This only
+applies to the canonical format, needs to happen before encoding
+anything, and is kept by `hextoggle_encoder_reset`. */
+HEXTOGGLE_API void hextoggle_encoder_set_elide(HextoggleEncoder *encoder,
+    int elide);
+
+/* Size of the output buffer needed for encoding `input_size` more
+bytes, including everything `hextoggle_encode_finish` may write. */
+HEXTOGGLE_API size_t hextoggle_encode_bound(
+    const HextoggleEncoder *encoder, size_t input_size);
+
+/**
+ * Encode `input_size` bytes of `input`. Complete lines are written to
+ * `output`, and the rest of a line (up to 15 bytes, or 31 in the plain
+ * format) is kept until the next call.
+ *
+ * Return value: the amount of data written to `output` */
+HEXTOGGLE_API size_t hextoggle_encode(HextoggleEncoder *encoder,
+    const void *input, size_t input_size, char *output);
+
+/* Encode `size` zero bytes, e.g. for a hole in a sparse file, without
+going through them one line at a time. This needs an encoder that elides
+lines (see `hextoggle_encoder_set_elide`), and an output buffer of
+`hextoggle_encode_bound(encoder, 32)` bytes. Returns the amount of data
+written to `output`. */
+HEXTOGGLE_API size_t hextoggle_encode_zeros(HextoggleEncoder *encoder,
+    unsigned long long size, char *output);
+
+/* Write the last partial line (and the header, for empty input).
+Returns the amount of data written to `output`. */
+HEXTOGGLE_API size_t hextoggle_encode_finish(HextoggleEncoder *encoder,
+    char *output);
+
+typedef struct HextoggleDecoder HextoggleDecoder;
+
+/* Create a decoder, or return NULL if out of memory. */
+HEXTOGGLE_API HextoggleDecoder *hextoggle_decoder_create(void);
+
+HEXTOGGLE_API void hextoggle_decoder_destroy(HextoggleDecoder *decoder);
+
+/* Start decoding new data. */
+HEXTOGGLE_API void hextoggle_decoder_reset(HextoggleDecoder *decoder);
+
+/* Size of the output buffer needed for decoding `input_size` bytes. */
+HEXTOGGLE_API size_t hextoggle_decode_bound(size_t input_size);
+
+/**
+ * Decode `input_size` bytes of hex data, continuing where the last call
+ * stopped. Input can be split at any position.
+ *
+ * `output_size`: set to the amount of data written to `output`
+ * Return value: 0 on success, or HEXTOGGLE_INVALID if the input is
+ *     invalid. `output` then contains everything decoded before the
+ *     invalid character.
+ *
+ * Decoding stops after a `* N` line with HEXTOGGLE_REPEAT, since its
+ * output can be arbitrarily large. The position (see
+ * `hextoggle_decoder_position`) is then after that line. Call
+ * `hextoggle_decode_repeat` until it returns 0, and continue with the
+ * rest of the input. */
+HEXTOGGLE_API int hextoggle_decode(HextoggleDecoder *decoder,
+    const char *input, size_t input_size,
+    void *output, size_t *output_size);
+
+/* Write as much as fits into `output_size` bytes (at least 16) of the
+lines repeated by a `* N` line. Returns the amount written, or 0 once
+they have all been written. */
+HEXTOGGLE_API size_t hextoggle_decode_repeat(HextoggleDecoder *decoder,
+    void *output, size_t output_size);
+
+/**
+ * Get the position of the next character to decode, or of the invalid
+ * character after an error.
+ *
+ * `character`: offset in the input, starting at 0
+ * `line`: starting at 1
+ * `column`: starting at 1, or 0 for a newline */
+HEXTOGGLE_API void hextoggle_decoder_position(
+    const HextoggleDecoder *decoder,
+    unsigned long long *character,
+    unsigned long long *line,
+    unsigned long long *column);
+
+#endif /* HEXTOGGLE_H */
@@ -4,139 +4,147 @@
 */
 
 #include "args.h"
+#include "batch.h"
 #include "bin_to_hex.h"
+#include "compress.h"
+#include "diff.h"
+#include "direct_io.h"
+#include "follow.h"
+#include "hex_to_bin.h"
+#include "hextoggle.h"
+#include "manifest.h"
+#include "mapped_io.h"
+#include "parallel.h"
+#include "pipe_io.h"
+#include "range.h"
+#include "search.h"
+#include "sparse_io.h"
+#include "stats.h"
 #include "tempfile.h"
+#include "uring_io.h"
 #include "utils.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static const char *header = "| hextoggle output file";
-enum { HEADER_LENGTH = 23 };
+static const char *header = HEXTOGGLE_HEADER;
+enum { HEADER_LENGTH = HEXTOGGLE_HEADER_LENGTH };
 
-static int cleanup_files(FILE *input, FILE *temp_output,
-                  const char *temp_output_filename,
+static int cleanup_files(FILE *input, FILE *output,
+                  TempFile *temp_output,
                   Args args) {
-    if (args.output_kind == OutputKindFileName && temp_output) {
-        fclose(temp_output);
-    }
     if (args.input_kind == InputKindFileName) {
         fclose(input);
     }
-    if (args.output_kind != OutputKindFileName)
-        return 0;
-    if (!temp_output_filename[0]) {
-        /* we wrote directly to the target file,
-            so no need to rename things */
-        return 0;
-    }
-#ifdef _MSC_VER
-    if (-1 == remove(args.output_filename)) {
-        if (errno != ENOENT) {
-            /* target file does exist but we cannot delete it */
-            fprintf(stderr, "Unable to remove file `%s`: %s\n",
-                temp_output_filename, strerror(errno));
-            return 1;
-        }
-    }
-#endif
-    if (args.verbose) {
-        fprintf(stderr, "Moving file `%s` to `%s`\n",
-            temp_output_filename, args.output_filename);
+    if (temp_output->file) {
+        /* we wrote to a temporary file next to the target */
+        return publish_temporary_file(
+            temp_output, args.output_filename, args.verbose);
     }
-    if (-1 == rename(temp_output_filename, args.output_filename)) {
-        fprintf(stderr, "Unable to rename file `%s` to `%s`: %s\n",
-            temp_output_filename,
-            args.output_filename,
-            strerror(errno));
-        return 1;
+    if (args.output_kind == OutputKindFileName && output) {
+        fclose(output);
     }
     return 0;
 }
 
-typedef struct {
-    int inside_comment; /* potentially nested comments */
-    BOOL skip_line;
-    char prev_byte;
-} FromHexData;
-
-static FromHexData init_from_hex_data() {
-    FromHexData result;
-    result.prev_byte = 0;
-    result.skip_line = FALSE;
-    result.inside_comment = 0;
-    return result;
-}
+/* Write the lines repeated by the `* N` line that `decoder` just read,
+using `output` (of `output_size` bytes) as a buffer. */
+static void write_repeats(HextoggleDecoder *decoder,
+        FILE *output_file,
+        char *output,
+        size_t output_size) {
+    size_t output_length;
+    double start;
 
-static int hex_to_chars(
-        FromHexData *data, char c, FILE *output_stream) {
-    int first_char, second_char;
-    char output;
-
-    if (data->prev_byte) {
-        if ((c >= '0' && c <= '9')
-                || (c >= 'a' && c <= 'f')
-                || (c >= 'A' && c <= 'F')) {
-            first_char = hex_char_to_int(data->prev_byte);
-            if (first_char < 0) {
-                return 1;
-            }
-            output = (char)(first_char << 4);
-            second_char = hex_char_to_int(c);
-            if (second_char < 0) {
-                return 1;
-            }
-            output += (char)second_char;
-            if (output_stream) {
-                fputc(output, output_stream);
-            }
-            data->prev_byte = 0;
-            return 0;
-        } else {
-            return 1;
+    for (;;) {
+        start = stats_clock();
+        output_length = hextoggle_decode_repeat(
+            decoder, output, output_size);
+        if (!output_length) {
+            break;
+        }
+        if (output_file) {
+            fwrite(output, output_length, 1, output_file);
         }
+        stats_end(StatsWrite, start, output_length);
     }
+}
 
-    /* It's important to process skipped lines BEFORE block comments
-        because otherwise '[' and ']' characters on the right-hand side
-        can unintentionally break the file. */
-    if (data->skip_line && c != '\n') {
-        return 0;
-    }
-    if (c == '\n') {
-        data->skip_line = FALSE;
-        return 0;
-    }
-    if (c == '|') {
-        data->skip_line = TRUE;
-        return 0;
-    }
+/* Decode the rest of `input_file` with `decoder`, using the fastest
+I/O backend that works for these files. Returns 0 for success, 1 for
+invalid input or 2 for other errors. */
+static int decode_rest(FILE *input_file,
+        FILE *output_file,
+        HextoggleDecoder *decoder,
+        unsigned jobs,
+        BOOL sparse,
+        BOOL direct) {
+    /* READ_BUFFER_SIZE describes the amount of hex data to decode at
+        once. Each byte of output needs at least two bytes of input. */
+    enum { READ_BUFFER_SIZE = 1 << 16 };
 
-    if (c == '[') {
-        ++data->inside_comment;
-        return 0;
-    }
-    if (data->inside_comment && c == ']') {
-        --data->inside_comment;
-        return 0;
-    }
-    if (data->inside_comment) {
-        return 0;
-    }
+    char input[READ_BUFFER_SIZE];
+    char output[READ_BUFFER_SIZE / 2 + 1];
+    size_t input_length, output_length, offset;
+    unsigned long long before, after, line_no, column;
+    int status;
+    double start;
 
-    if ((c >= '0' && c <= '9')
-            || (c >= 'a' && c <= 'f')
-            || (c >= 'A' && c <= 'F')) {
-        data->prev_byte = c;
-        return 0;
+    /* the I/O backends share the library's decoder state, but leave
+        `* N` lines to the loop below */
+    if (direct && (status = direct_from_hex(input_file, output_file,
+            decoder)) != DIRECT_IO_UNSUPPORTED) {
+        return status;
+    } else if (sparse && (status = sparse_from_hex(input_file, output_file,
+            decoder)) != SPARSE_IO_UNSUPPORTED) {
+        return status;
+    } else if (decoder->data.allow_repeat) {
+        /* elided file */
+    } else if (jobs > 1) {
+        return parallel_from_hex(
+            input_file, output_file, &decoder->data, jobs);
+    } else if ((status = pipe_from_hex(input_file, output_file,
+                &decoder->data)) != PIPE_IO_UNSUPPORTED
+            || (status = mapped_from_hex(input_file, output_file,
+                &decoder->data)) != MAPPED_IO_UNSUPPORTED
+            || (status = uring_from_hex(input_file, output_file,
+                &decoder->data)) != URING_IO_UNSUPPORTED) {
+        return status;
     }
-    if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
-        return 0;
+    status = 0;
+    while (!status) {
+        start = stats_clock();
+        input_length = fread(input, 1, READ_BUFFER_SIZE, input_file);
+        stats_end(StatsRead, start, input_length);
+        if (!input_length) {
+            break;
+        }
+        offset = 0;
+        do {
+            /* decoding stops after each `* N` line */
+            hextoggle_decoder_position(decoder, &before, &line_no, &column);
+            start = stats_clock();
+            status = hextoggle_decode(decoder, input + offset,
+                input_length - offset, output, &output_length);
+            hextoggle_decoder_position(decoder, &after, &line_no, &column);
+            offset += (size_t)(after - before);
+            stats_end(StatsConvert, start, after - before);
+            if (output_file && output_length) {
+                start = stats_clock();
+                fwrite(output, output_length, 1, output_file);
+                stats_end(StatsWrite, start, output_length);
+            }
+            if (status == HEXTOGGLE_REPEAT) {
+                write_repeats(decoder, output_file, output, sizeof(output));
+                status = 0;
+            }
+        } while (!status && offset < input_length);
     }
-    return 1;
+    return status;
 }
 
 /* Return values: 0 for success, 1 for retry as to_hex, 2 for error */
@@ -144,79 +152,223 @@ static int try_from_hex(FILE *input_file,
         FILE *output_file,
         char *from_hex_read_buffer,
         size_t *from_hex_read_buffer_length,
-        BOOL check_header) {
-    int ci;
-    unsigned long long i = 0;
-    unsigned long long line_no = 1;
-    unsigned long long col_no = 0;
-    FromHexData data = init_from_hex_data();
-    while ((ci = fgetc(input_file)) != EOF) {
-        char c = (char)ci;
-        if (c == '\n') {
-            ++line_no;
-            col_no = 0;
-        } else {
-            ++col_no;
+        BOOL check_header,
+        unsigned jobs,
+        BOOL sparse,
+        BOOL direct) {
+    char output[HEADER_LENGTH / 2 + 1];
+    size_t length, output_length;
+    unsigned long long char_no, line_no, column;
+    int status;
+    double start;
+    Compression compression;
+    HextoggleDecoder decoder;
+
+    hextoggle_decoder_reset(&decoder);
+    start = stats_clock();
+    *from_hex_read_buffer_length = fread(
+        from_hex_read_buffer, 1, HEADER_LENGTH, input_file);
+    stats_end(StatsRead, start, *from_hex_read_buffer_length);
+
+    /* compressed hex files are recognised by their magic bytes */
+    compression = detect_compression(
+        from_hex_read_buffer, *from_hex_read_buffer_length);
+    if (compression != CompressionNone
+            && !compression_supported(compression) && !check_header) {
+        fprintf(stderr,
+            "Error: %s input is not supported by this build\n",
+            compression_name(compression));
+        return 2;
+    } else if (compression != CompressionNone
+            && compression_supported(compression)) {
+        /* the magic bytes alone could start any compressed file */
+        start = stats_clock();
+        length = fread(from_hex_read_buffer + HEADER_LENGTH, 1,
+            COMPRESSION_PROBE_SIZE - HEADER_LENGTH, input_file);
+        stats_end(StatsRead, start, length);
+        *from_hex_read_buffer_length += length;
+        if (check_header && !is_compressed_hex(compression,
+                from_hex_read_buffer, *from_hex_read_buffer_length)) {
+            return 1;
         }
-        if (check_header && i < HEADER_LENGTH) {
-            from_hex_read_buffer[*from_hex_read_buffer_length] = c;
-            ++*from_hex_read_buffer_length;
-            if (header[i] != c) {
-                return 1;
-            }
+        status = compressed_from_hex(input_file, output_file,
+            from_hex_read_buffer, *from_hex_read_buffer_length,
+            compression, &decoder);
+    } else {
+        if (check_header && hextoggle_detect(from_hex_read_buffer,
+                *from_hex_read_buffer_length) != HextoggleDetectHex) {
+            /* header was incomplete or different (or file was empty) */
+            return 1;
         }
-        if (hex_to_chars(&data, c, output_file)) {
-            fprintf(stderr,
-                "Error: invalid format at character %llu, line %llu, "
-                "col %llu, aborting\n",
-                i, line_no, col_no);
-            return 2;
+        /* only elided files can contain `* N` lines */
+        decoder.data.allow_repeat = *from_hex_read_buffer_length
+                == HEXTOGGLE_ELIDED_HEADER_LENGTH
+            && !memcmp(from_hex_read_buffer, HEXTOGGLE_ELIDED_HEADER,
+                HEXTOGGLE_ELIDED_HEADER_LENGTH);
+        /* this is the header, which is a `|` line that produces no
+            output, unless the header wasn't required */
+        status = hextoggle_decode(&decoder, from_hex_read_buffer,
+            *from_hex_read_buffer_length, output, &output_length);
+        stats_count(StatsConvert, *from_hex_read_buffer_length);
+        if (output_file && output_length) {
+            fwrite(output, output_length, 1, output_file);
+        }
+        if (!status) {
+            status = decode_rest(input_file, output_file, &decoder,
+                jobs, sparse, direct);
         }
-        ++i;
     }
-    if (check_header && i < HEADER_LENGTH) {
-        /* header was incomplete (or file was empty) */
-        return 1;
+
+    hextoggle_decoder_position(&decoder, &char_no, &line_no, &column);
+    if (stats.enabled) {
+        /* the position is past the last newline unless the last line
+            is incomplete */
+        stats.lines = column > 1 ? line_no : line_no - 1;
     }
-    
-    return 0;
+    if (status == 1) {
+        fprintf(stderr,
+            "Error: invalid format at character %llu, line %llu, "
+            "col %llu, aborting\n",
+            char_no, line_no, column);
+    }
+    return status ? 2 : 0;
 }
 
 static int try_to_hex(FILE *input_file, FILE *output_file,
+        TempFile *temp_output,
         const char *from_hex_read_buffer,
-        size_t from_hex_read_buffer_length) {
-    unsigned long long addr, output_data_len;
-    size_t i;
+        size_t from_hex_read_buffer_length,
+        unsigned jobs,
+        unsigned long long skip,
+        unsigned long long length,
+        const char *manifest_filename,
+        Compression compression,
+        int compression_level,
+        HextoggleFormat format,
+        BOOL elide,
+        BOOL sparse,
+        BOOL direct,
+        BOOL follow) {
+    size_t i, read_length, output_data_len;
+    int status;
+    double start;
+    HextoggleEncoder encoder;
+    const char *format_header = header;
+    size_t header_length = HEADER_LENGTH;
 
     /* BLOCK_BATCH describes the number of blocks (sets of 16 bytes)
-        to convert at once. Each block produces 81 bytes of output. */
-    enum { BLOCK_BATCH = 64 };
+        to convert at once. Each block produces 81 bytes of output, and
+        elided output can add a `* N` line before and after them. */
+    enum { BLOCK_BATCH = 1024 };
 
-    char output[81 * BLOCK_BATCH];
+    char output[81 * BLOCK_BATCH + 2 * REPEAT_LINE_LENGTH];
     char input[16 * BLOCK_BATCH];
 
+    if (compression != CompressionNone) {
+        /* the header is compressed as well */
+        return compressed_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length,
+            compression, compression_level, format, elide);
+    }
+    if (format == HextoggleFormatPlain) {
+        header_length = HEXTOGGLE_PLAIN_HEADER_LENGTH;
+        format_header = HEXTOGGLE_PLAIN_HEADER;
+    } else if (elide) {
+        header_length = HEXTOGGLE_ELIDED_HEADER_LENGTH;
+        format_header = HEXTOGGLE_ELIDED_HEADER;
+    }
     if (output_file) {
-        fputs(header, output_file);
+        fputs(format_header, output_file);
         fputc('\n', output_file);
+        stats_count(StatsWrite, header_length + 1);
+    }
+    if (skip || length != ULLONG_MAX) {
+        return encode_range(input_file, output_file, skip, length);
+    } else if (manifest_filename) {
+        return encode_with_manifest(
+            input_file, output_file, manifest_filename);
+    }
+    if (follow && (status = follow_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length))
+                != FOLLOW_UNSUPPORTED) {
+        return status;
+    }
+    if (temp_output && !elide) {
+        /* the size of the output is known in advance */
+        preallocate_temporary_file(temp_output,
+            header_length + 1 + format_hex_size(format,
+                from_hex_read_buffer_length
+                + remaining_file_size(input_file)));
+    }
+
+    if (direct && (status = direct_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length,
+            format, elide)) != DIRECT_IO_UNSUPPORTED) {
+        return status;
+    } else if (sparse && (status = sparse_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length))
+                != SPARSE_IO_UNSUPPORTED) {
+        return status;
+    } else if (elide) {
+        /* only the streaming encoder below compares lines */
+    } else if (jobs > 1) {
+        return parallel_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length,
+            format, jobs);
+    } else if ((status = mapped_to_hex(input_file, output_file,
+                from_hex_read_buffer, from_hex_read_buffer_length,
+                format)) != MAPPED_IO_UNSUPPORTED) {
+        return status;
+    } else if (format == HextoggleFormatCanonical) {
+        /* the pipe and io_uring backends only write canonical lines */
+        status = pipe_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length);
+        if (status != PIPE_IO_UNSUPPORTED) {
+            return status;
+        }
+        status = uring_to_hex(input_file, output_file,
+            from_hex_read_buffer, from_hex_read_buffer_length);
+        if (status != URING_IO_UNSUPPORTED) {
+            return status;
+        }
     }
     
-    addr = 0;
-    
-    /* read in chars already read in by try_from_hex */
-    memcpy(input, from_hex_read_buffer, from_hex_read_buffer_length);
+    /* the header has already been written */
+    hextoggle_encoder_reset(&encoder, FALSE);
+    hextoggle_encoder_set_format(&encoder, format);
+    hextoggle_encoder_set_elide(&encoder, elide);
     
     for (;;) {
-        i = from_hex_read_buffer_length
-            + fread(input + from_hex_read_buffer_length,
-                    1,
-                    16 * (size_t)BLOCK_BATCH
-                        - from_hex_read_buffer_length,
-                    input_file);
-        from_hex_read_buffer_length = 0;
-        output_data_len = bin_data_to_hex(input, i, addr, output);
-        addr += i;
+        /* use up the chars already read in by try_from_hex, which can
+            be more than a batch, before reading more */
+        i = from_hex_read_buffer_length < 16 * BLOCK_BATCH
+            ? from_hex_read_buffer_length : 16 * BLOCK_BATCH;
+        memcpy(input, from_hex_read_buffer, i);
+        from_hex_read_buffer += i;
+        from_hex_read_buffer_length -= i;
+        if (!from_hex_read_buffer_length) {
+            start = stats_clock();
+            read_length = fread(input + i, 1, 16 * BLOCK_BATCH - i,
+                input_file);
+            stats_end(StatsRead, start, read_length);
+            i += read_length;
+        }
+        start = stats_clock();
+        output_data_len = hextoggle_encode(&encoder, input, i, output);
+        if (i < 16 * BLOCK_BATCH) {
+            /* `input` held less than a full batch, so there is room
+                for the last line */
+            output_data_len += hextoggle_encode_finish(
+                &encoder, output + output_data_len);
+        }
+        stats_end(StatsConvert, start, i);
+        if (elide) {
+            stats_count_lines(output, output_data_len);
+        }
         if (output_file) {
+            start = stats_clock();
             fwrite(output, output_data_len, 1, output_file);
+            stats_end(StatsWrite, start, output_data_len);
         }
         if (i < 16 * BLOCK_BATCH) {
             break;
@@ -226,7 +378,7 @@ static int try_to_hex(FILE *input_file, FILE *output_file,
 }
 
 static int open_files(FILE **input_file, FILE **output_file,
-               Args args, char *output_filename_buffer) {
+               Args args, TempFile *temp_output, BOOL patch_output) {
     if (args.input_kind == InputKindStdio) {
         *input_file = stdin;
         if (args.verbose) {
@@ -259,14 +411,28 @@ static int open_files(FILE **input_file, FILE **output_file,
         if (args.input_kind == InputKindFileName
                 && !strcmp(args.output_filename, args.input_filename)) {
             /* if the filenames are the same we need a temp file */
-            *output_file = open_temporary_file(output_filename_buffer);
-            if (args.verbose) {
+            if (!open_temporary_file(temp_output, args.output_filename)) {
+                fclose(*input_file);
+                return StatusCodeFailedToOpenFiles;
+            }
+            *output_file = temp_output->file;
+            if (args.verbose && temp_output->filename) {
                 fprintf(stderr, "Writing to temporary file `%s`\n",
-                    output_filename_buffer);
+                    temp_output->filename);
+            } else if (args.verbose) {
+                fprintf(stderr, "Writing to unnamed temporary file\n");
             }
         } else {
-            /* otherwise open the file directly */
-            *output_file = fopen(args.output_filename, "wb");
+            /* otherwise open the file directly (for reading as well,
+                since writable memory mappings need that), keeping its
+                contents if we might only patch or resume it */
+            *output_file = NULL;
+            if (patch_output || args.resume) {
+                *output_file = fopen(args.output_filename, "r+b");
+            }
+            if (!*output_file) {
+                *output_file = fopen(args.output_filename, "w+b");
+            }
             if (!*output_file) {
                 fprintf(stderr,
                     "Unable to open file `%s` for writing: %s\n",
@@ -292,37 +458,154 @@ static int open_files(FILE **input_file, FILE **output_file,
     return 0;
 }
 
-int main(int argc, const char *argv[]) {
-    Args args;
+/* Patch `args.output_filename` with the diff read from the input.
+Returns EXIT_SUCCESS or a `StatusCode`. */
+static int apply_input(Args args) {
+    FILE *diff_file = stdin;
+    int status;
+
+    if (args.input_kind == InputKindFileName) {
+        diff_file = fopen(args.input_filename, "rb");
+        if (!diff_file) {
+            fprintf(stderr,
+                "Unable to open file `%s` for reading: %s\n",
+                args.input_filename, strerror(errno));
+            return StatusCodeFailedToOpenFiles;
+        }
+    }
+    status = apply_diff(diff_file, args.output_filename,
+        args.output_kind == OutputKindFileName, args.verbose);
+    if (args.input_kind == InputKindFileName) {
+        fclose(diff_file);
+    }
+    return status == 1 ? StatusCodeFailedToOpenFiles
+        : status ? StatusCodeInvalidInput : EXIT_SUCCESS;
+}
+
+/* Continue the conversion of the input into the output written so far,
+decoding if the input is hex (or decoding was asked for). Returns 0 for
+success, or 1 or 2 on error. */
+static int resume_conversion(FILE *input_file, FILE *output_file,
+        Args args) {
+    char buffer[HEADER_LENGTH];
+    size_t length;
+    double start;
+    BOOL decode = args.conversion == ConversionOnlyDecode;
+
+    if (args.conversion == ConversionAutoDetect) {
+        start = stats_clock();
+        length = fread(buffer, 1, HEADER_LENGTH, input_file);
+        stats_end(StatsRead, start, length);
+        decode = hextoggle_detect(buffer, length) == HextoggleDetectHex;
+    }
+    if (decode) {
+        return resume_decode(input_file, args.input_filename,
+            output_file, args.verbose);
+    }
+    return resume_encode(input_file, output_file, args.verbose);
+}
+
+/* Convert a single file as described by `args`. Returns EXIT_SUCCESS
+or a `StatusCode`. */
+static int convert(Args args) {
     FILE *input_file, *output_file;
-    char output_filename_buffer[TEMP_FILENAME_SIZE];
+    TempFile temp_output;
+    BOOL patch_output;
     size_t from_hex_read_buffer_length;
-    char from_hex_read_buffer[HEADER_LENGTH];
+    char *from_hex_read_buffer = NULL;
+    unsigned long long line_bytes;
 
-    args = parse_args(argc, argv);
-    if (args.exit_with_error) {
-        return args.exit_with_error;
-    } else if (args.exit_with_success) {
-        return EXIT_SUCCESS;
+    if (args.apply) {
+        return apply_input(args);
     }
 
-    output_filename_buffer[0] = '\0';
+    /* a hex file with a manifest can be decoded by patching the binary
+        it was made from */
+    patch_output = args.conversion != ConversionOnlyEncode
+        && !args.range && !args.write_index && !args.search
+        && !args.resume
+        && args.input_kind == InputKindFileName
+        && args.output_kind == OutputKindFileName
+        && strcmp(args.output_filename, args.input_filename)
+        && manifest_exists(args.input_filename);
+
+    temp_output.file = NULL;
+    temp_output.filename = NULL;
     if (open_files(&input_file, &output_file,
             args,
-            output_filename_buffer)) {
+            &temp_output, patch_output)) {
         return StatusCodeFailedToOpenFiles;
     }
-    
-    /* store read characters in case we need to retry as to_hex. */
+    if (args.stats || args.progress) {
+        stats_start(args.progress, remaining_file_size(input_file));
+    }
+
+    if (args.diff_filename) {
+        if (diff_files(input_file,
+                args.input_kind == InputKindFileName
+                    ? args.input_filename : NULL,
+                args.diff_filename, output_file,
+                args.jobs, args.verbose)) {
+            goto failure_cleanup;
+        }
+        goto success_cleanup;
+    } else if (args.search) {
+        if (search_input(input_file, output_file, &args.search_pattern,
+                args.verbose)) {
+            goto failure_cleanup;
+        }
+        goto success_cleanup;
+    } else if (args.resume) {
+        if (resume_conversion(input_file, output_file, args)) {
+            goto failure_cleanup;
+        }
+        goto success_cleanup;
+    } else if (args.range) {
+        if (decode_range(input_file,
+                args.input_kind == InputKindFileName
+                    ? args.input_filename : NULL,
+                output_file,
+                args.range_start, args.range_length,
+                args.verbose)) {
+            goto failure_cleanup;
+        }
+        goto success_cleanup;
+    } else if (args.write_index) {
+        if (write_range_index(input_file, args.input_filename,
+                args.verbose)) {
+            goto failure_cleanup;
+        }
+        goto success_cleanup;
+    } else if (patch_output) {
+        switch (patch_from_manifest(input_file, args.input_filename,
+                output_file, header, args.verbose)) {
+            case 0: /* success */
+                goto success_cleanup;
+
+            case MANIFEST_UNUSABLE: /* decode everything instead */
+                break;
+
+            default:
+                goto failure_cleanup;
+        }
+    }
+
+    /* store read characters in case we need to retry as to_hex. This
+        is enough for recognising compressed hex files. */
     from_hex_read_buffer_length = 0;
-    memset(from_hex_read_buffer, 0, HEADER_LENGTH);
+    from_hex_read_buffer = (char *)calloc(COMPRESSION_PROBE_SIZE, 1);
+    if (!from_hex_read_buffer) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        goto failure_cleanup;
+    }
 
     if (args.conversion == ConversionOnlyDecode
             || args.conversion == ConversionAutoDetect) {
         switch (try_from_hex(
             input_file, output_file,
             from_hex_read_buffer, &from_hex_read_buffer_length,
-            args.conversion == ConversionAutoDetect)) {
+            args.conversion == ConversionAutoDetect,
+            args.jobs, args.sparse, args.direct)) {
 
             case 0: /* success */
                 goto success_cleanup;
@@ -336,28 +619,59 @@ int main(int argc, const char *argv[]) {
     }
 
     if (try_to_hex(input_file, output_file,
-                from_hex_read_buffer, from_hex_read_buffer_length)) {
+                temp_output.file ? &temp_output : NULL,
+                from_hex_read_buffer, from_hex_read_buffer_length,
+                args.jobs, args.skip, args.length,
+                args.manifest ? args.output_filename : NULL,
+                args.compression, args.compression_level,
+                args.format, args.elide || args.sparse, args.sparse,
+                args.direct, args.follow)) {
         /* on error: */
         goto failure_cleanup;
     }
+    if (stats.enabled && (args.elide || args.sparse)) {
+        /* the lines were counted while encoding */
+        stats.lines += 1;
+    } else if (stats.enabled) {
+        /* the header line, and a line per 16 (or 32) bytes */
+        line_bytes = args.format == HextoggleFormatPlain
+            ? PLAIN_LINE_BYTES : 16;
+        stats.lines = 1 + (stats.bytes[StatsConvert] + line_bytes - 1)
+            / line_bytes;
+    }
 
     /* continue through to success cleanup */
 
 success_cleanup:
+    free(from_hex_read_buffer);
+    stats_finish(stderr, args.stats);
     if (cleanup_files(input_file, output_file,
-            output_filename_buffer,
+            &temp_output,
             args)) {
         return StatusCodeFailedCleanup;
     }
     return EXIT_SUCCESS;
 
 failure_cleanup:
+    free(from_hex_read_buffer);
+    stats_finish(stderr, args.stats);
     fclose(input_file);
-    if (output_file) {
+    if (temp_output.file) {
+        discard_temporary_file(&temp_output);
+    } else if (output_file) {
         fclose(output_file);
-        if (output_filename_buffer[0]) {
-            remove(output_filename_buffer);
-        }
     }
     return StatusCodeInvalidInput;
 }
+
+int main(int argc, const char *argv[]) {
+    Args args = parse_args(argc, argv);
+    if (args.exit_with_error) {
+        return args.exit_with_error;
+    } else if (args.exit_with_success) {
+        return EXIT_SUCCESS;
+    } else if (args.batch) {
+        return run_batch(args, convert);
+    }
+    return convert(args);
+}
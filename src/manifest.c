@@ -0,0 +1,471 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "manifest.h"
+
+#include "utils.h"
+
+#include <stdio.h>
+
+#ifdef _MSC_VER
+
+BOOL manifest_exists(const char *hex_filename) {
+    (void)hex_filename;
+    return FALSE;
+}
+
+int encode_with_manifest(FILE *input_file,
+        FILE *output_file,
+        const char *output_filename) {
+    (void)input_file;
+    (void)output_file;
+    (void)output_filename;
+    fprintf(stderr, "Error: manifests are not supported on Windows\n");
+    return 1;
+}
+
+int patch_from_manifest(FILE *input_file,
+        const char *input_filename,
+        FILE *output_file,
+        const char *header,
+        BOOL verbose) {
+    (void)input_file;
+    (void)input_filename;
+    (void)output_file;
+    (void)header;
+    (void)verbose;
+    return MANIFEST_UNUSABLE;
+}
+
+#else
+
+#include "bin_to_hex.h"
+#include "file_version.h"
+#include "hex_to_bin.h"
+#include "mapped_io.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* every block of BLOCK_LINES lines holds BLOCK_SIZE bytes of data
+    (except for the last one) */
+enum { BLOCK_LINES = 4096, BLOCK_SIZE = 16 * BLOCK_LINES };
+
+/* a block is decoded at most BLOCK_SIZE * 2 characters at a time, so
+    BLOCK_SIZE * 2 + 1 bytes of output are enough to detect blocks that
+    decode to too much data */
+enum { DECODE_PIECE_SIZE = BLOCK_SIZE * 2 };
+
+#define HASH_MULTIPLIER 0x9e3779b97f4a7c15ull
+
+static const char *manifest_header = "| hextoggle manifest";
+
+typedef struct {
+    unsigned long long size; /* of the binary data */
+    FileVersion version; /* of the binary file */
+    unsigned long long block_count;
+    unsigned long long *hashes; /* of the hex text of every block */
+} Manifest;
+
+/* a block that was edited since the manifest was written */
+typedef struct {
+    unsigned long long block;
+    const char *text;
+    size_t length;
+} ChangedBlock;
+
+static char *manifest_filename(const char *hex_filename) {
+    char *filename = (char *)malloc(strlen(hex_filename) + 10);
+    if (filename) {
+        sprintf(filename, "%s.manifest", hex_filename);
+    }
+    return filename;
+}
+
+BOOL manifest_exists(const char *hex_filename) {
+    struct stat info;
+    char *filename = manifest_filename(hex_filename);
+    BOOL exists = filename && !stat(filename, &info);
+    free(filename);
+    return exists;
+}
+
+/* Hash `length` bytes of `text`. This only needs to detect edits, so it
+ * mixes in 8 bytes at a time, in four independent lanes. */
+static unsigned long long hash_text(const char *text, size_t length) {
+    unsigned long long lanes[4], word, hash;
+    size_t i;
+
+    for (i = 0; i < 4; ++i) {
+        lanes[i] = (length + i) * HASH_MULTIPLIER;
+    }
+    for (; length >= 32; text += 32, length -= 32) {
+        for (i = 0; i < 4; ++i) {
+            memcpy(&word, text + 8 * i, 8);
+            lanes[i] = (lanes[i] ^ word) * HASH_MULTIPLIER;
+            lanes[i] ^= lanes[i] >> 29;
+        }
+    }
+    hash = lanes[0];
+    for (i = 1; i < 4; ++i) {
+        hash = (hash ^ lanes[i]) * HASH_MULTIPLIER;
+        hash ^= hash >> 29;
+    }
+    for (; length; text += i, length -= i) {
+        i = length < 8 ? length : 8;
+        word = 0;
+        memcpy(&word, text, i);
+        hash = (hash ^ word) * HASH_MULTIPLIER;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+static int write_manifest(const Manifest *manifest,
+        const char *hex_filename) {
+    char *filename;
+    FILE *file;
+    unsigned long long block;
+    int status = 0;
+
+    filename = manifest_filename(hex_filename);
+    if (!filename) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+    file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Unable to open file `%s` for writing: %s\n",
+            filename, strerror(errno));
+        free(filename);
+        return 1;
+    }
+    fprintf(file, "%s\n%llu " FILE_VERSION_FORMAT "\n", manifest_header,
+        manifest->size, manifest->version.mtime,
+        manifest->version.mtime_nsec, manifest->version.ctime,
+        manifest->version.ctime_nsec, manifest->version.inode);
+    for (block = 0; block < manifest->block_count; ++block) {
+        fprintf(file, "%016llx\n", manifest->hashes[block]);
+    }
+    if (fclose(file)) {
+        fprintf(stderr, "Error: Unable to write `%s`: %s\n",
+            filename, strerror(errno));
+        remove(filename);
+        status = 1;
+    }
+    free(filename);
+    return status;
+}
+
+static BOOL read_manifest(const char *hex_filename, Manifest *manifest,
+        BOOL verbose) {
+    char header[32], sizes[128];
+    char *filename;
+    FILE *file;
+    unsigned long long block;
+    BOOL valid = FALSE;
+
+    manifest->hashes = NULL;
+    filename = manifest_filename(hex_filename);
+    if (!filename) {
+        return FALSE;
+    }
+    file = fopen(filename, "rb");
+    if (!file) {
+        free(filename);
+        return FALSE;
+    }
+    if (fgets(header, sizeof(header), file)
+            && !strncmp(header, manifest_header, strlen(manifest_header))
+            && fgets(sizes, sizeof(sizes), file)
+            && sscanf(sizes, "%llu " FILE_VERSION_FORMAT,
+                &manifest->size, &manifest->version.mtime,
+                &manifest->version.mtime_nsec, &manifest->version.ctime,
+                &manifest->version.ctime_nsec,
+                &manifest->version.inode) == 6) {
+        manifest->block_count = manifest->size / BLOCK_SIZE
+            + (manifest->size % BLOCK_SIZE != 0);
+        manifest->hashes = (unsigned long long *)malloc(
+            (size_t)manifest->block_count * sizeof(*manifest->hashes) + 1);
+        for (block = 0; manifest->hashes
+                && block < manifest->block_count
+                && fscanf(file, "%llx", &manifest->hashes[block]) == 1;
+                ++block) {
+        }
+        valid = manifest->hashes && block == manifest->block_count;
+    }
+    if (!valid) {
+        fprintf(stderr, "Ignoring invalid manifest `%s`\n", filename);
+        free(manifest->hashes);
+        manifest->hashes = NULL;
+    } else if (verbose) {
+        fprintf(stderr, "Using manifest `%s`\n", filename);
+    }
+    fclose(file);
+    free(filename);
+    return valid;
+}
+
+int encode_with_manifest(FILE *input_file,
+        FILE *output_file,
+        const char *output_filename) {
+    Manifest manifest;
+    char *input, *output;
+    unsigned long long *hashes;
+    size_t input_length, output_length, capacity = 0;
+    int status;
+    double start;
+
+    input = (char *)malloc(BLOCK_SIZE + (size_t)81 * BLOCK_LINES);
+    if (!input) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+    output = input + BLOCK_SIZE;
+    manifest.size = 0;
+    manifest.block_count = 0;
+    manifest.hashes = NULL;
+
+    for (;;) {
+        start = stats_clock();
+        input_length = fread(input, 1, BLOCK_SIZE, input_file);
+        stats_end(StatsRead, start, input_length);
+        if (!input_length) {
+            break;
+        }
+        start = stats_clock();
+        output_length = bin_data_to_hex(
+            input, input_length, manifest.size, output);
+        if (manifest.block_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            hashes = (unsigned long long *)realloc(
+                manifest.hashes, capacity * sizeof(*hashes));
+            if (!hashes) {
+                fprintf(stderr, "Error: Unable to allocate buffers\n");
+                free(manifest.hashes);
+                free(input);
+                return 1;
+            }
+            manifest.hashes = hashes;
+        }
+        manifest.hashes[manifest.block_count++]
+            = hash_text(output, output_length);
+        stats_end(StatsConvert, start, input_length);
+        manifest.size += input_length;
+        start = stats_clock();
+        fwrite(output, output_length, 1, output_file);
+        stats_end(StatsWrite, start, output_length);
+        if (input_length < BLOCK_SIZE) {
+            break;
+        }
+    }
+    free(input);
+
+    if (ferror(input_file)
+            || !get_file_version(input_file, &manifest.version)) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+        free(manifest.hashes);
+        return 1;
+    }
+    status = write_manifest(&manifest, output_filename);
+    free(manifest.hashes);
+    return status;
+}
+
+/* Find the end of the block starting at `position`. */
+static const char *next_block(const char *position, const char *end) {
+    const char *newline;
+    unsigned lines;
+
+    for (lines = 0; lines < BLOCK_LINES && position < end; ++lines) {
+        newline = (const char *)memchr(
+            position, '\n', (size_t)(end - position));
+        position = newline ? newline + 1 : end;
+    }
+    return position;
+}
+
+/* Decode a block into `output`, which needs space for
+ * DECODE_PIECE_SIZE / 2 + BLOCK_SIZE + 1 bytes. The block must decode
+ * to `expected` bytes, and leave the decoder in its initial state so
+ * the next block can be decoded on its own. */
+static int decode_block(FromHexData *data,
+        const char *text,
+        size_t length,
+        BOOL last_block,
+        char *output,
+        size_t expected) {
+    size_t piece, decoded = 0, output_length;
+
+    while (length) {
+        piece = length < DECODE_PIECE_SIZE ? length : DECODE_PIECE_SIZE;
+        if (hex_data_to_bin(data, text, piece,
+                output + decoded, &output_length)) {
+            return 1;
+        }
+        decoded += output_length;
+        if (decoded > expected) {
+            return MANIFEST_UNUSABLE;
+        }
+        text += piece;
+        length -= piece;
+    }
+    if (decoded != expected || data->inside_comment || data->prev_byte
+            || (data->skip_line && !last_block)) {
+        return MANIFEST_UNUSABLE;
+    }
+    return 0;
+}
+
+/* Prepare the output for decoding all of the input, as if it had just
+ * been opened with "w+b". */
+static int give_up(FILE *output_file) {
+    if (ftruncate(fileno(output_file), 0)) {
+        fprintf(stderr, "Error: Unable to truncate output: %s\n",
+            strerror(errno));
+        return 2;
+    }
+    rewind(output_file);
+    return MANIFEST_UNUSABLE;
+}
+
+int patch_from_manifest(FILE *input_file,
+        const char *input_filename,
+        FILE *output_file,
+        const char *header,
+        BOOL verbose) {
+    Manifest manifest;
+    MappedInput mapped;
+    FromHexData data;
+    struct stat info;
+    ChangedBlock *changed;
+    const char *position, *end, *block_end;
+    char *output;
+    unsigned long long block, hash;
+    size_t header_length, changed_count, i, expected;
+    int status = 0, error;
+
+    if (!read_manifest(input_filename, &manifest, verbose)) {
+        return give_up(output_file);
+    }
+    if (fstat(fileno(output_file), &info) || !S_ISREG(info.st_mode)
+            || (unsigned long long)info.st_size != manifest.size
+            || !is_file_version(output_file, &manifest.version)) {
+        if (verbose) {
+            fprintf(stderr,
+                "Output has changed since the manifest was written\n");
+        }
+        free(manifest.hashes);
+        return give_up(output_file);
+    }
+    if (!map_input(input_file, 0, &mapped)) {
+        free(manifest.hashes);
+        return give_up(output_file);
+    }
+    changed = (ChangedBlock *)malloc(
+        (size_t)manifest.block_count * sizeof(*changed) + 1);
+    output = (char *)malloc(DECODE_PIECE_SIZE / 2 + BLOCK_SIZE + 1);
+    if (!changed || !output) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        free(changed);
+        free(output);
+        unmap_input(&mapped);
+        free(manifest.hashes);
+        return 2;
+    }
+
+    /* find and check the changed blocks, without writing anything yet
+        so the output is still intact if we have to give up */
+    data = init_from_hex_data();
+    header_length = strlen(header);
+    end = mapped.data + mapped.size;
+    position = mapped.data + header_length + 1;
+    if (mapped.size <= header_length
+            || memcmp(mapped.data, header, header_length)
+            || mapped.data[header_length] != '\n') {
+        status = MANIFEST_UNUSABLE;
+    }
+    changed_count = 0;
+    for (block = 0; !status && block < manifest.block_count; ++block) {
+        block_end = next_block(position, end);
+        if (block_end == position) {
+            status = MANIFEST_UNUSABLE;
+            break;
+        }
+        hash = hash_text(position, (size_t)(block_end - position));
+        if (hash != manifest.hashes[block]) {
+            data = init_from_hex_data();
+            data.char_no = (unsigned long long)(position - mapped.data);
+            data.line_start = data.char_no;
+            data.line_no = 2 + block * BLOCK_LINES;
+            expected = block + 1 < manifest.block_count ? BLOCK_SIZE
+                : (size_t)(manifest.size - block * BLOCK_SIZE);
+            status = decode_block(&data, position,
+                (size_t)(block_end - position),
+                block + 1 == manifest.block_count, output, expected);
+            changed[changed_count].block = block;
+            changed[changed_count].text = position;
+            changed[changed_count].length
+                = (size_t)(block_end - position);
+            ++changed_count;
+            manifest.hashes[block] = hash;
+        }
+        position = block_end;
+    }
+    if (!status && position != end) {
+        status = MANIFEST_UNUSABLE;
+    }
+
+    if (status == 1) {
+        fprintf(stderr,
+            "Error: invalid format at character %llu, line %llu, "
+            "col %llu, aborting\n",
+            data.char_no, data.line_no, from_hex_column(&data));
+    } else if (status == MANIFEST_UNUSABLE) {
+        if (verbose) {
+            fprintf(stderr,
+                "Unable to patch the output, "
+                "decoding everything\n");
+        }
+        status = give_up(output_file);
+    }
+
+    for (i = 0; !status && i < changed_count; ++i) {
+        block = changed[i].block;
+        data = init_from_hex_data();
+        expected = block + 1 < manifest.block_count ? BLOCK_SIZE
+            : (size_t)(manifest.size - block * BLOCK_SIZE);
+        decode_block(&data, changed[i].text, changed[i].length,
+            block + 1 == manifest.block_count, output, expected);
+        if ((error = write_at(fileno(output_file), output, expected,
+                block * BLOCK_SIZE))) {
+            fprintf(stderr, "Error: Unable to write output: %s\n",
+                strerror(error));
+            status = 2;
+        }
+    }
+    if (!status) {
+        if (verbose) {
+            fprintf(stderr, "Patched %llu of %llu blocks\n",
+                (unsigned long long)changed_count, manifest.block_count);
+        }
+        if (changed_count
+                && get_file_version(output_file, &manifest.version)) {
+            write_manifest(&manifest, input_filename);
+        }
+    }
+
+    free(changed);
+    free(output);
+    unmap_input(&mapped);
+    free(manifest.hashes);
+    return status;
+}
+
+#endif /* _MSC_VER */
@@ -0,0 +1,49 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+/* manifests record a hash of every block of lines of a hex file, so
+decoding it back into the binary it was made from only needs to rewrite
+the blocks that were edited */
+
+#include "utils.h"
+
+#include <stdio.h>
+
+/* Returned by `patch_from_manifest` if the target can't be patched.
+Nothing has been written in that case, and the target has been
+truncated so the caller can decode the whole input into it. */
+enum { MANIFEST_UNUSABLE = -1 };
+
+/* Whether there's a manifest `hex_filename`.manifest. */
+BOOL manifest_exists(const char *hex_filename);
+
+/**
+ * Encode `input_file` like `bin_data_to_hex`, and write the manifest
+ * `output_filename`.manifest describing the output and the size,
+ * modification and change times (with nanoseconds where available) and
+ * inode of the input.
+ *
+ * `output_file`: where the header has already been written
+ * Return value: 0 on success, 1 on error */
+int encode_with_manifest(FILE *input_file,
+    FILE *output_file,
+    const char *output_filename);
+
+/**
+ * Decode the hex file `input_file` into `output_file`, which needs to
+ * still contain the binary data described by the manifest
+ * `input_filename`.manifest (this is checked with its size, times and
+ * inode). Only blocks of lines whose hash has changed are
+ * decoded and written, and they need to decode to as many bytes as
+ * before. The manifest is then updated to describe the new data.
+ *
+ * `header`: the first line of the hex file, without its newline
+ * Return value: 0 on success, 1 if the input is invalid, 2 on any other
+ *     error, or MANIFEST_UNUSABLE */
+int patch_from_manifest(FILE *input_file,
+    const char *input_filename,
+    FILE *output_file,
+    const char *header,
+    BOOL verbose);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "mapped_io.h"
+
+#include "bin_to_hex.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+
+int mapped_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        HextoggleFormat format) {
+    (void)input_file;
+    (void)output_file;
+    (void)prefix;
+    (void)prefix_length;
+    (void)format;
+    return MAPPED_IO_UNSUPPORTED;
+}
+
+int mapped_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data) {
+    (void)input_file;
+    (void)output_file;
+    (void)data;
+    return MAPPED_IO_UNSUPPORTED;
+}
+
+BOOL map_input(FILE *input_file, size_t prefix_length, MappedInput *input) {
+    (void)input_file;
+    (void)prefix_length;
+    (void)input;
+    return FALSE;
+}
+
+void unmap_input(MappedInput *input) {
+    (void)input;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* WINDOW_SIZE is the amount of input mapped at once. It is a multiple
+    of the line size of both formats, so every window starts at the
+    beginning of a line. */
+enum { WINDOW_SIZE = 1 << 26 };
+
+typedef struct {
+    void *address;
+    size_t length;
+} Mapping;
+
+/* Map `length` bytes of `fd` starting at `offset`, which doesn't need
+ * to be page-aligned. Returns a pointer to the byte at `offset`, or
+ * NULL on error. */
+static char *map_range(Mapping *mapping, int fd,
+        unsigned long long offset, size_t length, BOOL writable) {
+    unsigned long long page_size;
+    size_t misalignment;
+
+    page_size = (unsigned long long)sysconf(_SC_PAGESIZE);
+    misalignment = (size_t)(offset % page_size);
+
+    mapping->length = length + misalignment;
+    mapping->address = mmap(NULL, mapping->length,
+        writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED, fd, (off_t)(offset - misalignment));
+    if (mapping->address == MAP_FAILED) {
+        return NULL;
+    }
+    if (!writable) {
+        posix_madvise(mapping->address, mapping->length,
+            POSIX_MADV_SEQUENTIAL);
+    }
+    return (char *)mapping->address + misalignment;
+}
+
+/* Find the current position of a regular file (taking data buffered
+ * by stdio into account) and the amount of data after it. Returns
+ * FALSE if `file` isn't a regular file. */
+static BOOL file_remainder(FILE *file,
+        unsigned long long *position, unsigned long long *remainder) {
+    struct stat info;
+    off_t offset;
+
+    if (fstat(fileno(file), &info) || !S_ISREG(info.st_mode)) {
+        return FALSE;
+    }
+    offset = ftello(file);
+    if (offset < 0 || offset > info.st_size) {
+        return FALSE;
+    }
+    *position = (unsigned long long)offset;
+    *remainder = (unsigned long long)(info.st_size - offset);
+    return TRUE;
+}
+
+int mapped_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        HextoggleFormat format) {
+    unsigned long long input_offset, input_size;
+    unsigned long long output_offset, output_size, done;
+    int output_fd, error;
+    size_t length, output_length;
+    Mapping input_mapping, output_mapping;
+    char *input, *output;
+    double start;
+
+    (void)prefix; /* the mapping includes the prefix again */
+    if (!output_file
+            || !file_remainder(input_file, &input_offset, &input_size)
+            || input_offset < prefix_length
+            || fflush(output_file)
+            || !file_remainder(output_file, &output_offset, &output_size)) {
+        return MAPPED_IO_UNSUPPORTED;
+    }
+    input_offset -= prefix_length;
+    input_size += prefix_length;
+    output_size = format_hex_size(format, input_size);
+    output_fd = fileno(output_file);
+
+    if (ftruncate(output_fd, (off_t)(output_offset + output_size))) {
+        return MAPPED_IO_UNSUPPORTED;
+    }
+#ifdef __linux__
+    /* reserve the space now, since running out of space while writing
+        to a mapping raises SIGBUS */
+    if (output_size && (error = posix_fallocate(output_fd,
+            (off_t)output_offset, (off_t)output_size))) {
+        fprintf(stderr, "Error: Unable to allocate output file: %s\n",
+            strerror(error));
+        return 1;
+    }
+#endif
+
+    for (done = 0; done < input_size; done += length) {
+        length = WINDOW_SIZE;
+        if (input_size - done < WINDOW_SIZE) {
+            length = (size_t)(input_size - done);
+        }
+        input = map_range(&input_mapping, fileno(input_file),
+            input_offset + done, length, FALSE);
+        output = input ? map_range(&output_mapping, output_fd,
+            output_offset + format_hex_size(format, done),
+            (size_t)format_hex_size(format, length), TRUE) : NULL;
+        if (!output) {
+            error = errno;
+            if (input) {
+                munmap(input_mapping.address, input_mapping.length);
+            }
+            if (done == 0) {
+                /* nothing has been written yet, and the streaming path
+                    will write exactly as much as was allocated */
+                return MAPPED_IO_UNSUPPORTED;
+            }
+            fprintf(stderr, "Error: Unable to map file: %s\n",
+                strerror(error));
+            return 1;
+        }
+        start = stats_clock();
+        output_length = bin_data_to_format_hex(
+            format, input, length, done, output);
+        stats_end(StatsConvert, start, length);
+        munmap(input_mapping.address, input_mapping.length);
+        /* this is where the output is handed to the kernel */
+        start = stats_clock();
+        munmap(output_mapping.address, output_mapping.length);
+        stats_end(StatsWrite, start, output_length);
+    }
+    return 0;
+}
+
+int mapped_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data) {
+    unsigned long long input_offset, input_size, done;
+    size_t length, output_length;
+    Mapping mapping;
+    char *input, *output;
+    int status = 0;
+    double start;
+
+    if (!file_remainder(input_file, &input_offset, &input_size)) {
+        return MAPPED_IO_UNSUPPORTED;
+    }
+    output = (char *)malloc(WINDOW_SIZE / 2 + 1);
+    if (!output) {
+        return MAPPED_IO_UNSUPPORTED;
+    }
+
+    for (done = 0; !status && done < input_size; done += length) {
+        length = WINDOW_SIZE;
+        if (input_size - done < WINDOW_SIZE) {
+            length = (size_t)(input_size - done);
+        }
+        input = map_range(&mapping, fileno(input_file),
+            input_offset + done, length, FALSE);
+        if (!input && done == 0) {
+            free(output);
+            return MAPPED_IO_UNSUPPORTED;
+        } else if (!input) {
+            fprintf(stderr, "Error: Unable to map input file: %s\n",
+                strerror(errno));
+            status = 2;
+            break;
+        }
+        start = stats_clock();
+        status = hex_data_to_bin(data, input, length,
+            output, &output_length);
+        stats_end(StatsConvert, start, length);
+        munmap(mapping.address, mapping.length);
+        if (output_file && output_length) {
+            start = stats_clock();
+            fwrite(output, output_length, 1, output_file);
+            stats_end(StatsWrite, start, output_length);
+        }
+    }
+    free(output);
+    return status;
+}
+
+BOOL map_input(FILE *input_file, size_t prefix_length, MappedInput *input) {
+    unsigned long long offset, size;
+    Mapping mapping;
+
+    if (!file_remainder(input_file, &offset, &size)
+            || offset < prefix_length
+            || size + prefix_length == 0
+            || size + prefix_length > (size_t)-1) {
+        return FALSE;
+    }
+    input->size = size + prefix_length;
+    input->data = map_range(&mapping, fileno(input_file),
+        offset - prefix_length, (size_t)input->size, FALSE);
+    input->address = mapping.address;
+    input->length = mapping.length;
+    return input->data != NULL;
+}
+
+void unmap_input(MappedInput *input) {
+    munmap(input->address, input->length);
+}
+
+#endif /* _MSC_VER */
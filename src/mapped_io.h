@@ -0,0 +1,60 @@
+#ifndef MAPPED_IO_H
+#define MAPPED_IO_H
+
+/* conversions that access regular files through memory mappings
+instead of copying data through read and write buffers */
+
+#include "hex_to_bin.h"
+#include "hextoggle.h"
+
+#include <stdio.h>
+
+/* Returned by the functions below if the files can't be mapped (e.g.
+because they are pipes). Nothing has been read or written in that case,
+so the caller can fall back to streaming the data. */
+enum { MAPPED_IO_UNSUPPORTED = -1 };
+
+/**
+ * Encode `input_file` into `output_file`, which both need to be
+ * regular files. The output is extended to its final size with
+ * ftruncate and written through a shared mapping.
+ *
+ * `prefix`: the first `prefix_length` bytes of input, which were
+ *     already read from `input_file`
+ * `output_file`: where the header has already been written, or NULL
+ *     for a dry run
+ * `format`: the format of the lines after the header
+ * Return value: 0 on success, 1 on error, or MAPPED_IO_UNSUPPORTED */
+int mapped_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length,
+    HextoggleFormat format);
+
+/**
+ * Decode the rest of `input_file`, which needs to be a regular file,
+ * continuing from the decoder state in `data`.
+ *
+ * Return value: 0 on success, 1 if the input is invalid (with `data`
+ *     describing the position of the invalid character), 2 on any other
+ *     error, or MAPPED_IO_UNSUPPORTED */
+int mapped_from_hex(FILE *input_file,
+    FILE *output_file,
+    FromHexData *data);
+
+/* a read-only mapping of the rest of an input file */
+typedef struct {
+    const char *data;
+    unsigned long long size;
+    void *address; /* start of the mapping */
+    size_t length; /* length of the mapping */
+} MappedInput;
+
+/* Map the rest of `input_file`, including the `prefix_length` bytes
+before the current position that were already read. Returns FALSE if
+the file can't be mapped. */
+BOOL map_input(FILE *input_file, size_t prefix_length, MappedInput *input);
+
+void unmap_input(MappedInput *input);
+
+#endif /* MAPPED_IO_H */
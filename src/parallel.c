@@ -0,0 +1,520 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "parallel.h"
+
+#include "bin_to_hex.h"
+#include "cpu.h"
+#include "hex_to_bin.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#  include <sys/stat.h>
+#  include <sys/types.h>
+#  include <unistd.h>
+#endif
+
+/* CHUNK_SIZE is the amount of input encoded by each job. It is a
+    multiple of the line size of both formats, so every chunk starts at
+    the beginning of a line. Canonical output is the larger one. */
+enum { CHUNK_SIZE = 1 << 20 };
+#define CHUNK_OUTPUT_SIZE ((size_t)CHUNK_SIZE / 16 * 81)
+
+typedef struct {
+    /* one buffer per job slot: CHUNK_SIZE bytes of input followed by
+        CHUNK_OUTPUT_SIZE bytes of output */
+    char **buffers;
+    HextoggleFormat format;
+    size_t *input_lengths;
+    size_t *output_lengths;
+    unsigned long long first_addr; /* address of the current batch */
+
+    /* positional I/O only */
+    int input_fd;
+    int output_fd; /* -1 for a dry run */
+    unsigned long long input_offset; /* file offset of address 0 */
+    unsigned long long input_size;
+    unsigned long long output_offset; /* file offset of the first line */
+    int *errors; /* per worker: errno, or -1 if the input was short */
+} EncodeJobs;
+
+static void encode_chunk(void *context, size_t job, unsigned worker) {
+    EncodeJobs *jobs = (EncodeJobs *)context;
+    char *input = jobs->buffers[job];
+    (void)worker;
+    jobs->output_lengths[job] = bin_data_to_format_hex(
+        jobs->format,
+        input,
+        jobs->input_lengths[job],
+        jobs->first_addr + (unsigned long long)job * CHUNK_SIZE,
+        input + CHUNK_SIZE);
+}
+
+/* encode batches of up to `jobs` chunks and write them out in order */
+static int encode_ordered(EncodeJobs *jobs, ThreadPool *pool,
+        unsigned job_count, FILE *input_file, FILE *output_file,
+        const char *prefix, size_t prefix_length) {
+    size_t chunks, i, length;
+    unsigned long long batch_length;
+    BOOL eof = FALSE;
+    double start;
+
+    jobs->first_addr = 0;
+    while (!eof) {
+        batch_length = 0;
+        for (chunks = 0; chunks < job_count && !eof; ++chunks) {
+            char *input = jobs->buffers[chunks];
+            memcpy(input, prefix, prefix_length);
+            start = stats_clock();
+            length = fread(input + prefix_length, 1,
+                CHUNK_SIZE - prefix_length, input_file);
+            stats_end(StatsRead, start, length);
+            jobs->input_lengths[chunks] = prefix_length + length;
+            batch_length += jobs->input_lengths[chunks];
+            prefix_length = 0;
+            eof = jobs->input_lengths[chunks] < CHUNK_SIZE;
+        }
+        if (ferror(input_file)) {
+            fprintf(stderr, "Error: Unable to read input: %s\n",
+                strerror(errno));
+            return 1;
+        }
+        start = stats_clock();
+        thread_pool_run(pool, encode_chunk, jobs, chunks);
+        stats_end(StatsConvert, start, batch_length);
+        for (i = 0; i < chunks; ++i) {
+            if (output_file) {
+                start = stats_clock();
+                fwrite(jobs->buffers[i] + CHUNK_SIZE,
+                    jobs->output_lengths[i], 1, output_file);
+                stats_end(StatsWrite, start, jobs->output_lengths[i]);
+            }
+            jobs->first_addr += jobs->input_lengths[i];
+        }
+    }
+    return 0;
+}
+
+#ifndef _MSC_VER
+
+static int read_fully_at(int fd, char *buffer, size_t length,
+        unsigned long long offset) {
+    ssize_t result;
+    while (length) {
+        result = pread(fd, buffer, length, (off_t)offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result < 0) {
+            return errno;
+        } else if (result == 0) {
+            return -1;
+        }
+        buffer += result;
+        length -= (size_t)result;
+        offset += (unsigned long long)result;
+    }
+    return 0;
+}
+
+static int write_fully_at(int fd, const char *buffer, size_t length,
+        unsigned long long offset) {
+    ssize_t result;
+    while (length) {
+        result = pwrite(fd, buffer, length, (off_t)offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result < 0) {
+            return errno;
+        }
+        buffer += result;
+        length -= (size_t)result;
+        offset += (unsigned long long)result;
+    }
+    return 0;
+}
+
+/* read, encode and write chunk number `job` at its own offsets */
+static void encode_chunk_at(void *context, size_t job, unsigned worker) {
+    EncodeJobs *jobs = (EncodeJobs *)context;
+    char *input = jobs->buffers[worker];
+    char *output = input + CHUNK_SIZE;
+    unsigned long long addr
+        = jobs->first_addr + (unsigned long long)job * CHUNK_SIZE;
+    size_t length = CHUNK_SIZE, output_length;
+
+    if (jobs->errors[worker]) {
+        return;
+    }
+    if (jobs->input_size - addr < CHUNK_SIZE) {
+        length = (size_t)(jobs->input_size - addr);
+    }
+    jobs->errors[worker] = read_fully_at(
+        jobs->input_fd, input, length, jobs->input_offset + addr);
+    if (jobs->errors[worker]) {
+        return;
+    }
+    output_length = bin_data_to_format_hex(
+        jobs->format, input, length, addr, output);
+    if (jobs->output_fd != -1) {
+        jobs->errors[worker] = write_fully_at(jobs->output_fd,
+            output, output_length,
+            jobs->output_offset + format_hex_size(jobs->format, addr));
+    }
+}
+
+static BOOL is_regular_file(FILE *file) {
+    struct stat info;
+    return !fstat(fileno(file), &info) && S_ISREG(info.st_mode);
+}
+
+/* Set up positional I/O if both files are regular files. Returns FALSE
+ * if they aren't. */
+static BOOL prepare_positional(EncodeJobs *jobs,
+        FILE *input_file, FILE *output_file, size_t prefix_length) {
+    struct stat info;
+    off_t input_position, output_position;
+
+    if (!is_regular_file(input_file)
+            || (output_file && !is_regular_file(output_file))) {
+        return FALSE;
+    }
+    /* ftello accounts for data buffered by stdio */
+    input_position = ftello(input_file);
+    if (input_position < (off_t)prefix_length
+            || fstat(fileno(input_file), &info)
+            || info.st_size < input_position) {
+        return FALSE;
+    }
+    jobs->input_fd = fileno(input_file);
+    jobs->input_offset = (unsigned long long)input_position - prefix_length;
+    jobs->input_size = (unsigned long long)info.st_size
+        - jobs->input_offset;
+
+    jobs->output_fd = -1;
+    if (output_file) {
+        if (fflush(output_file)
+                || (output_position = ftello(output_file)) < 0) {
+            return FALSE;
+        }
+        jobs->output_fd = fileno(output_file);
+        jobs->output_offset = (unsigned long long)output_position;
+        /* preallocate the file, since its final size is known */
+        if (ftruncate(jobs->output_fd, (off_t)(jobs->output_offset
+                + format_hex_size(jobs->format, jobs->input_size)))) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* While recording statistics, the chunks are run in batches of this
+    many per thread, so progress can be reported in between. */
+enum { STATS_BATCH_CHUNKS = 16 };
+
+static int encode_positional(EncodeJobs *jobs, ThreadPool *pool,
+        unsigned job_count) {
+    unsigned i;
+    unsigned long long batch = jobs->input_size, length;
+    double start;
+
+    if (stats.enabled) {
+        batch = (unsigned long long)job_count * STATS_BATCH_CHUNKS
+            * CHUNK_SIZE;
+    }
+    for (jobs->first_addr = 0; jobs->first_addr < jobs->input_size;
+            jobs->first_addr += length) {
+        length = jobs->input_size - jobs->first_addr;
+        if (length > batch) {
+            length = batch;
+        }
+        /* the workers read and write their chunks themselves */
+        start = stats_clock();
+        thread_pool_run(pool, encode_chunk_at, jobs,
+            (size_t)((length + CHUNK_SIZE - 1) / CHUNK_SIZE));
+        stats_end(StatsConvert, start, length);
+        if (jobs->output_fd != -1) {
+            stats_count(StatsWrite,
+                format_hex_size(jobs->format, length));
+        }
+    }
+    for (i = 0; i < job_count; ++i) {
+        if (jobs->errors[i] == -1) {
+            fprintf(stderr, "Error: Input file changed size\n");
+            return 1;
+        } else if (jobs->errors[i]) {
+            fprintf(stderr, "Error: Unable to convert file: %s\n",
+                strerror(jobs->errors[i]));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif /* _MSC_VER */
+
+int parallel_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length,
+        HextoggleFormat format,
+        unsigned jobs) {
+    EncodeJobs state;
+    ThreadPool *pool;
+    unsigned i;
+    BOOL allocated;
+    int result = 1;
+
+    memset(&state, 0, sizeof(state));
+    state.format = format;
+    state.buffers = (char **)calloc(jobs, sizeof(char *));
+    state.input_lengths = (size_t *)calloc(jobs, sizeof(size_t));
+    state.output_lengths = (size_t *)calloc(jobs, sizeof(size_t));
+    state.errors = (int *)calloc(jobs, sizeof(int));
+    allocated = state.buffers && state.input_lengths
+        && state.output_lengths && state.errors;
+    for (i = 0; allocated && i < jobs; ++i) {
+        state.buffers[i] = (char *)malloc(CHUNK_SIZE + CHUNK_OUTPUT_SIZE);
+        allocated = state.buffers[i] != NULL;
+    }
+    if (!allocated) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        goto cleanup;
+    }
+
+    /* detect the SIMD kernels before any worker threads use them */
+    cpu_features();
+    pool = thread_pool_create(jobs);
+    if (!pool) {
+        goto cleanup;
+    }
+#ifndef _MSC_VER
+    if (prepare_positional(&state, input_file, output_file,
+            prefix_length)) {
+        result = encode_positional(&state, pool, jobs);
+    } else
+#endif
+    {
+        result = encode_ordered(&state, pool, jobs,
+            input_file, output_file, prefix, prefix_length);
+    }
+    thread_pool_destroy(pool);
+
+cleanup:
+    if (state.buffers) {
+        for (i = 0; i < jobs; ++i) {
+            free(state.buffers[i]);
+        }
+    }
+    free(state.buffers);
+    free(state.input_lengths);
+    free(state.output_lengths);
+    free(state.errors);
+    return result;
+}
+
+/* DECODE_CHUNK_SIZE is the amount of hex data decoded by each job.
+    Chunks end after a newline wherever possible. */
+enum { DECODE_CHUNK_SIZE = 1 << 22 };
+
+typedef struct {
+    const char *input;
+    char *output;
+    size_t *starts; /* chunk boundaries, `chunk_count + 1` entries */
+    unsigned long long batch_offset; /* position of `input` in the file */
+
+    /* per chunk, the results of decoding it from the start of a line */
+    FromHexData *results;
+    size_t *output_lengths;
+    int *statuses;
+} DecodeJobs;
+
+/* Each chunk gets its own part of the output buffer: a chunk starting
+ * at `start` can't decode to more than `start / 2 + chunk` bytes. */
+static char *chunk_output(DecodeJobs *jobs, size_t chunk) {
+    return jobs->output + jobs->starts[chunk] / 2 + chunk;
+}
+
+/* Decoder state at the start of a line outside of any comment. This is
+ * the state every chunk is speculatively decoded from. */
+static BOOL is_clean_line_start(const FromHexData *data) {
+    return !data->prev_byte && !data->skip_line && !data->inside_comment
+        && data->line_start == data->char_no;
+}
+
+static void decode_chunk(void *context, size_t job, unsigned worker) {
+    DecodeJobs *jobs = (DecodeJobs *)context;
+    FromHexData *data = &jobs->results[job];
+    (void)worker;
+    *data = init_from_hex_data();
+    data->char_no = jobs->batch_offset + jobs->starts[job];
+    data->line_start = data->char_no;
+    jobs->statuses[job] = hex_data_to_bin(data,
+        jobs->input + jobs->starts[job],
+        jobs->starts[job + 1] - jobs->starts[job],
+        chunk_output(jobs, job),
+        &jobs->output_lengths[job]);
+}
+
+/* Split `length` bytes of input into chunks, returning their number. */
+static size_t split_chunks(const char *input, size_t length,
+        size_t *starts) {
+    size_t count = 0, start = 0, end;
+    while (start < length) {
+        starts[count++] = start;
+        if (length - start <= DECODE_CHUNK_SIZE) {
+            break;
+        }
+        /* end after the last newline in the chunk, unless that would
+            make it much shorter than DECODE_CHUNK_SIZE */
+        end = start + DECODE_CHUNK_SIZE;
+        while (end > start + DECODE_CHUNK_SIZE / 2 && input[end - 1] != '\n') {
+            --end;
+        }
+        if (input[end - 1] != '\n') {
+            end = start + DECODE_CHUNK_SIZE;
+        }
+        start = end;
+    }
+    starts[count] = length;
+    return count;
+}
+
+/* Write out the chunks of a batch in order, continuing from `data`.
+ * A chunk's speculative result is only used if the real state at its
+ * start matches the state it was decoded from; otherwise it is decoded
+ * again from the real state. */
+static int stitch_chunks(DecodeJobs *jobs, size_t chunk_count,
+        FromHexData *data, FILE *output_file) {
+    size_t i, output_length;
+    unsigned long long line_no;
+    int status;
+    double start;
+
+    for (i = 0; i < chunk_count; ++i) {
+        if (is_clean_line_start(data)) {
+            /* positions in the result are relative to line 1 */
+            line_no = data->line_no + jobs->results[i].line_no - 1;
+            *data = jobs->results[i];
+            data->line_no = line_no;
+            output_length = jobs->output_lengths[i];
+            status = jobs->statuses[i];
+        } else {
+            start = stats_clock();
+            status = hex_data_to_bin(data,
+                jobs->input + jobs->starts[i],
+                jobs->starts[i + 1] - jobs->starts[i],
+                chunk_output(jobs, i),
+                &output_length);
+            /* the input was counted when it was first decoded */
+            stats_end(StatsConvert, start, 0);
+        }
+        if (output_file && output_length) {
+            start = stats_clock();
+            fwrite(chunk_output(jobs, i), output_length, 1, output_file);
+            stats_end(StatsWrite, start, output_length);
+        }
+        if (status) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int decode_batches(DecodeJobs *jobs, ThreadPool *pool,
+        char *input, size_t capacity,
+        FILE *input_file, FILE *output_file, FromHexData *data) {
+    size_t length = 0, end, chunk_count, read_length;
+    BOOL eof = FALSE;
+    double start;
+
+    jobs->batch_offset = data->char_no;
+    while (!eof) {
+        start = stats_clock();
+        read_length = fread(input + length, 1, capacity - length,
+            input_file);
+        stats_end(StatsRead, start, read_length);
+        length += read_length;
+        if (ferror(input_file)) {
+            fprintf(stderr, "Error: Unable to read input: %s\n",
+                strerror(errno));
+            return 2;
+        }
+        eof = length < capacity;
+
+        /* keep an incomplete last line for the next batch */
+        end = length;
+        if (!eof) {
+            while (end > 0 && input[end - 1] != '\n') {
+                --end;
+            }
+            if (end == 0) {
+                end = length;
+            }
+        }
+
+        chunk_count = split_chunks(input, end, jobs->starts);
+        start = stats_clock();
+        thread_pool_run(pool, decode_chunk, jobs, chunk_count);
+        stats_end(StatsConvert, start, end);
+        if (stitch_chunks(jobs, chunk_count, data, output_file)) {
+            return 1;
+        }
+
+        memmove(input, input + end, length - end);
+        length -= end;
+        jobs->batch_offset += end;
+    }
+    return 0;
+}
+
+int parallel_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data,
+        unsigned jobs) {
+    DecodeJobs state;
+    ThreadPool *pool;
+    char *input;
+    size_t capacity = (size_t)jobs * DECODE_CHUNK_SIZE;
+    /* every chunk is at least half of DECODE_CHUNK_SIZE long */
+    size_t max_chunks = 2 * (size_t)jobs + 1;
+    int result = 2;
+
+    memset(&state, 0, sizeof(state));
+    input = (char *)malloc(capacity);
+    state.output = (char *)malloc(capacity / 2 + max_chunks);
+    state.starts = (size_t *)calloc(max_chunks + 1, sizeof(size_t));
+    state.results = (FromHexData *)calloc(max_chunks, sizeof(FromHexData));
+    state.output_lengths = (size_t *)calloc(max_chunks, sizeof(size_t));
+    state.statuses = (int *)calloc(max_chunks, sizeof(int));
+    state.input = input;
+    if (!input || !state.output || !state.starts || !state.results
+            || !state.output_lengths || !state.statuses) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        goto cleanup;
+    }
+
+    /* detect the SIMD kernels before any worker threads use them */
+    cpu_features();
+    pool = thread_pool_create(jobs);
+    if (!pool) {
+        goto cleanup;
+    }
+    result = decode_batches(&state, pool, input, capacity,
+        input_file, output_file, data);
+    thread_pool_destroy(pool);
+
+cleanup:
+    free(input);
+    free(state.output);
+    free(state.starts);
+    free(state.results);
+    free(state.output_lengths);
+    free(state.statuses);
+    return result;
+}
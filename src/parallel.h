@@ -0,0 +1,51 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* multi-threaded conversions */
+
+#include "hex_to_bin.h"
+#include "hextoggle.h"
+
+#include <stdio.h>
+
+/**
+ * Encode all of `input_file` on `jobs` threads.
+ *
+ * `prefix`: the first `prefix_length` bytes of input, which were
+ *     already read from `input_file`
+ * `output_file`: where the header has already been written, or NULL
+ *     for a dry run
+ * `format`: the format of the lines after the header
+ * Return value: 0 on success, 1 on error
+ *
+ * The input is split into chunks that are encoded independently. When
+ * both files are regular files, each job reads and writes its chunk
+ * with pread/pwrite at offsets computed from the chunk's address.
+ * Otherwise chunks are read in batches and written out in order. */
+int parallel_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length,
+    HextoggleFormat format,
+    unsigned jobs);
+
+/**
+ * Decode the rest of `input_file` on `jobs` threads, continuing from
+ * the decoder state in `data`.
+ *
+ * Return value: 0 on success, 1 if the input is invalid (with `data`
+ *     describing the position of the invalid character, exactly as
+ *     `hex_data_to_bin` would), or 2 on any other error
+ *
+ * The input is read in batches that are split into chunks, preferably
+ * after a newline. Every chunk is decoded on a worker thread as if it
+ * started a line outside of any comment, which is the only possible
+ * state after a newline unless a comment spans several lines. The
+ * chunks are then written out in order, and any chunk whose real
+ * starting state turns out to be different is decoded again. */
+int parallel_from_hex(FILE *input_file,
+    FILE *output_file,
+    FromHexData *data,
+    unsigned jobs);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "pipe_io.h"
+
+#include "bin_to_hex.h"
+#include "mapped_io.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __linux__
+
+int pipe_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    (void)input_file;
+    (void)output_file;
+    (void)prefix;
+    (void)prefix_length;
+    return PIPE_IO_UNSUPPORTED;
+}
+
+int pipe_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data) {
+    (void)input_file;
+    (void)output_file;
+    (void)data;
+    return PIPE_IO_UNSUPPORTED;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* PIPE_CAPACITY is the pipe size we ask for. Unprivileged processes can
+    raise it up to /proc/sys/fs/pipe-max-size (1 MiB by default). */
+enum { PIPE_CAPACITY = 1 << 20 };
+
+/* vmsplice passes references to our pages to the pipe, so a buffer
+    can only be reused after the reader has consumed it. With buffers of
+    half the pipe capacity, that is usually the case by the time the
+    third buffer has been spliced. A reader that splices or tees the
+    pages onward still holds them after that, which is why this is only
+    used when asked for (see pipe_io.h). */
+enum { SPLICE_BUFFERS = 3 };
+
+typedef struct {
+    int fd;
+    size_t buffer_size;
+    /* page-aligned buffers, followed by one more that is written with
+        write(2) if the next buffer is still in the pipe */
+    char *buffers;
+    unsigned long long ends[SPLICE_BUFFERS]; /* see `written` */
+    unsigned long long written; /* total bytes passed to the pipe */
+    unsigned next;
+    unsigned current;
+} PipeWriter;
+
+static BOOL pipe_writer_open(PipeWriter *writer, FILE *output_file) {
+    struct stat info;
+    int capacity;
+    void *buffers;
+
+    if (!output_file || !getenv("HEXTOGGLE_SPLICE")) {
+        return FALSE;
+    }
+    writer->fd = fileno(output_file);
+    if (fstat(writer->fd, &info) || !S_ISFIFO(info.st_mode)
+            || fflush(output_file)) {
+        return FALSE;
+    }
+    /* this fails if the capacity is above the limit, in which case we
+        use the current size */
+    fcntl(writer->fd, F_SETPIPE_SZ, PIPE_CAPACITY);
+    capacity = fcntl(writer->fd, F_GETPIPE_SZ);
+    if (capacity < 2 * 81) {
+        return FALSE;
+    }
+    writer->buffer_size = (size_t)capacity / 2;
+    buffers = mmap(NULL, (SPLICE_BUFFERS + 1) * writer->buffer_size,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        return FALSE;
+    }
+    writer->buffers = (char *)buffers;
+    memset(writer->ends, 0, sizeof(writer->ends));
+    writer->written = 0;
+    writer->next = 0;
+    writer->current = 0;
+    return TRUE;
+}
+
+static void pipe_writer_close(PipeWriter *writer) {
+    munmap(writer->buffers, (SPLICE_BUFFERS + 1) * writer->buffer_size);
+}
+
+/* Get the buffer to fill next, with `buffer_size` bytes of space. */
+static char *pipe_writer_buffer(PipeWriter *writer) {
+    int unread = 0;
+    /* FIONREAD reports the amount of data still in the pipe */
+    if (writer->ends[writer->next]
+            && (ioctl(writer->fd, FIONREAD, &unread)
+                || writer->written - (unsigned)unread
+                    < writer->ends[writer->next])) {
+        writer->current = SPLICE_BUFFERS;
+    } else {
+        writer->current = writer->next;
+    }
+    return writer->buffers + writer->current * writer->buffer_size;
+}
+
+/* Pass the first `length` bytes of the current buffer to the pipe.
+ * Returns 0 on success or an errno value. */
+static int pipe_writer_commit(PipeWriter *writer, size_t length) {
+    struct iovec iov;
+    ssize_t result;
+    BOOL splice = writer->current < SPLICE_BUFFERS;
+    double start = stats_clock();
+
+    iov.iov_base = writer->buffers + writer->current * writer->buffer_size;
+    iov.iov_len = length;
+    while (iov.iov_len) {
+        result = splice
+            ? vmsplice(writer->fd, &iov, 1, 0)
+            : write(writer->fd, iov.iov_base, iov.iov_len);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result < 0) {
+            return errno;
+        }
+        iov.iov_base = (char *)iov.iov_base + result;
+        iov.iov_len -= (size_t)result;
+    }
+    stats_end(StatsWrite, start, length);
+    writer->written += length;
+    if (splice) {
+        writer->ends[writer->current] = writer->written;
+        writer->next = (writer->next + 1) % SPLICE_BUFFERS;
+    }
+    return 0;
+}
+
+static int report_write_error(int error) {
+    fprintf(stderr, "Error: Unable to write output: %s\n",
+        strerror(error));
+    return 1;
+}
+
+int pipe_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    PipeWriter writer;
+    MappedInput mapped;
+    unsigned long long done;
+    size_t batch, length, output_length;
+    char *input, *output;
+    int error = 0;
+    double start;
+
+    if (!pipe_writer_open(&writer, output_file)) {
+        return PIPE_IO_UNSUPPORTED;
+    }
+    /* as many complete lines as fit into one buffer */
+    batch = writer.buffer_size / 81 * 16;
+    if (batch < prefix_length) {
+        pipe_writer_close(&writer);
+        return PIPE_IO_UNSUPPORTED;
+    }
+
+    if (map_input(input_file, prefix_length, &mapped)) {
+        for (done = 0; !error && done < mapped.size; done += length) {
+            length = batch;
+            if (mapped.size - done < batch) {
+                length = (size_t)(mapped.size - done);
+            }
+            output = pipe_writer_buffer(&writer);
+            start = stats_clock();
+            output_length = bin_data_to_hex(
+                mapped.data + done, length, done, output);
+            stats_end(StatsConvert, start, length);
+            error = pipe_writer_commit(&writer, output_length);
+        }
+        unmap_input(&mapped);
+    } else {
+        input = (char *)malloc(batch);
+        if (!input) {
+            pipe_writer_close(&writer);
+            return PIPE_IO_UNSUPPORTED;
+        }
+        memcpy(input, prefix, prefix_length);
+        length = prefix_length;
+        for (done = 0; !error;) {
+            start = stats_clock();
+            output_length = fread(input + length, 1, batch - length,
+                input_file);
+            stats_end(StatsRead, start, output_length);
+            length += output_length;
+            output = pipe_writer_buffer(&writer);
+            start = stats_clock();
+            output_length = bin_data_to_hex(input, length, done, output);
+            stats_end(StatsConvert, start, length);
+            error = pipe_writer_commit(&writer, output_length);
+            if (length < batch) {
+                break;
+            }
+            done += length;
+            length = 0;
+        }
+        free(input);
+    }
+    pipe_writer_close(&writer);
+    return error ? report_write_error(error) : 0;
+}
+
+int pipe_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data) {
+    PipeWriter writer;
+    MappedInput mapped;
+    unsigned long long done;
+    size_t batch, length, output_length;
+    char *input, *output;
+    int error = 0, status = 0;
+    double start;
+
+    if (!pipe_writer_open(&writer, output_file)) {
+        return PIPE_IO_UNSUPPORTED;
+    }
+    /* the most input that is guaranteed to fit into one buffer */
+    batch = 2 * writer.buffer_size - 1;
+
+    if (map_input(input_file, 0, &mapped)) {
+        for (done = 0; !error && !status && done < mapped.size;
+                done += length) {
+            length = batch;
+            if (mapped.size - done < batch) {
+                length = (size_t)(mapped.size - done);
+            }
+            output = pipe_writer_buffer(&writer);
+            start = stats_clock();
+            status = hex_data_to_bin(data, mapped.data + done, length,
+                output, &output_length);
+            stats_end(StatsConvert, start, length);
+            error = pipe_writer_commit(&writer, output_length);
+        }
+        unmap_input(&mapped);
+    } else {
+        input = (char *)malloc(batch);
+        if (!input) {
+            pipe_writer_close(&writer);
+            return PIPE_IO_UNSUPPORTED;
+        }
+        while (!error && !status) {
+            start = stats_clock();
+            length = fread(input, 1, batch, input_file);
+            stats_end(StatsRead, start, length);
+            if (!length) {
+                break;
+            }
+            output = pipe_writer_buffer(&writer);
+            start = stats_clock();
+            status = hex_data_to_bin(data, input, length,
+                output, &output_length);
+            stats_end(StatsConvert, start, length);
+            error = pipe_writer_commit(&writer, output_length);
+        }
+        free(input);
+    }
+    pipe_writer_close(&writer);
+    if (error) {
+        report_write_error(error);
+        return 2;
+    }
+    return status;
+}
+
+#endif /* __linux__ */
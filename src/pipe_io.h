@@ -0,0 +1,41 @@
+#ifndef PIPE_IO_H
+#define PIPE_IO_H
+
+/* conversions that hand their output to a pipe with vmsplice (Linux),
+when HEXTOGGLE_SPLICE is set. The buffers are reused once the pipe has
+been drained, so the reader needs to copy the data out of the pipe (as
+read(2) does). A reader that moves the pages on with splice or tee would
+see them overwritten later. */
+
+#include "hex_to_bin.h"
+
+#include <stdio.h>
+
+/* Returned by the functions below if the output isn't a pipe (or
+zero-copy output is unavailable or wasn't asked for). Nothing has been
+read or written in that case. */
+enum { PIPE_IO_UNSUPPORTED = -1 };
+
+/**
+ * Encode `input_file` into the pipe `output_file`, whose header has
+ * already been written. `prefix` contains the first `prefix_length`
+ * bytes of input, which were already read.
+ *
+ * Return value: 0 on success, 1 on error, or PIPE_IO_UNSUPPORTED */
+int pipe_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length);
+
+/**
+ * Decode the rest of `input_file` into the pipe `output_file`,
+ * continuing from the decoder state in `data`.
+ *
+ * Return value: 0 on success, 1 if the input is invalid (with `data`
+ *     describing the position of the invalid character), 2 on any other
+ *     error, or PIPE_IO_UNSUPPORTED */
+int pipe_from_hex(FILE *input_file,
+    FILE *output_file,
+    FromHexData *data);
+
+#endif /* PIPE_IO_H */
@@ -0,0 +1,819 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "range.h"
+
+#include "bin_to_hex.h"
+#include "file_version.h"
+#include "hex_to_bin.h"
+#include "hextoggle.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#  include <unistd.h>
+#endif
+
+/* the header line of canonical output */
+enum { HEADER_SIZE = HEXTOGGLE_HEADER_LENGTH + 1 };
+
+/* bytes of decoded output before its first hole that are decoded again
+    when resuming, since the pages around the hole can be partly written
+    (encoded output is checked line by line instead) */
+enum { HOLE_MARGIN = 1 << 20 };
+
+/* every INDEX_INTERVAL-th line is recorded in a line index */
+enum { INDEX_INTERVAL = 4096 };
+
+enum { READ_BUFFER_SIZE = 1 << 16 };
+enum { INDEX_BUFFER_SIZE = 1 << 20 };
+
+static const char *index_header = "| hextoggle line index";
+
+/* a line to start decoding at */
+typedef struct {
+    unsigned long long offset; /* in the hex file */
+    unsigned long long address; /* of the first byte decoded from it */
+    unsigned long long line_no; /* starting at 1, or 0 if unknown */
+} Location;
+
+/* where the decoded bytes of a range go */
+typedef struct {
+    FILE *file; /* or NULL */
+    char *buffer; /* or NULL, moved past the bytes copied to it */
+} RangeOutput;
+
+/* The size of the start of the output in `file` of `size` bytes that
+ * has no holes. The backends that size their output in advance leave a
+ * hole where they stopped, unless they also allocated it (see
+ * mapped_io.c), in which case the rest reads as zeros. */
+static unsigned long long written_size(FILE *file,
+        unsigned long long size) {
+#ifdef SEEK_HOLE
+    off_t hole = lseek(fileno(file), 0, SEEK_HOLE);
+    if (hole >= 0 && (unsigned long long)hole < size) {
+        return (unsigned long long)hole;
+    }
+#else
+    (void)file;
+#endif
+    return size;
+}
+
+static size_t read_at(FILE *file, unsigned long long offset,
+        char *buffer, size_t length) {
+    if (!seek_to(file, offset)) {
+        return 0;
+    }
+    return fread(buffer, 1, length, file);
+}
+
+/* Parse an address column as written by `format_address`. */
+static BOOL parse_address(const char *line, size_t length,
+        unsigned long long *address) {
+    unsigned long long value = 0;
+    int i;
+
+    if (length < ADDRESS_LENGTH || line[0] != '[' || line[11] != ' '
+            || line[23] != ']') {
+        return FALSE;
+    }
+    for (i = 1; i <= 10; ++i) {
+        if (!isxdigit((unsigned char)line[i])) {
+            return FALSE;
+        }
+        value = value * 16 + (unsigned)hex_char_to_int(line[i]);
+    }
+    for (i = 12; i <= 22; ++i) {
+        if (!isdigit((unsigned char)line[i])) {
+            return FALSE;
+        }
+    }
+    *address = value;
+    return TRUE;
+}
+
+/* Find the first line that starts at or after `offset` (after the
+ * previous newline) and has an address column. */
+static BOOL next_address_line(FILE *file, unsigned long long offset,
+        unsigned long long size, Location *line) {
+    char buffer[4096];
+    unsigned long long position = offset ? offset - 1 : 0;
+    BOOL at_line_start = offset == 0;
+    size_t length;
+    char *newline;
+
+    while (position < size) {
+        length = read_at(file, position, buffer, sizeof(buffer));
+        if (!length) {
+            return FALSE;
+        }
+        if (at_line_start) {
+            if (parse_address(buffer, length, &line->address)) {
+                line->offset = position;
+                line->line_no = 0;
+                return TRUE;
+            }
+            at_line_start = FALSE;
+        }
+        newline = (char *)memchr(buffer, '\n', length);
+        if (newline) {
+            position += (size_t)(newline - buffer) + 1;
+            at_line_start = TRUE;
+        } else {
+            position += length;
+        }
+    }
+    return FALSE;
+}
+
+/* Find the line containing `start` from the line index of
+ * `input_file`. Returns FALSE if there is no up-to-date index, i.e.
+ * one written for this size and version of the file. Otherwise `line`
+ * is left unchanged if `start` comes before the first entry, since the
+ * addresses in the file can't be trusted if it has an index. */
+static BOOL find_in_index(FILE *input_file, const char *input_filename,
+        unsigned long long size, unsigned long long start,
+        Location *line, BOOL verbose) {
+    char header[32], sizes[128];
+    char *index_filename;
+    FILE *index;
+    unsigned long long indexed_size;
+    FileVersion version;
+    Location entry;
+    BOOL usable = FALSE;
+
+    if (!input_filename) {
+        return FALSE;
+    }
+    index_filename = (char *)malloc(strlen(input_filename) + 5);
+    if (!index_filename) {
+        return FALSE;
+    }
+    sprintf(index_filename, "%s.idx", input_filename);
+    index = fopen(index_filename, "rb");
+    if (!index) {
+        free(index_filename);
+        return FALSE;
+    }
+    if (!fgets(header, sizeof(header), index)
+            || strncmp(header, index_header, strlen(index_header))
+            || !fgets(sizes, sizeof(sizes), index)
+            || sscanf(sizes, "%llu " FILE_VERSION_FORMAT, &indexed_size,
+                &version.mtime, &version.mtime_nsec, &version.ctime,
+                &version.ctime_nsec, &version.inode) != 6) {
+        fprintf(stderr, "Ignoring invalid line index `%s`\n",
+            index_filename);
+    } else if (indexed_size != size
+            || !is_file_version(input_file, &version)) {
+        fprintf(stderr, "Ignoring out-of-date line index `%s`\n",
+            index_filename);
+    } else {
+        /* entries are sorted by address */
+        while (fscanf(index, "%llu %llu %llu", &entry.address,
+                    &entry.offset, &entry.line_no) == 3
+                && entry.address <= start) {
+            *line = entry;
+        }
+        usable = TRUE;
+        if (verbose) {
+            fprintf(stderr, "Using line index `%s`\n", index_filename);
+        }
+    }
+    fclose(index);
+    free(index_filename);
+    return usable;
+}
+
+/* Compute where `start` would be in a canonical file, and check that
+ * there's a line with the right address. */
+static BOOL find_canonical(FILE *file, const Location *first,
+        unsigned long long size, unsigned long long start,
+        Location *line) {
+    char buffer[ADDRESS_LENGTH + 1];
+    unsigned long long line_count, address;
+    Location candidate;
+
+    line_count = (start - first->address) / 16;
+    candidate.offset = first->offset + line_count * LINE_LENGTH;
+    candidate.address = first->address + line_count * 16;
+    candidate.line_no = first->line_no ? first->line_no + line_count : 0;
+    if (candidate.offset >= size || candidate.offset == 0
+            || read_at(file, candidate.offset - 1, buffer, sizeof(buffer))
+                != sizeof(buffer)) {
+        if (line_count) {
+            return FALSE;
+        }
+    } else if (buffer[0] != '\n'
+            || !parse_address(buffer + 1, ADDRESS_LENGTH, &address)
+            || address != (candidate.address & ADDRESS_MASK)) {
+        return FALSE;
+    }
+    *line = candidate;
+    return TRUE;
+}
+
+/* Compute where `start` would be in a plain file, which has no address
+ * column to check, so only its header and the newline before the line
+ * are checked. */
+static BOOL find_plain(FILE *file, unsigned long long size,
+        unsigned long long start, Location *line) {
+    char buffer[HEXTOGGLE_PLAIN_HEADER_LENGTH + 1];
+    unsigned long long line_count = start / PLAIN_LINE_BYTES;
+    Location candidate;
+
+    candidate.offset = sizeof(buffer) + line_count * PLAIN_LINE_LENGTH;
+    candidate.address = line_count * PLAIN_LINE_BYTES;
+    candidate.line_no = 2 + line_count;
+    if (candidate.offset >= size
+            || read_at(file, 0, buffer, sizeof(buffer)) != sizeof(buffer)
+            || memcmp(buffer, HEXTOGGLE_PLAIN_HEADER "\n", sizeof(buffer))
+            || read_at(file, candidate.offset - 1, buffer, 1) != 1
+            || buffer[0] != '\n') {
+        return FALSE;
+    }
+    *line = candidate;
+    return TRUE;
+}
+
+/* Binary search for the last line with an address up to `start`. */
+static BOOL find_by_address(FILE *file, const Location *first,
+        unsigned long long size, unsigned long long start,
+        Location *line) {
+    unsigned long long low = first->offset, high = size, middle;
+    Location candidate;
+    BOOL found = FALSE;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (next_address_line(file, middle, size, &candidate)
+                && candidate.address <= start) {
+            *line = candidate;
+            found = TRUE;
+            low = candidate.offset + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return found;
+}
+
+/* Find the first address line, which determines the address of the
+ * first decoded byte. Without one, the data starts at address 0. */
+static void find_first_line(FILE *file, unsigned long long size,
+        Location *first) {
+    char buffer[4096];
+    size_t i;
+
+    if (!next_address_line(file, 0, size, first)) {
+        first->offset = 0;
+        first->address = 0;
+    }
+    /* count the lines before it (usually just the header) */
+    first->line_no = 0;
+    if (first->offset <= sizeof(buffer) && read_at(file, 0, buffer,
+            (size_t)first->offset) == first->offset) {
+        first->line_no = 1;
+        for (i = 0; i < first->offset; ++i) {
+            first->line_no += buffer[i] == '\n';
+        }
+    }
+}
+
+/* Whether `file` starts with the header of elided output, which can
+ * contain `* N` lines. */
+static BOOL is_elided(FILE *file) {
+    char buffer[HEXTOGGLE_ELIDED_HEADER_LENGTH];
+    return read_at(file, 0, buffer, sizeof(buffer)) == sizeof(buffer)
+        && !memcmp(buffer, HEXTOGGLE_ELIDED_HEADER, sizeof(buffer));
+}
+
+/* Write the part of `output` that is in the range, which starts after
+ * `*skip` more bytes and has `*length` bytes left. */
+static void write_in_range(RangeOutput *range_output,
+        const char *output, size_t output_length,
+        unsigned long long *skip, unsigned long long *length) {
+    if (*skip >= output_length) {
+        *skip -= output_length;
+        return;
+    }
+    output += *skip;
+    output_length -= (size_t)*skip;
+    *skip = 0;
+    if (output_length > *length) {
+        output_length = (size_t)*length;
+    }
+    if (range_output->file && output_length) {
+        fwrite(output, output_length, 1, range_output->file);
+    }
+    if (range_output->buffer) {
+        memcpy(range_output->buffer, output, output_length);
+        range_output->buffer += output_length;
+    }
+    *length -= output_length;
+}
+
+/* Decode `input_length` bytes of `input` with `output` as a scratch
+ * buffer, and add the number of bytes they stand for (including any
+ * `* N` lines) to `*address`. */
+static int count_decoded_bytes(FromHexData *data,
+        const char *input, size_t input_length,
+        char *output, unsigned long long *address) {
+    unsigned long long before;
+    size_t output_length;
+    int status;
+
+    for (;;) {
+        before = data->char_no;
+        status = hex_data_to_bin(data, input, input_length,
+            output, &output_length);
+        *address += output_length;
+        if (status != HEX_TO_BIN_REPEAT) {
+            return status;
+        }
+        *address += data->repeat * 16;
+        data->repeat = 0;
+        input += data->char_no - before;
+        input_length -= (size_t)(data->char_no - before);
+    }
+}
+
+static void report_invalid(const FromHexData *data) {
+    if (data->line_no) {
+        fprintf(stderr,
+            "Error: invalid format at character %llu, line %llu, "
+            "col %llu, aborting\n",
+            data->char_no, data->line_no, from_hex_column(data));
+    } else {
+        fprintf(stderr,
+            "Error: invalid format at character %llu, aborting\n",
+            data->char_no);
+    }
+}
+
+/* Decode a range as described by `decode_range`, to `range_output`. */
+static int decode_range_to(FILE *input_file,
+        const char *input_filename,
+        RangeOutput *range_output,
+        unsigned long long start,
+        unsigned long long length,
+        BOOL verbose) {
+    char input[READ_BUFFER_SIZE];
+    char output[READ_BUFFER_SIZE / 2 + 1];
+    unsigned long long size, skip, wanted, before, lines;
+    size_t input_length, output_length;
+    Location first, line;
+    FromHexData data = init_from_hex_data();
+    const char *position;
+    int status;
+
+    if (!get_file_size(input_file, &size)) {
+        fprintf(stderr, "Error: Unable to seek in input: %s\n",
+            strerror(errno));
+        return 2;
+    }
+    find_first_line(input_file, size, &first);
+
+    line.offset = 0;
+    line.address = first.address;
+    line.line_no = 1;
+    if (start < first.address) {
+        /* the range starts before the data */
+        length = start + length > first.address
+            ? start + length - first.address : 0;
+        start = first.address;
+    }
+    if (find_in_index(input_file, input_filename, size, start, &line,
+            verbose)) {
+        /* line found, or at the start of the file */
+    } else if (find_canonical(input_file, &first, size, start, &line)) {
+        if (verbose) {
+            fprintf(stderr, "Seeking to canonical line\n");
+        }
+    } else if (first.address == 0
+            && find_plain(input_file, size, start, &line)) {
+        if (verbose) {
+            fprintf(stderr, "Seeking to plain line\n");
+        }
+    } else if (find_by_address(input_file, &first, size, start, &line)) {
+        if (verbose) {
+            fprintf(stderr, "Seeking by address column\n");
+        }
+    }
+    if (verbose) {
+        fprintf(stderr, "Decoding from character %llu (address %llu)\n",
+            line.offset, line.address);
+    }
+
+    /* lines with an address column start outside of any comment, and
+        are followed by any `* N` lines repeating them */
+    data.allow_repeat = is_elided(input_file);
+    data.char_no = line.offset;
+    data.line_start = line.offset;
+    data.line_no = line.line_no;
+    if (!seek_to(input_file, line.offset)) {
+        fprintf(stderr, "Error: Unable to seek in input: %s\n",
+            strerror(errno));
+        return 2;
+    }
+
+    skip = start - line.address;
+    status = 0;
+    while (length && !status) {
+        /* read about as many lines as are needed in a canonical file */
+        wanted = (skip + length) / 16 * LINE_LENGTH + 2 * LINE_LENGTH;
+        input_length = fread(input, 1,
+            wanted < READ_BUFFER_SIZE ? (size_t)wanted : READ_BUFFER_SIZE,
+            input_file);
+        if (!input_length) {
+            break;
+        }
+        position = input;
+        do {
+            /* decoding stops after each `* N` line */
+            before = data.char_no;
+            status = hex_data_to_bin(&data, position,
+                input_length - (size_t)(position - input),
+                output, &output_length);
+            position += data.char_no - before;
+            write_in_range(range_output, output, output_length,
+                &skip, &length);
+            if (status == HEX_TO_BIN_REPEAT) {
+                /* whole lines before the range are skipped at once */
+                lines = skip / 16 < data.repeat ? skip / 16 : data.repeat;
+                skip -= lines * 16;
+                data.repeat -= lines;
+                while (length && (output_length = hex_repeat_to_bin(
+                        &data, output, sizeof(output))) > 0) {
+                    write_in_range(range_output, output, output_length,
+                        &skip, &length);
+                }
+                data.repeat = 0;
+                status = 0;
+            }
+        } while (!status && length
+            && position < input + input_length);
+    }
+    if (status && length) {
+        /* only invalid characters inside the range matter */
+        report_invalid(&data);
+        return 1;
+    }
+    return 0;
+}
+
+int decode_range(FILE *input_file,
+        const char *input_filename,
+        FILE *output_file,
+        unsigned long long start,
+        unsigned long long length,
+        BOOL verbose) {
+    RangeOutput range_output;
+    range_output.file = output_file;
+    range_output.buffer = NULL;
+    return decode_range_to(input_file, input_filename, &range_output,
+        start, length, verbose);
+}
+
+int write_range_index(FILE *input_file,
+        const char *input_filename,
+        BOOL verbose) {
+    char *input, *output, *index_filename;
+    const char *chunk_start, *position, *end, *newline;
+    unsigned long long size, offset, address;
+    size_t input_length;
+    unsigned lines;
+    Location first;
+    FILE *index;
+    FileVersion version;
+    FromHexData data = init_from_hex_data();
+    int status = 0;
+
+    if (!get_file_size(input_file, &size)) {
+        fprintf(stderr, "Error: Unable to seek in input: %s\n",
+            strerror(errno));
+        return 2;
+    }
+    find_first_line(input_file, size, &first);
+    data.allow_repeat = is_elided(input_file);
+    if (!get_file_version(input_file, &version)) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+        return 2;
+    } else if (!seek_to(input_file, 0)) {
+        fprintf(stderr, "Error: Unable to seek in input: %s\n",
+            strerror(errno));
+        return 2;
+    }
+
+    index_filename = (char *)malloc(strlen(input_filename) + 5);
+    input = (char *)malloc(INDEX_BUFFER_SIZE + INDEX_BUFFER_SIZE / 2 + 1);
+    if (!index_filename || !input) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        free(index_filename);
+        free(input);
+        return 2;
+    }
+    output = input + INDEX_BUFFER_SIZE;
+    sprintf(index_filename, "%s.idx", input_filename);
+    index = fopen(index_filename, "wb");
+    if (!index) {
+        fprintf(stderr, "Unable to open file `%s` for writing: %s\n",
+            index_filename, strerror(errno));
+        free(index_filename);
+        free(input);
+        return 2;
+    }
+    if (verbose) {
+        fprintf(stderr, "Writing line index `%s`\n", index_filename);
+    }
+    fprintf(index, "%s\n%llu " FILE_VERSION_FORMAT "\n", index_header,
+        size, version.mtime, version.mtime_nsec, version.ctime,
+        version.ctime_nsec, version.inode);
+
+    /* decode in chunks that end after every INDEX_INTERVAL-th line */
+    offset = 0;
+    address = first.address;
+    lines = 0;
+    while (!status && (input_length = fread(
+            input, 1, INDEX_BUFFER_SIZE, input_file)) > 0) {
+        end = input + input_length;
+        chunk_start = input;
+        for (position = input; position < end; position = newline + 1) {
+            newline = (const char *)memchr(
+                position, '\n', (size_t)(end - position));
+            if (!newline) {
+                break;
+            } else if (++lines < INDEX_INTERVAL) {
+                continue;
+            }
+            lines = 0;
+            status = count_decoded_bytes(&data, chunk_start,
+                (size_t)(newline + 1 - chunk_start), output, &address);
+            if (status) {
+                break;
+            }
+            chunk_start = newline + 1;
+            /* decoding can't start at a `* N` line, which repeats
+                the line before it */
+            if (!data.inside_comment && !data.skip_line
+                    && !data.prev_byte && (!data.allow_repeat
+                        || (chunk_start < end && *chunk_start != '*'))) {
+                fprintf(index, "%llu %llu %llu\n", address,
+                    offset + (size_t)(chunk_start - input), data.line_no);
+            }
+        }
+        if (!status && chunk_start < end) {
+            status = count_decoded_bytes(&data, chunk_start,
+                (size_t)(end - chunk_start), output, &address);
+        }
+        offset += input_length;
+    }
+
+    if (status) {
+        report_invalid(&data);
+    }
+    if (fclose(index) && !status) {
+        fprintf(stderr, "Error: Unable to write `%s`: %s\n",
+            index_filename, strerror(errno));
+        status = 2;
+    }
+    if (status) {
+        remove(index_filename);
+    }
+    free(index_filename);
+    free(input);
+    return status;
+}
+
+int encode_range(FILE *input_file,
+        FILE *output_file,
+        unsigned long long skip,
+        unsigned long long length) {
+    char *input, *output;
+    unsigned long long address = skip;
+    size_t input_length, output_length;
+    double start;
+
+    /* ENCODE_BUFFER_SIZE is a multiple of 16, so every read after the
+        first one starts a line */
+    enum { ENCODE_BUFFER_SIZE = 1 << 16 };
+
+    input = (char *)malloc(ENCODE_BUFFER_SIZE
+        + (size_t)bin_to_hex_size(ENCODE_BUFFER_SIZE));
+    if (!input) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 1;
+    }
+    output = input + ENCODE_BUFFER_SIZE;
+
+#ifdef _MSC_VER
+    if (skip && !_fseeki64(input_file, (__int64)skip, SEEK_CUR)) {
+        skip = 0;
+    }
+#else
+    if (skip && !fseeko(input_file, (off_t)skip, SEEK_CUR)) {
+        skip = 0;
+    }
+#endif
+    /* pipes can't seek, so read past what is skipped */
+    while (skip && (input_length = fread(input, 1,
+            skip < ENCODE_BUFFER_SIZE ? (size_t)skip : ENCODE_BUFFER_SIZE,
+            input_file)) > 0) {
+        skip -= input_length;
+    }
+
+    while (length) {
+        start = stats_clock();
+        input_length = fread(input, 1,
+            length < ENCODE_BUFFER_SIZE
+                ? (size_t)length : ENCODE_BUFFER_SIZE,
+            input_file);
+        stats_end(StatsRead, start, input_length);
+        if (!input_length) {
+            break;
+        }
+        start = stats_clock();
+        output_length = bin_data_to_hex(input, input_length, address,
+            output);
+        stats_end(StatsConvert, start, input_length);
+        if (output_file) {
+            start = stats_clock();
+            fwrite(output, output_length, 1, output_file);
+            stats_end(StatsWrite, start, output_length);
+        }
+        address += input_length;
+        length -= input_length;
+    }
+    if (ferror(input_file)) {
+        fprintf(stderr, "Error: Unable to read input: %s\n",
+            strerror(errno));
+        free(input);
+        return 1;
+    }
+    free(input);
+    return 0;
+}
+
+/* Whether line `line` (after the header) of the canonical output in
+ * `output_file` is the one encoding the input at its address. */
+static BOOL is_line_written(FILE *input_file, FILE *output_file,
+        unsigned long long line) {
+    char input[16], text[LINE_LENGTH], expected[LINE_LENGTH];
+
+    return read_at(input_file, line * 16, input, 16) == 16
+        && read_at(output_file, HEADER_SIZE + line * LINE_LENGTH, text,
+            LINE_LENGTH) == LINE_LENGTH
+        && bin_data_to_hex(input, 16, line * 16, expected) == LINE_LENGTH
+        && !memcmp(text, expected, LINE_LENGTH);
+}
+
+int resume_encode(FILE *input_file,
+        FILE *output_file,
+        BOOL verbose) {
+    char header[HEADER_SIZE];
+    unsigned long long input_size, output_size, lines, low, high, middle;
+    size_t length;
+
+    if (!get_file_size(input_file, &input_size)
+            || !get_file_size(output_file, &output_size)) {
+        fprintf(stderr, "Error: Unable to seek in the files: %s\n",
+            strerror(errno));
+        return 1;
+    }
+    output_size = written_size(output_file, output_size);
+
+    /* anything else than (the start of) canonical output is kept */
+    length = output_size < HEADER_SIZE ? (size_t)output_size : HEADER_SIZE;
+    if (read_at(output_file, 0, header, length) != length
+            || memcmp(header, HEXTOGGLE_HEADER "\n", length)) {
+        fprintf(stderr, "Error: the output isn't canonical hex output, "
+            "so it can't be resumed\n");
+        return 1;
+    }
+    lines = output_size < HEADER_SIZE
+        ? 0 : (output_size - HEADER_SIZE) / LINE_LENGTH;
+    if (lines > input_size / 16) {
+        fprintf(stderr, "Error: the output has more lines than the "
+            "input, so it can't be resumed\n");
+        return 1;
+    }
+
+    /* the last complete line needs to match the input, but output that
+        was allocated in advance is followed by zeros, so if it doesn't
+        the last line that does is searched for: lines are written in
+        order, and one that wasn't can't match, since it has an address */
+    if (lines && !is_line_written(input_file, output_file, lines - 1)) {
+        if (is_line_written(input_file, output_file, 0)) {
+            low = 1;
+            high = lines - 1;
+        } else if (read_at(output_file, HEADER_SIZE, header, 1) == 1
+                && header[0] == '\0') {
+            /* allocated, but stopped before the first line */
+            low = high = 0;
+        } else {
+            fprintf(stderr, "Error: line 2 of the output doesn't match "
+                "the input, so it can't be resumed\n");
+            return 1;
+        }
+        /* line `low - 1` matches and line `high` doesn't */
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (is_line_written(input_file, output_file, middle)) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (verbose) {
+            fprintf(stderr, "Only the first %llu lines of the output "
+                "match the input\n", low);
+        }
+        lines = low;
+    }
+
+    /* drop any torn line after it, and carry on from there */
+    if (!truncate_file(output_file, lines ? HEADER_SIZE
+                + lines * LINE_LENGTH : 0)
+            || !seek_to(output_file, lines ? HEADER_SIZE
+                + lines * LINE_LENGTH : 0)
+            || !seek_to(input_file, 0)) {
+        fprintf(stderr, "Error: Unable to resize the output: %s\n",
+            strerror(errno));
+        return 1;
+    }
+    if (!lines) {
+        fputs(HEXTOGGLE_HEADER "\n", output_file);
+        stats_count(StatsWrite, HEADER_SIZE);
+    }
+    if (verbose) {
+        fprintf(stderr, "Resuming at address %llu (line %llu)\n",
+            lines * 16, lines + 2);
+    }
+    if (stats.enabled) {
+        stats.total = input_size - lines * 16;
+    }
+    return encode_range(input_file, output_file, lines * 16, ULLONG_MAX);
+}
+
+int resume_decode(FILE *input_file,
+        const char *input_filename,
+        FILE *output_file,
+        BOOL verbose) {
+    char expected[16], output[16];
+    unsigned long long input_size, output_size, end;
+    Location first;
+    RangeOutput range_output;
+    int status;
+
+    if (!get_file_size(input_file, &input_size)
+            || !get_file_size(output_file, &output_size)) {
+        fprintf(stderr, "Error: Unable to seek in the files: %s\n",
+            strerror(errno));
+        return 2;
+    }
+    end = written_size(output_file, output_size);
+    if (end < output_size) {
+        end = end > HOLE_MARGIN ? end - HOLE_MARGIN : 0;
+    }
+    end = end / 16 * 16;
+    find_first_line(input_file, input_size, &first);
+
+    /* the last 16 bytes kept need to match what the input decodes to
+        at their address */
+    if (end) {
+        range_output.file = NULL;
+        range_output.buffer = expected;
+        status = decode_range_to(input_file, input_filename,
+            &range_output, first.address + end - 16, 16, FALSE);
+        if (status) {
+            return status;
+        }
+        if (range_output.buffer != expected + 16
+                || read_at(output_file, end - 16, output, 16) != 16
+                || memcmp(output, expected, 16)) {
+            fprintf(stderr, "Error: the output doesn't match the input "
+                "at address %llu, so it can't be resumed\n",
+                first.address + end - 16);
+            return 2;
+        }
+    }
+
+    if (!truncate_file(output_file, end) || !seek_to(output_file, end)) {
+        fprintf(stderr, "Error: Unable to resize the output: %s\n",
+            strerror(errno));
+        return 2;
+    }
+    if (verbose) {
+        fprintf(stderr, "Resuming at address %llu\n",
+            first.address + end);
+    }
+    return decode_range(input_file, input_filename, output_file,
+        first.address + end, ULLONG_MAX, verbose);
+}
@@ -0,0 +1,97 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+/* random access to byte ranges: decoding the bytes at given addresses
+of a hex file, encoding part of a binary file, and resuming either of
+these conversions where they stopped */
+
+#include "utils.h"
+
+#include <stdio.h>
+
+/**
+ * Decode the `length` bytes starting at address `start` of the hex
+ * file `input_file`. Addresses are those shown in the address column,
+ * i.e. the first line's address plus the position in the decoded data.
+ *
+ * Decoding starts at a line close to `start`, which is found with the
+ * first of these that works:
+ *   - the line index `input_filename`.idx written by
+ *     `write_range_index`, if the file hasn't changed since (its size,
+ *     modification and change times and inode are compared)
+ *   - the offset of the line in a canonical file, where every line is
+ *     81 characters long (its address column is checked)
+ *   - the offset of the line in a plain file, where every line is 65
+ *     characters long
+ *   - a binary search on the address column, which assumes the
+ *     addresses are still in order (up to 1 TiB)
+ *   - the start of the file
+ * A line index is the only option that is reliable after lines have
+ * been edited to contain more or fewer bytes.
+ *
+ * `input_filename`: used to find the line index, can be NULL
+ * Return value: 0 on success, 1 if the input is invalid, or 2 on any
+ *     other error. Ranges past the end of the data are cut short. */
+int decode_range(FILE *input_file,
+    const char *input_filename,
+    FILE *output_file,
+    unsigned long long start,
+    unsigned long long length,
+    BOOL verbose);
+
+/**
+ * Decode all of `input_file` and write the positions of every 4096th
+ * line to the line index `input_filename`.idx.
+ *
+ * Return value: 0 on success, 1 if the input is invalid, or 2 on any
+ *     other error */
+int write_range_index(FILE *input_file,
+    const char *input_filename,
+    BOOL verbose);
+
+/**
+ * Encode `length` bytes of `input_file`, starting `skip` bytes after
+ * its current position. The address column shows the offsets in the
+ * input, i.e. starting at `skip`. Seekable inputs are seeked, and data
+ * is read and discarded otherwise.
+ *
+ * `output_file`: where the header has already been written, or NULL
+ *     for a dry run
+ * `length`: ULLONG_MAX to encode everything after `skip`
+ * Return value: 0 on success, 1 on error */
+int encode_range(FILE *input_file,
+    FILE *output_file,
+    unsigned long long skip,
+    unsigned long long length);
+
+/**
+ * Continue encoding `input_file` into `output_file`, which holds the
+ * start of its canonical output. The last complete line is checked
+ * against the input, any torn line after it is cut off, and encoding
+ * carries on with the next line. Output that was sized in advance is
+ * only read up to its first hole, and if it was also allocated, the
+ * last line that matches the input is found with a binary search. An
+ * empty output is encoded from the start.
+ *
+ * Both files need to be seekable, and the output open for reading.
+ * Return value: 0 on success, 1 on error */
+int resume_encode(FILE *input_file,
+    FILE *output_file,
+    BOOL verbose);
+
+/**
+ * Continue decoding the hex file `input_file` into `output_file`, which
+ * holds the start of its data. The output is cut back to a whole number
+ * of lines, its last 16 bytes are checked against the input, and
+ * decoding carries on from the line with the next address, which is
+ * found as described for `decode_range`.
+ *
+ * Both files need to be seekable, and the output open for reading.
+ * Return value: 0 on success, 1 if the input is invalid, or 2 on any
+ *     other error */
+int resume_decode(FILE *input_file,
+    const char *input_filename,
+    FILE *output_file,
+    BOOL verbose);
+
+#endif /* RANGE_H */
@@ -0,0 +1,376 @@
+#include "search.h"
+
+#include "bin_to_hex.h"
+#include "cpu.h"
+#include "mapped_io.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+#endif
+
+/* lines shown before and after the lines of each match */
+enum { CONTEXT_LINES = 1, CONTEXT_BYTES = 16 * CONTEXT_LINES };
+
+/* Input that can't be mapped is read READ_SIZE bytes at a time. The
+    buffer also keeps the end of the previous read, for matches that
+    span reads and for the lines around them. */
+enum { READ_SIZE = 1 << 20 };
+enum { BUFFER_SIZE = READ_SIZE + 2 * MAX_PATTERN_LENGTH
+    + 4 * CONTEXT_BYTES + 32 };
+
+/* the bytes after a match that need to be in the buffer, for the rest
+    of its last line and the lines after it */
+enum { AFTER_MATCH = 16 + CONTEXT_BYTES };
+
+/* Kernels that return the first position below `count` where `data`
+ * has the bytes `first` and `second`, or `count` if there is none.
+ * `data[count]` needs to be readable. */
+typedef size_t (*FindPairFn)(
+    const unsigned char *data,
+    size_t count,
+    unsigned char first,
+    unsigned char second);
+
+typedef struct {
+    const SearchPattern *pattern;
+    /* candidates are found with the bytes at `anchor`, which are the
+        pair (or single byte) without wildcards least likely to be
+        common, or with none of them if every byte has a wildcard */
+    size_t anchor;
+    int anchor_length;
+    FindPairFn find_pair;
+    FILE *output_file;
+    char *output; /* the lines around a match */
+    unsigned long long matches;
+} Search;
+
+BOOL parse_search_pattern(const char *text, SearchPattern *pattern) {
+    size_t nibbles = 0, byte;
+    int shift, value;
+
+    for (; *text; ++text) {
+        if (*text == ' ') {
+            continue;
+        } else if (nibbles == 2 * MAX_PATTERN_LENGTH) {
+            return FALSE;
+        }
+        byte = nibbles / 2;
+        shift = nibbles % 2 ? 0 : 4;
+        if (shift) {
+            pattern->value[byte] = 0;
+            pattern->mask[byte] = 0;
+        }
+        if (*text != '?') {
+            value = hex_char_to_int(*text);
+            if (value < 0) {
+                return FALSE;
+            }
+            pattern->value[byte] |= (unsigned char)(value << shift);
+            pattern->mask[byte] |= (unsigned char)(0xf << shift);
+        }
+        ++nibbles;
+    }
+    pattern->length = nibbles / 2;
+    return nibbles && nibbles % 2 == 0;
+}
+
+/* Zeros and 0xff fill much of most binaries, which makes them poor
+ * filters. */
+static int common_byte(unsigned char byte) {
+    return byte == 0 || byte == 0xff;
+}
+
+static void choose_anchor(Search *search) {
+    const SearchPattern *pattern = search->pattern;
+    int score, best = 0;
+    size_t i;
+
+    search->anchor = 0;
+    search->anchor_length = 0;
+    for (i = 0; i + 1 < pattern->length; ++i) {
+        if (pattern->mask[i] != 0xff || pattern->mask[i + 1] != 0xff) {
+            continue;
+        }
+        score = common_byte(pattern->value[i])
+            + common_byte(pattern->value[i + 1]);
+        if (!search->anchor_length || score < best) {
+            search->anchor = i;
+            search->anchor_length = 2;
+            best = score;
+        }
+    }
+    for (i = 0; !search->anchor_length && i < pattern->length; ++i) {
+        if (pattern->mask[i] == 0xff) {
+            search->anchor = i;
+            search->anchor_length = 1;
+        }
+    }
+}
+
+static size_t find_pair_scalar(
+        const unsigned char *data,
+        size_t count,
+        unsigned char first,
+        unsigned char second) {
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        if (data[i] == first && data[i + 1] == second) {
+            return i;
+        }
+    }
+    return count;
+}
+
+#ifdef CPU_X86
+
+static unsigned lowest_bit(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#endif
+}
+
+/* Both bytes are compared at every position at once, by comparing
+ * the second one with the data shifted by a byte. */
+CPU_TARGET("sse2")
+static size_t find_pair_sse2(
+        const unsigned char *data,
+        size_t count,
+        unsigned char first,
+        unsigned char second) {
+    const __m128i first_bytes = _mm_set1_epi8((char)first);
+    const __m128i second_bytes = _mm_set1_epi8((char)second);
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(first_bytes,
+                _mm_loadu_si128((const __m128i *)(data + i))),
+            _mm_cmpeq_epi8(second_bytes,
+                _mm_loadu_si128((const __m128i *)(data + i + 1)))));
+        if (mask) {
+            return i + lowest_bit(mask);
+        }
+    }
+    return i + find_pair_scalar(data + i, count - i, first, second);
+}
+
+CPU_TARGET("avx2")
+static size_t find_pair_avx2(
+        const unsigned char *data,
+        size_t count,
+        unsigned char first,
+        unsigned char second) {
+    const __m256i first_bytes = _mm256_set1_epi8((char)first);
+    const __m256i second_bytes = _mm256_set1_epi8((char)second);
+    __m256i low, high;
+    unsigned mask;
+    size_t i;
+
+    /* two vectors per iteration, which are only looked at separately
+        if either of them has a candidate */
+    for (i = 0; i + 64 <= count; i += 64) {
+        low = _mm256_and_si256(
+            _mm256_cmpeq_epi8(first_bytes,
+                _mm256_loadu_si256((const __m256i *)(data + i))),
+            _mm256_cmpeq_epi8(second_bytes,
+                _mm256_loadu_si256((const __m256i *)(data + i + 1))));
+        high = _mm256_and_si256(
+            _mm256_cmpeq_epi8(first_bytes,
+                _mm256_loadu_si256((const __m256i *)(data + i + 32))),
+            _mm256_cmpeq_epi8(second_bytes,
+                _mm256_loadu_si256((const __m256i *)(data + i + 33))));
+        if (_mm256_testz_si256(_mm256_or_si256(low, high),
+                _mm256_or_si256(low, high))) {
+            continue;
+        }
+        mask = (unsigned)_mm256_movemask_epi8(low);
+        if (mask) {
+            return i + lowest_bit(mask);
+        }
+        return i + 32 + lowest_bit((unsigned)_mm256_movemask_epi8(high));
+    }
+    return i + find_pair_sse2(data + i, count - i, first, second);
+}
+
+#endif /* CPU_X86 */
+
+static FindPairFn select_find_pair_kernel(void) {
+#ifdef CPU_X86
+    unsigned features = cpu_features();
+    if (features & CpuFeatureAVX2) {
+        return find_pair_avx2;
+    } else if (features & CpuFeatureSSE2) {
+        return find_pair_sse2;
+    }
+#endif
+    return find_pair_scalar;
+}
+
+static BOOL matches_at(const SearchPattern *pattern,
+        const unsigned char *data) {
+    size_t i;
+    for (i = 0; i < pattern->length; ++i) {
+        if ((data[i] & pattern->mask[i]) != pattern->value[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Write the address of the match at `offset`, followed by its lines
+ * and those around it as far as `data` goes. `data` holds `length`
+ * bytes from the line address `base`. */
+static void report_match(Search *search,
+        const char *data, size_t length,
+        unsigned long long base, size_t offset) {
+    unsigned long long address = base + offset;
+    unsigned long long start = address / 16 * 16;
+    unsigned long long end = (address + search->pattern->length + 15)
+        / 16 * 16 + CONTEXT_BYTES;
+    size_t output_length;
+
+    ++search->matches;
+    if (!search->output_file) {
+        return;
+    }
+    start = start - base >= CONTEXT_BYTES ? start - CONTEXT_BYTES : base;
+    if (end > base + length) {
+        end = base + length;
+    }
+    output_length = bin_data_to_hex(data + (start - base),
+        (size_t)(end - start), start, search->output);
+    fprintf(search->output_file, "| match at %llu (0x%llx)\n",
+        address, address);
+    fwrite(search->output, output_length, 1, search->output_file);
+    stats_count(StatsWrite, output_length);
+}
+
+/* Report the matches that start from `from` to before `to` in `data`,
+ * which holds `length` bytes from the line address `base`, including
+ * the whole of these matches. */
+static void scan(Search *search,
+        const char *data, size_t length,
+        unsigned long long base, size_t from, size_t to) {
+    const SearchPattern *pattern = search->pattern;
+    const unsigned char *bytes = (const unsigned char *)data;
+    const unsigned char *anchor = bytes + search->anchor;
+    const unsigned char *found;
+    size_t i = from;
+
+    while (i < to) {
+        if (search->anchor_length == 2) {
+            i += search->find_pair(anchor + i, to - i,
+                pattern->value[search->anchor],
+                pattern->value[search->anchor + 1]);
+        } else if (search->anchor_length == 1) {
+            found = (const unsigned char *)memchr(anchor + i,
+                pattern->value[search->anchor], to - i);
+            i = found ? (size_t)(found - anchor) : to;
+        }
+        if (i >= to) {
+            break;
+        }
+        if (matches_at(pattern, bytes + i)) {
+            report_match(search, data, length, base, i);
+        }
+        ++i;
+    }
+}
+
+int search_input(FILE *input_file,
+        FILE *output_file,
+        const SearchPattern *pattern,
+        BOOL verbose) {
+    Search search;
+    MappedInput mapped;
+    char *buffer;
+    size_t length = 0, position = 0, limit, keep, read_length;
+    unsigned long long base = 0;
+    BOOL end_of_input = FALSE;
+    double start;
+
+    search.pattern = pattern;
+    search.find_pair = select_find_pair_kernel();
+    search.output_file = output_file;
+    search.matches = 0;
+    choose_anchor(&search);
+    search.output = (char *)malloc((size_t)bin_to_hex_size(
+        MAX_PATTERN_LENGTH + 32 + 2 * CONTEXT_BYTES));
+    if (!search.output) {
+        fprintf(stderr, "Error: Unable to allocate buffers\n");
+        return 2;
+    }
+
+    if (map_input(input_file, 0, &mapped)) {
+        /* the whole file is one buffer */
+        start = stats_clock();
+        if (mapped.size >= pattern->length) {
+            scan(&search, mapped.data, (size_t)mapped.size, 0,
+                0, (size_t)mapped.size - pattern->length + 1);
+        }
+        stats_end(StatsConvert, start, mapped.size);
+        unmap_input(&mapped);
+    } else {
+        buffer = (char *)malloc(BUFFER_SIZE);
+        if (!buffer) {
+            fprintf(stderr, "Error: Unable to allocate buffers\n");
+            free(search.output);
+            return 2;
+        }
+        while (!end_of_input) {
+            start = stats_clock();
+            read_length = fread(buffer + length, 1, BUFFER_SIZE - length,
+                input_file);
+            stats_end(StatsRead, start, read_length);
+            if (ferror(input_file)) {
+                fprintf(stderr, "Error: Unable to read input\n");
+                free(buffer);
+                free(search.output);
+                return 2;
+            }
+            length += read_length;
+            end_of_input = length < BUFFER_SIZE;
+
+            /* the lines after a match need to be read before it can be
+                reported, unless the input ends */
+            limit = end_of_input ? pattern->length - 1
+                : pattern->length - 1 + AFTER_MATCH;
+            limit = length > limit ? length - limit : 0;
+            if (limit > position) {
+                start = stats_clock();
+                scan(&search, buffer, length, base, position, limit);
+                stats_end(StatsConvert, start, limit - position);
+                position = limit;
+            }
+
+            /* keep the next candidate and the lines before it */
+            keep = (size_t)((base + position) / 16 * 16 - base);
+            keep = keep >= CONTEXT_BYTES ? keep - CONTEXT_BYTES : 0;
+            memmove(buffer, buffer + keep, length - keep);
+            base += keep;
+            length -= keep;
+            position -= keep;
+        }
+        free(buffer);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "%llu match%s\n", search.matches,
+            search.matches == 1 ? "" : "es");
+    }
+    free(search.output);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+/* searching binary input for a byte pattern, and showing the lines
+around each match in the canonical hex format */
+
+#include "utils.h"
+
+#include <stdio.h>
+
+enum { MAX_PATTERN_LENGTH = 256 };
+
+/* a sequence of bytes where some of the nibbles can be anything */
+typedef struct {
+    unsigned char value[MAX_PATTERN_LENGTH];
+    unsigned char mask[MAX_PATTERN_LENGTH]; /* 0xf0 for a wildcard in
+                                               the low nibble, etc. */
+    size_t length;
+} SearchPattern;
+
+/* Parse a pattern of hex digits, where `?` stands for any nibble (such
+as `7f45 4c46 ??01`). Spaces are ignored, and the pattern needs to be a
+whole number of bytes. Returns FALSE if it's invalid. */
+BOOL parse_search_pattern(const char *text, SearchPattern *pattern);
+
+/**
+ * Find every occurrence of `pattern` in the rest of `input_file`
+ * (overlapping ones included), and write its address followed by the
+ * lines around it to `output_file`, if it isn't NULL. Regular files are
+ * searched through a memory mapping, and anything else in buffers.
+ *
+ * Return value: 0 on success (whether or not there are matches), or 2
+ *     on error */
+int search_input(FILE *input_file,
+    FILE *output_file,
+    const SearchPattern *pattern,
+    BOOL verbose);
+
+#endif /* SEARCH_H */
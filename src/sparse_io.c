@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "sparse_io.h"
+
+#include "bin_to_hex.h"
+#include "hex_to_bin.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __linux__
+
+int sparse_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    (void)input_file;
+    (void)output_file;
+    (void)prefix;
+    (void)prefix_length;
+    return SPARSE_IO_UNSUPPORTED;
+}
+
+int sparse_from_hex(FILE *input_file,
+        FILE *output_file,
+        HextoggleDecoder *decoder) {
+    (void)input_file;
+    (void)output_file;
+    (void)decoder;
+    return SPARSE_IO_UNSUPPORTED;
+}
+
+#else
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* READ_SIZE is the amount of input to convert at once. */
+enum { READ_SIZE = 1 << 20 };
+
+/* Decoded blocks of zeros of this size (and alignment) become holes. */
+enum { HOLE_BLOCK_SIZE = 4096 };
+
+/* Encode `length` bytes of `input`, or of zeros if it's NULL, and
+ * write the output. */
+static void encode_part(HextoggleEncoder *encoder,
+        const char *input, unsigned long long length,
+        char *output, FILE *output_file) {
+    size_t output_length;
+    double start = stats_clock();
+
+    output_length = input
+        ? hextoggle_encode(encoder, input, (size_t)length, output)
+        : hextoggle_encode_zeros(encoder, length, output);
+    stats_end(StatsConvert, start, length);
+    stats_count_lines(output, output_length);
+    if (output_file && output_length) {
+        start = stats_clock();
+        fwrite(output, output_length, 1, output_file);
+        stats_end(StatsWrite, start, output_length);
+    }
+}
+
+int sparse_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    struct stat info;
+    HextoggleEncoder encoder;
+    off_t offset, data, hole;
+    ssize_t length;
+    size_t part, output_length;
+    char *input, *output;
+    int fd = fileno(input_file);
+    double start;
+
+    /* the holes are looked up from the current position */
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)
+            || (offset = ftello(input_file)) < 0
+            || (lseek(fd, offset, SEEK_HOLE) < 0 && errno != ENXIO)) {
+        return SPARSE_IO_UNSUPPORTED;
+    }
+    hextoggle_encoder_reset(&encoder, FALSE);
+    hextoggle_encoder_set_elide(&encoder, TRUE);
+    input = (char *)malloc(READ_SIZE
+        + hextoggle_encode_bound(&encoder, READ_SIZE));
+    if (!input) {
+        return SPARSE_IO_UNSUPPORTED;
+    }
+    output = input + READ_SIZE;
+
+    while (prefix_length) {
+        part = prefix_length < READ_SIZE ? prefix_length : READ_SIZE;
+        encode_part(&encoder, prefix, part, output, output_file);
+        prefix += part;
+        prefix_length -= part;
+    }
+    while (offset < info.st_size) {
+        data = lseek(fd, offset, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+            /* the rest of the file is a hole */
+            data = info.st_size;
+        }
+        hole = data < info.st_size ? lseek(fd, data, SEEK_HOLE) : data;
+        if (data < 0 || hole < 0) {
+            fprintf(stderr, "Error: Unable to find holes in input: %s\n",
+                strerror(errno));
+            free(input);
+            return 1;
+        }
+        if (hole > info.st_size) {
+            hole = info.st_size;
+        }
+        if (data > offset) {
+            encode_part(&encoder, NULL,
+                (unsigned long long)(data - offset), output, output_file);
+            offset = data;
+        }
+        while (offset < hole) {
+            start = stats_clock();
+            length = pread(fd, input, hole - offset < READ_SIZE
+                ? (size_t)(hole - offset) : READ_SIZE, offset);
+            stats_end(StatsRead, start, length > 0 ? (size_t)length : 0);
+            if (length < 0 && errno == EINTR) {
+                continue;
+            } else if (length < 0) {
+                fprintf(stderr, "Error: Unable to read input: %s\n",
+                    strerror(errno));
+                free(input);
+                return 1;
+            } else if (!length) {
+                /* the file was truncated while reading it */
+                info.st_size = offset;
+                break;
+            }
+            encode_part(&encoder, input, (size_t)length,
+                output, output_file);
+            offset += length;
+        }
+    }
+
+    output_length = hextoggle_encode_finish(&encoder, output);
+    stats_count_lines(output, output_length);
+    if (output_file && output_length) {
+        fwrite(output, output_length, 1, output_file);
+        stats_count(StatsWrite, output_length);
+    }
+    free(input);
+    return 0;
+}
+
+static BOOL is_zero(const char *data, size_t length) {
+    return !data[0] && !memcmp(data, data + 1, length - 1);
+}
+
+/* Write `length` bytes of `data` at `*offset` except for the aligned
+ * blocks of zeros, and advance `*offset`. Returns 0 or an errno
+ * value. */
+static int write_sparse(int fd, const char *data, size_t length,
+        unsigned long long *offset) {
+    size_t done = 0, written = 0, block;
+    int error = 0;
+    double start = stats_clock();
+
+    while (!error && done < length) {
+        block = HOLE_BLOCK_SIZE
+            - (size_t)((*offset + done) % HOLE_BLOCK_SIZE);
+        if (block > length - done) {
+            block = length - done;
+        }
+        if (block == HOLE_BLOCK_SIZE && is_zero(data + done, block)) {
+            /* write what came before this block */
+            error = write_at(fd, data + written, done - written,
+                *offset + written);
+            written = done + block;
+        }
+        done += block;
+    }
+    if (!error) {
+        error = write_at(fd, data + written, length - written,
+            *offset + written);
+    }
+    *offset += length;
+    stats_end(StatsWrite, start, length);
+    return error;
+}
+
+int sparse_from_hex(FILE *input_file,
+        FILE *output_file,
+        HextoggleDecoder *decoder) {
+    static const char zero_line[16];
+    struct stat info;
+    char *input, *output;
+    size_t input_length, output_length, output_size, done;
+    unsigned long long before, after, line_no, column, offset;
+    off_t start_offset;
+    int fd, status = 0, error = 0;
+    double start;
+
+    if (!output_file) {
+        return SPARSE_IO_UNSUPPORTED;
+    }
+    fd = fileno(output_file);
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)
+            || fflush(output_file)
+            || (start_offset = ftello(output_file)) < 0) {
+        return SPARSE_IO_UNSUPPORTED;
+    }
+    output_size = hextoggle_decode_bound(READ_SIZE);
+    input = (char *)malloc(READ_SIZE + output_size);
+    /* anything after the start would show through the holes */
+    if (!input || ftruncate(fd, start_offset)) {
+        free(input);
+        return SPARSE_IO_UNSUPPORTED;
+    }
+    output = input + READ_SIZE;
+    offset = (unsigned long long)start_offset;
+
+    while (!status && !error) {
+        start = stats_clock();
+        input_length = fread(input, 1, READ_SIZE, input_file);
+        stats_end(StatsRead, start, input_length);
+        if (!input_length) {
+            break;
+        }
+        done = 0;
+        do {
+            /* decoding stops after each `* N` line */
+            hextoggle_decoder_position(decoder, &before, &line_no, &column);
+            start = stats_clock();
+            status = hextoggle_decode(decoder, input + done,
+                input_length - done, output, &output_length);
+            hextoggle_decoder_position(decoder, &after, &line_no, &column);
+            done += (size_t)(after - before);
+            stats_end(StatsConvert, start, after - before);
+            error = write_sparse(fd, output, output_length, &offset);
+            if (status != HEXTOGGLE_REPEAT) {
+                continue;
+            } else if (!memcmp(decoder->data.last_bytes, zero_line, 16)) {
+                /* repeated zeros are skipped over at once */
+                stats_count(StatsWrite, decoder->data.repeat * 16);
+                offset += decoder->data.repeat * 16;
+                decoder->data.repeat = 0;
+            }
+            while (!error && (output_length = hextoggle_decode_repeat(
+                    decoder, output, output_size)) > 0) {
+                error = write_sparse(fd, output, output_length, &offset);
+            }
+            status = 0;
+        } while (!status && !error && done < input_length);
+    }
+
+    /* the file ends with a hole if it ends with zeros */
+    if (!error && ftruncate(fd, (off_t)offset)) {
+        error = errno;
+    }
+    if (!error && fseeko(output_file, (off_t)offset, SEEK_SET)) {
+        error = errno;
+    }
+    free(input);
+    if (error) {
+        fprintf(stderr, "Error: Unable to write output: %s\n",
+            strerror(error));
+        return 2;
+    }
+    return status;
+}
+
+#endif /* __linux__ */
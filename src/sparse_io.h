@@ -0,0 +1,41 @@
+#ifndef SPARSE_IO_H
+#define SPARSE_IO_H
+
+/* conversions of sparse files: encoding reads only the data regions of
+the input (SEEK_DATA and SEEK_HOLE), and decoding leaves holes for
+blocks of zeros instead of writing them */
+
+#include "hextoggle.h"
+
+#include <stdio.h>
+
+/* Returned by the functions below if the files can't be handled this
+way (or the system doesn't support sparse files). Nothing has been read
+or written in that case. */
+enum { SPARSE_IO_UNSUPPORTED = -1 };
+
+/**
+ * Encode the regular file `input_file` with elided lines, writing the
+ * holes in it as `* N` lines without reading them. The elided header
+ * has already been written, and `prefix` contains the first
+ * `prefix_length` bytes of input, which were already read.
+ *
+ * Return value: 0 on success, 1 on error, or SPARSE_IO_UNSUPPORTED */
+int sparse_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length);
+
+/**
+ * Decode the rest of `input_file` into the regular file `output_file`
+ * with `decoder`, skipping over every block of zeros (including lines
+ * repeated by `* N` lines) so that it becomes a hole.
+ *
+ * Return value: 0 on success, 1 if the input is invalid (see
+ *     `hextoggle_decoder_position`), 2 on any other error, or
+ *     SPARSE_IO_UNSUPPORTED */
+int sparse_from_hex(FILE *input_file,
+    FILE *output_file,
+    HextoggleDecoder *decoder);
+
+#endif /* SPARSE_IO_H */
@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <string.h>
+#include <time.h>
+
+/* seconds between updates of the status line */
+#define PROGRESS_INTERVAL 0.5
+
+Stats stats;
+
+static clock_t cpu_start;
+
+static const char *phase_names[STATS_PHASES] = {
+    "Read:      ", "Convert:   ", "Write:     ", "I/O wait:  "
+};
+
+static double wall_clock(void) {
+    struct timespec now;
+#ifdef _MSC_VER
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+void stats_start(BOOL progress, unsigned long long total) {
+    memset(&stats, 0, sizeof(stats));
+    stats.enabled = TRUE;
+    stats.progress = progress;
+    stats.total = total;
+    stats.start = wall_clock();
+    stats.next_progress = stats.start + PROGRESS_INTERVAL;
+    cpu_start = clock();
+}
+
+double stats_clock(void) {
+    return stats.enabled ? wall_clock() : 0;
+}
+
+static double rate(unsigned long long bytes, double seconds) {
+    return seconds > 0 ? (double)bytes / seconds / 1e6 : 0;
+}
+
+static void print_progress(double now) {
+    unsigned long long done = stats.bytes[StatsConvert];
+    fprintf(stderr, "\r%llu MiB", done >> 20);
+    if (stats.total) {
+        fprintf(stderr, " of %llu MiB (%u%%)", stats.total >> 20,
+            (unsigned)(done < stats.total ? done * 100 / stats.total : 100));
+    }
+    fprintf(stderr, ", %.1f MB/s   ", rate(done, now - stats.start));
+    fflush(stderr);
+}
+
+void stats_end(StatsPhase phase, double start, unsigned long long bytes) {
+    double now;
+    if (!stats.enabled) {
+        return;
+    }
+    now = wall_clock();
+    ++stats.calls[phase];
+    stats.bytes[phase] += bytes;
+    stats.seconds[phase] += now - start;
+    if (stats.progress && now >= stats.next_progress) {
+        stats.next_progress = now + PROGRESS_INTERVAL;
+        print_progress(now);
+    }
+}
+
+void stats_count(StatsPhase phase, unsigned long long bytes) {
+    if (stats.enabled) {
+        ++stats.calls[phase];
+        stats.bytes[phase] += bytes;
+    }
+}
+
+void stats_count_lines(const char *output, size_t length) {
+    const char *end = output + length;
+    if (!stats.enabled) {
+        return;
+    }
+    while ((output = (const char *)memchr(
+            output, '\n', (size_t)(end - output))) != NULL) {
+        ++stats.lines;
+        ++output;
+    }
+}
+
+void stats_finish(FILE *file, BOOL print) {
+    double wall, cpu;
+    int phase;
+
+    if (!stats.enabled) {
+        return;
+    }
+    wall = wall_clock() - stats.start;
+    cpu = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
+    stats.enabled = FALSE;
+    if (stats.progress) {
+        print_progress(stats.start + wall);
+        fputc('\n', stderr);
+    }
+    if (!print) {
+        return;
+    }
+    fprintf(file, "Input:      %llu bytes\n", stats.bytes[StatsConvert]);
+    fprintf(file, "Output:     %llu bytes\n", stats.bytes[StatsWrite]);
+    fprintf(file, "Lines:      %llu\n", stats.lines);
+    fprintf(file, "Wall time:  %.3f s (CPU time %.3f s)\n", wall, cpu);
+    fprintf(file, "Throughput: %.1f MB/s\n",
+        rate(stats.bytes[StatsConvert], wall));
+    for (phase = 0; phase < STATS_PHASES; ++phase) {
+        fprintf(file, "%s%llu calls, %.3f s\n", phase_names[phase],
+            stats.calls[phase], stats.seconds[phase]);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* counters for --stats and --progress. The conversion loops report each
+buffer they read, convert or write, so the cost is a branch per buffer
+while neither option is used. */
+
+#include "utils.h"
+
+#include <stdio.h>
+
+typedef enum {
+    StatsRead,
+    StatsConvert, /* the bytes of a conversion are the input it used */
+    StatsWrite,
+    StatsWait, /* waiting for asynchronous reads and writes */
+    STATS_PHASES
+} StatsPhase;
+
+typedef struct {
+    BOOL enabled; /* whether the loops record anything */
+    BOOL progress; /* print a status line while converting */
+    unsigned long long total; /* size of the input, or 0 if unknown */
+    unsigned long long lines;
+    unsigned long long calls[STATS_PHASES];
+    unsigned long long bytes[STATS_PHASES];
+    double seconds[STATS_PHASES];
+    double start; /* wall clock time, see `stats_clock` */
+    double next_progress;
+} Stats;
+
+/* Only used by the thread converting a file, and not by batches. */
+extern Stats stats;
+
+/* Start recording (with a status line if `progress` is set), for an
+input of `total` bytes if known. */
+void stats_start(BOOL progress, unsigned long long total);
+
+/* Seconds from an arbitrary point, or 0 while not recording. */
+double stats_clock(void);
+
+/* Record one call of `phase` on `bytes` bytes that started at
+`stats_clock()` time `start`, and update the status line if it's due. */
+void stats_end(StatsPhase phase, double start, unsigned long long bytes);
+
+/* Record one call of `phase` that wasn't timed on its own. */
+void stats_count(StatsPhase phase, unsigned long long bytes);
+
+/* Add the lines in `length` bytes of hex output to `stats.lines`, for
+output where they can't be worked out from the size of the input. */
+void stats_count_lines(const char *output, size_t length);
+
+/* Finish the status line, and print the statistics to `file` if
+`print` is set. */
+void stats_finish(FILE *file, BOOL print);
+
+#endif /* STATS_H */
@@ -1,4 +1,5 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
 
 #include "tempfile.h"
 
@@ -9,55 +10,272 @@
 #include <stdlib.h>
 #include <string.h>
 
-static FILE *handle_errors(FILE *file, const char *filename);
+/* name of a temporary file; the Xs are replaced to make it unique */
+static const char *temp_name = ".temp_hextoggle_XXXXXXXX";
+enum { TEMP_NAME_UNIQUE_LENGTH = 8 };
+
+/* Build the path of `name` in the directory containing `target`.
+ * Returns a buffer allocated with malloc, or NULL on error. */
+static char *sibling_path(const char *target, const char *name) {
+    const char *separator = strrchr(target, '/');
+    size_t directory_length;
+    char *path;
 
 #ifdef _MSC_VER
+    const char *backslash = strrchr(target, '\\');
+    if (backslash && (!separator || backslash > separator)) {
+        separator = backslash;
+    }
+#endif
+    directory_length = separator ? (size_t)(separator - target) + 1 : 0;
+    path = (char *)malloc(directory_length + strlen(name) + 1);
+    if (!path) {
+        return NULL;
+    }
+    memcpy(path, target, directory_length);
+    strcpy(path + directory_length, name);
+    return path;
+}
 
-FILE *open_temporary_file(char *filename) {
-    errno_t err;
-    FILE *file;
+static BOOL handle_errors(TempFile *temp, const char *target) {
+    if (temp->file) {
+        return TRUE;
+    }
+    fprintf(stderr,
+        "Error: Unable to open temporary file `%s` for writing: %s\n",
+        temp->filename ? temp->filename : target, strerror(errno));
+    if (temp->filename) {
+        remove(temp->filename);
+        free(temp->filename);
+        temp->filename = NULL;
+    }
+    return FALSE;
+}
 
-    err = tmpnam_s(filename, L_tmpnam_s);
-    if (err) {
-        fprintf(stderr,
-            "Error: Unable to get temp file name: %s\n",
-            strerror(err));
-        return NULL;
+static BOOL report_name_error(void) {
+    fprintf(stderr,
+        "Error: Unable to get temp file name: %s\n",
+        strerror(errno));
+    return FALSE;
+}
+
+#ifdef _MSC_VER
+
+BOOL open_temporary_file(TempFile *temp, const char *target) {
+    temp->file = NULL;
+    temp->filename = sibling_path(target, temp_name);
+    if (!temp->filename) {
+        errno = ENOMEM;
+        return report_name_error();
+    }
+    errno = _mktemp_s(temp->filename, strlen(temp->filename) + 1);
+    if (errno) {
+        free(temp->filename);
+        temp->filename = NULL;
+        return report_name_error();
     }
-    file = fopen(filename, "wb");
-    return handle_errors(file, filename);
+    temp->file = fopen(temp->filename, "w+b");
+    return handle_errors(temp, target);
+}
+
+void preallocate_temporary_file(TempFile *temp, unsigned long long size) {
+    (void)temp;
+    (void)size;
+}
+
+int publish_temporary_file(TempFile *temp, const char *target,
+        BOOL verbose) {
+    int result = fclose(temp->file);
+
+    temp->file = NULL;
+    if (result) {
+        fprintf(stderr, "Error: Unable to write temporary file: %s\n",
+            strerror(errno));
+        discard_temporary_file(temp);
+        return 1;
+    }
+    /* rename doesn't replace existing files on Windows */
+    if (-1 == remove(target)) {
+        if (errno != ENOENT) {
+            /* target file does exist but we cannot delete it */
+            fprintf(stderr, "Unable to remove file `%s`: %s\n",
+                target, strerror(errno));
+            return 1;
+        }
+    }
+    if (verbose) {
+        fprintf(stderr, "Moving file `%s` to `%s`\n",
+            temp->filename, target);
+    }
+    if (-1 == rename(temp->filename, target)) {
+        fprintf(stderr, "Unable to rename file `%s` to `%s`: %s\n",
+            temp->filename, target, strerror(errno));
+        return 1;
+    }
+    free(temp->filename);
+    temp->filename = NULL;
+    return 0;
+}
+
+unsigned long long remaining_file_size(FILE *file) {
+    (void)file;
+    return 0;
 }
 
 #else
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
-FILE *open_temporary_file(char *filename) {
-    int fd;
-    BOOL success;
-    FILE *file;
-
-    strcpy(filename, ".temp_hextoggle_XXXXXXXX");
-    fd = mkstemp(filename);
-    success = fd != -1;
-    if (!success) {
-        fprintf(stderr,
-            "Error: Unable to get temp file name: %s\n",
+
+BOOL open_temporary_file(TempFile *temp, const char *target) {
+    struct stat info;
+    char *directory;
+    int fd = -1;
+
+    temp->file = NULL;
+    temp->filename = NULL;
+#ifdef O_TMPFILE
+    /* this fails if the kernel or file system doesn't support it */
+    directory = sibling_path(target, ".");
+    if (directory) {
+        fd = open(directory, O_TMPFILE | O_RDWR, 0600);
+        free(directory);
+    }
+#else
+    (void)directory;
+#endif
+    if (fd == -1) {
+        temp->filename = sibling_path(target, temp_name);
+        if (!temp->filename) {
+            errno = ENOMEM;
+            return report_name_error();
+        }
+        fd = mkstemp(temp->filename);
+        if (fd == -1) {
+            free(temp->filename);
+            temp->filename = NULL;
+            return report_name_error();
+        }
+    }
+    if (!stat(target, &info)) {
+        fchmod(fd, info.st_mode & 07777);
+    }
+    temp->file = fdopen(fd, "w+b");
+    if (!temp->file) {
+        close(fd);
+    }
+    return handle_errors(temp, target);
+}
+
+void preallocate_temporary_file(TempFile *temp, unsigned long long size) {
+#ifdef __linux__
+    if (size) {
+        fallocate(fileno(temp->file), FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+    }
+#else
+    (void)temp;
+    (void)size;
+#endif
+}
+
+#ifdef O_TMPFILE
+/* Give an unnamed temporary file a name next to `target`. */
+static BOOL link_temporary_file(TempFile *temp, const char *target) {
+    char fd_path[32];
+    char *unique;
+    unsigned attempt, seed;
+    int fd = fileno(temp->file);
+
+    temp->filename = sibling_path(target, temp_name);
+    if (!temp->filename) {
+        errno = ENOMEM;
+        return report_name_error();
+    }
+    unique = temp->filename + strlen(temp->filename)
+        - TEMP_NAME_UNIQUE_LENGTH;
+    sprintf(fd_path, "/proc/self/fd/%d", fd);
+    seed = (unsigned)getpid() * 2654435761u;
+    for (attempt = 0; attempt < 100; ++attempt) {
+        sprintf(unique, "%08x", (seed + attempt) & 0xffffffffu);
+        /* linking through /proc works without special privileges,
+            but /proc might not be mounted */
+        if (!linkat(AT_FDCWD, fd_path, AT_FDCWD, temp->filename,
+                    AT_SYMLINK_FOLLOW)
+                || (errno == ENOENT && !linkat(fd, "", AT_FDCWD,
+                    temp->filename, AT_EMPTY_PATH))) {
+            return TRUE;
+        } else if (errno != EEXIST) {
+            break;
+        }
+    }
+    fprintf(stderr, "Error: Unable to link temporary file `%s`: %s\n",
+        temp->filename, strerror(errno));
+    free(temp->filename);
+    temp->filename = NULL;
+    return FALSE;
+}
+#endif /* O_TMPFILE */
+
+int publish_temporary_file(TempFile *temp, const char *target,
+        BOOL verbose) {
+    int result = fflush(temp->file);
+
+#ifdef O_TMPFILE
+    if (!result && !temp->filename && !link_temporary_file(temp, target)) {
+        discard_temporary_file(temp);
+        return 1;
+    }
+#endif
+    result = fclose(temp->file) || result;
+    temp->file = NULL;
+    if (result) {
+        fprintf(stderr, "Error: Unable to write temporary file: %s\n",
             strerror(errno));
-        return NULL;
+        discard_temporary_file(temp);
+        return 1;
+    }
+    if (verbose) {
+        fprintf(stderr, "Moving file `%s` to `%s`\n",
+            temp->filename, target);
     }
-    file = fdopen(fd, "wb");
-    return handle_errors(file, filename);
+    /* this atomically replaces the target, since both are in the same
+        directory, and leaves it as it was if it fails */
+    if (-1 == rename(temp->filename, target)) {
+        fprintf(stderr, "Unable to rename file `%s` to `%s`: %s\n",
+            temp->filename, target, strerror(errno));
+        discard_temporary_file(temp);
+        return 1;
+    }
+    free(temp->filename);
+    temp->filename = NULL;
+    return 0;
+}
+
+unsigned long long remaining_file_size(FILE *file) {
+    struct stat info;
+    off_t position;
+
+    if (fstat(fileno(file), &info) || !S_ISREG(info.st_mode)) {
+        return 0;
+    }
+    position = ftello(file);
+    if (position < 0 || position > info.st_size) {
+        return 0;
+    }
+    return (unsigned long long)(info.st_size - position);
 }
 
 #endif /* _MSC_VER */
 
-static FILE *handle_errors(FILE *file, const char *filename) {
-    if (file) {
-        return file;
+void discard_temporary_file(TempFile *temp) {
+    if (temp->file) {
+        fclose(temp->file);
+        temp->file = NULL;
+    }
+    if (temp->filename) {
+        remove(temp->filename);
+        free(temp->filename);
+        temp->filename = NULL;
     }
-    fprintf(stderr,
-        "Error: Unable to open temporary file `%s` for writing: %s\n",
-        filename, strerror(errno));
-    remove(filename);
-    return NULL;
 }
@@ -1,22 +1,45 @@
 #ifndef TEMPFILE_H
 #define TEMPFILE_H
 
-/* create and delete temporary files */
+/* create temporary files that replace another file once complete */
+
+#include "utils.h"
 
 #include <stdio.h>
 
-#ifdef _MSC_VER
-#  define TEMP_FILENAME_SIZE L_tmpnam_s
-#else
-#  define TEMP_FILENAME_SIZE 25
-#endif
+typedef struct {
+    FILE *file;
+    /* NULL while the file has no name (it was created with O_TMPFILE
+    and only gets linked into the directory when it is published) */
+    char *filename;
+} TempFile;
+
+/*
+Create and open a new temporary file in the same directory as
+`target`, so that it can later replace `target` with a rename. The
+temporary file gets the permissions of `target`, if it exists.
+@return FALSE on error, after printing a message. */
+BOOL open_temporary_file(TempFile *temp, const char *target);
 
 /*
-Create and open a new temporary file.
-@param filename a butter of size TEMP_FILENAME_SIZE where the
-    filename will be stored.
-@return a handle to the open file. The temporary file's name will
-    be stored in the given buffer. Returns NULL on error. */
-FILE *open_temporary_file(char *filename);
+Reserve disk space for `size` bytes in the temporary file, without
+changing its size, so that a large file isn't fragmented as it is
+written. This is only a hint: failures are ignored. */
+void preallocate_temporary_file(TempFile *temp, unsigned long long size);
+
+/*
+Close the temporary file and atomically replace `target` with it.
+@return 0 on success, or 1 on error after printing a message and
+    deleting the temporary file (except on Windows if `target` was
+    already removed, since it then holds the only copy of the data). */
+int publish_temporary_file(TempFile *temp, const char *target,
+    BOOL verbose);
+
+/* Close and delete the temporary file. */
+void discard_temporary_file(TempFile *temp);
+
+/* The number of bytes after the current position of `file`, or 0 if
+that is unknown (e.g. because `file` isn't a regular file). */
+unsigned long long remaining_file_size(FILE *file);
 
 #endif /* TEMPFILE_H */
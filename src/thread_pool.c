@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* utils.h isn't included because its BOOL conflicts with windows.h */
+
+#ifdef _MSC_VER
+
+#include <windows.h>
+#include <process.h>
+
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+#define THREAD_RETURN unsigned __stdcall
+
+static int thread_start(Thread *thread,
+        unsigned (__stdcall *entry)(void *), void *arg) {
+    *thread = (HANDLE)_beginthreadex(NULL, 0, entry, arg, 0, NULL);
+    return *thread != 0;
+}
+static void thread_join(Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+static void mutex_init(Mutex *mutex) { InitializeCriticalSection(mutex); }
+static void mutex_destroy(Mutex *mutex) { DeleteCriticalSection(mutex); }
+static void mutex_lock(Mutex *mutex) { EnterCriticalSection(mutex); }
+static void mutex_unlock(Mutex *mutex) { LeaveCriticalSection(mutex); }
+static void condition_init(Condition *cond) {
+    InitializeConditionVariable(cond);
+}
+static void condition_destroy(Condition *cond) { (void)cond; }
+static void condition_wait(Condition *cond, Mutex *mutex) {
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+static void condition_broadcast(Condition *cond) {
+    WakeAllConditionVariable(cond);
+}
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+#define THREAD_RETURN void *
+
+static int thread_start(Thread *thread,
+        void *(*entry)(void *), void *arg) {
+    return pthread_create(thread, NULL, entry, arg) == 0;
+}
+static void thread_join(Thread thread) { pthread_join(thread, NULL); }
+static void mutex_init(Mutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static void mutex_destroy(Mutex *mutex) { pthread_mutex_destroy(mutex); }
+static void mutex_lock(Mutex *mutex) { pthread_mutex_lock(mutex); }
+static void mutex_unlock(Mutex *mutex) { pthread_mutex_unlock(mutex); }
+static void condition_init(Condition *cond) {
+    pthread_cond_init(cond, NULL);
+}
+static void condition_destroy(Condition *cond) {
+    pthread_cond_destroy(cond);
+}
+static void condition_wait(Condition *cond, Mutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+static void condition_broadcast(Condition *cond) {
+    pthread_cond_broadcast(cond);
+}
+
+#endif /* _MSC_VER */
+
+typedef struct {
+    ThreadPool *pool;
+    unsigned index;
+} Worker;
+
+struct ThreadPool {
+    unsigned thread_count;
+    Thread *threads;
+    Worker *workers;
+    Mutex mutex;
+    Condition work_available;
+    Condition work_done;
+
+    /* the current batch, protected by `mutex` */
+    ThreadPoolJob job;
+    void *context;
+    size_t job_count;
+    size_t next_job;
+    size_t finished_jobs;
+    int shutting_down;
+};
+
+static THREAD_RETURN worker_main(void *arg) {
+    Worker *worker = (Worker *)arg;
+    ThreadPool *pool = worker->pool;
+    size_t job;
+
+    mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->shutting_down && pool->next_job >= pool->job_count) {
+            condition_wait(&pool->work_available, &pool->mutex);
+        }
+        if (pool->shutting_down) {
+            break;
+        }
+        job = pool->next_job++;
+        mutex_unlock(&pool->mutex);
+
+        pool->job(pool->context, job, worker->index);
+
+        mutex_lock(&pool->mutex);
+        if (++pool->finished_jobs == pool->job_count) {
+            condition_broadcast(&pool->work_done);
+        }
+    }
+    mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+ThreadPool *thread_pool_create(unsigned thread_count) {
+    ThreadPool *pool;
+    unsigned i;
+
+    pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = (Thread *)calloc(thread_count, sizeof(Thread));
+    pool->workers = (Worker *)calloc(thread_count, sizeof(Worker));
+    if (!pool->threads || !pool->workers) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    mutex_init(&pool->mutex);
+    condition_init(&pool->work_available);
+    condition_init(&pool->work_done);
+
+    for (i = 0; i < thread_count; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (!thread_start(&pool->threads[i], worker_main,
+                &pool->workers[i])) {
+            fprintf(stderr, "Error: Unable to start worker thread\n");
+            break;
+        }
+        pool->thread_count = i + 1;
+    }
+    if (pool->thread_count != thread_count) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void thread_pool_run(ThreadPool *pool,
+        ThreadPoolJob job,
+        void *context,
+        size_t job_count) {
+    if (job_count == 0) {
+        return;
+    }
+    mutex_lock(&pool->mutex);
+    pool->job = job;
+    pool->context = context;
+    pool->next_job = 0;
+    pool->finished_jobs = 0;
+    pool->job_count = job_count;
+    condition_broadcast(&pool->work_available);
+    while (pool->finished_jobs < pool->job_count) {
+        condition_wait(&pool->work_done, &pool->mutex);
+    }
+    pool->job_count = 0;
+    mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_destroy(ThreadPool *pool) {
+    unsigned i;
+
+    mutex_lock(&pool->mutex);
+    pool->shutting_down = 1;
+    condition_broadcast(&pool->work_available);
+    mutex_unlock(&pool->mutex);
+    for (i = 0; i < pool->thread_count; ++i) {
+        thread_join(pool->threads[i]);
+    }
+    condition_destroy(&pool->work_available);
+    condition_destroy(&pool->work_done);
+    mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,28 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/* a fixed set of worker threads that run batches of independent jobs */
+
+#include <stdlib.h>
+
+typedef struct ThreadPool ThreadPool;
+
+/* `job` is the index of the job (0 to job_count - 1), and `worker` is
+the index of the thread running it (0 to thread_count - 1), which can
+be used to select per-thread buffers. */
+typedef void (*ThreadPoolJob)(void *context, size_t job, unsigned worker);
+
+/* Start `thread_count` worker threads. Returns NULL on error. */
+ThreadPool *thread_pool_create(unsigned thread_count);
+
+/* Run `job` for every index below `job_count` and wait until all of
+them have finished. */
+void thread_pool_run(ThreadPool *pool,
+    ThreadPoolJob job,
+    void *context,
+    size_t job_count);
+
+/* Stop and join all worker threads. */
+void thread_pool_destroy(ThreadPool *pool);
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "uring_io.h"
+
+#include "bin_to_hex.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __linux__
+
+int uring_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    (void)input_file;
+    (void)output_file;
+    (void)prefix;
+    (void)prefix_length;
+    return URING_IO_UNSUPPORTED;
+}
+
+int uring_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data) {
+    (void)input_file;
+    (void)output_file;
+    (void)data;
+    return URING_IO_UNSUPPORTED;
+}
+
+#else
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* SLOT_COUNT buffers of SLOT_INPUT_SIZE bytes are in use at once: while
+    one is being converted, the others are being read into or written
+    out. SLOT_INPUT_SIZE is a multiple of 16, so every slot starts at the
+    beginning of a line. */
+enum { SLOT_COUNT = 4 };
+enum { SLOT_INPUT_SIZE = 1 << 20 };
+
+/* a minimal io_uring interface on top of the raw system calls */
+typedef struct {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned queued; /* entries that haven't been submitted yet */
+} Ring;
+
+static void ring_close(Ring *ring) {
+    if (ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->cq_ring != MAP_FAILED) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if ((void *)ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    close(ring->fd);
+}
+
+static BOOL ring_open(Ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    char *sq_ring, *cq_ring;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return FALSE;
+    }
+    ring->sq_ring_size = params.sq_off.array
+        + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED
+            || (void *)ring->sqes == MAP_FAILED) {
+        ring_close(ring);
+        return FALSE;
+    }
+
+    sq_ring = (char *)ring->sq_ring;
+    ring->sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+    cq_ring = (char *)ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+    ring->queued = 0;
+    return TRUE;
+}
+
+/* Queue a readv or writev of `iov`, which needs to stay valid until the
+ * request completes. `offset` is -1 to use the file position. */
+static void ring_queue(Ring *ring, int opcode, int fd,
+        const struct iovec *iov, unsigned long long offset,
+        unsigned long long user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->queued;
+}
+
+/* Submit all queued requests and wait until at least one has completed.
+ * Returns 0 on success or an errno value. */
+static int ring_submit_and_wait(Ring *ring) {
+    long result;
+    for (;;) {
+        result = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+        if (result >= 0) {
+            ring->queued -= (unsigned)result;
+            return 0;
+        } else if (errno != EINTR) {
+            return errno;
+        }
+    }
+}
+
+/* Take the next completion, if there is one. */
+static BOOL ring_completion(Ring *ring,
+        unsigned long long *user_data, int *result) {
+    unsigned head = *ring->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return FALSE;
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/* A slot goes through these states in order, and back to SLOT_FREE.
+    Slots are converted and written in the order they were read. */
+enum {
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_READ,
+    SLOT_CONVERTED,
+    SLOT_WRITING
+};
+
+typedef struct {
+    int state;
+    unsigned long long sequence; /* index of the slot's input chunk */
+    char *input;
+    size_t input_length;
+    BOOL end; /* reading stopped at the end of the input */
+    char *output;
+    size_t output_length;
+    size_t written;
+    unsigned long long output_offset;
+    struct iovec iov; /* of the request in flight */
+} Slot;
+
+typedef struct {
+    Ring ring;
+    Slot slots[SLOT_COUNT];
+    char *buffers;
+    FromHexData *data; /* NULL when encoding */
+    int input_fd;
+    int output_fd;
+    BOOL output_seekable;
+    unsigned long long input_offset; /* file offset of the first chunk */
+    unsigned long long output_offset; /* offset of the next output */
+    unsigned long long address; /* address of the next chunk to encode */
+    size_t prefix_length; /* bytes of the first chunk already read */
+
+    /* sequence numbers of the next slot to go through each step */
+    unsigned long long next_read, next_convert, next_write, next_free;
+    unsigned in_flight;
+    unsigned writes_in_flight;
+
+    BOOL ended; /* the end of the input has been converted */
+    BOOL failed; /* an error has been reported */
+    int status; /* of the decoder */
+} Pipeline;
+
+#define SLOT(pipeline, sequence) \
+    (&(pipeline)->slots[(sequence) % SLOT_COUNT])
+
+static void queue_read(Pipeline *pipeline, Slot *slot) {
+    slot->iov.iov_base = slot->input + slot->input_length;
+    slot->iov.iov_len = SLOT_INPUT_SIZE - slot->input_length;
+    ring_queue(&pipeline->ring, IORING_OP_READV, pipeline->input_fd,
+        &slot->iov,
+        pipeline->input_offset + slot->sequence * SLOT_INPUT_SIZE
+            + slot->input_length,
+        (unsigned long long)(slot - pipeline->slots));
+    ++pipeline->in_flight;
+}
+
+static void queue_write(Pipeline *pipeline, Slot *slot) {
+    slot->iov.iov_base = slot->output + slot->written;
+    slot->iov.iov_len = slot->output_length - slot->written;
+    ring_queue(&pipeline->ring, IORING_OP_WRITEV, pipeline->output_fd,
+        &slot->iov,
+        pipeline->output_seekable
+            ? slot->output_offset + slot->written
+            : (unsigned long long)-1,
+        (unsigned long long)(slot - pipeline->slots));
+    ++pipeline->in_flight;
+    ++pipeline->writes_in_flight;
+}
+
+static void report_error(Pipeline *pipeline, const char *message,
+        int error) {
+    if (!pipeline->failed) {
+        fprintf(stderr, "Error: %s: %s\n", message, strerror(error));
+        pipeline->failed = TRUE;
+    }
+}
+
+static void complete(Pipeline *pipeline, Slot *slot, int result) {
+    --pipeline->in_flight;
+    if (slot->state == SLOT_READING) {
+        if (result < 0) {
+            report_error(pipeline, "Unable to read input", -result);
+            slot->state = SLOT_READ;
+        } else if (result == 0) {
+            slot->end = TRUE;
+            slot->state = SLOT_READ;
+        } else {
+            stats_count(StatsRead, (unsigned long long)result);
+            slot->input_length += (size_t)result;
+            if (slot->input_length < SLOT_INPUT_SIZE && !pipeline->failed) {
+                queue_read(pipeline, slot);
+            } else {
+                slot->state = SLOT_READ;
+            }
+        }
+    } else {
+        --pipeline->writes_in_flight;
+        if (result <= 0) {
+            report_error(pipeline, "Unable to write output",
+                result ? -result : EIO);
+            return;
+        }
+        stats_count(StatsWrite, (unsigned long long)result);
+        slot->written += (size_t)result;
+        if (slot->written < slot->output_length) {
+            if (!pipeline->failed) {
+                queue_write(pipeline, slot);
+            }
+        } else {
+            slot->state = SLOT_FREE;
+        }
+    }
+}
+
+static void convert(Pipeline *pipeline, Slot *slot) {
+    double start = stats_clock();
+    if (slot->end) {
+        pipeline->ended = TRUE;
+    }
+    if (pipeline->data) {
+        pipeline->status = hex_data_to_bin(pipeline->data,
+            slot->input, slot->input_length,
+            slot->output, &slot->output_length);
+    } else {
+        slot->output_length = bin_data_to_hex(slot->input,
+            slot->input_length, pipeline->address, slot->output);
+        pipeline->address += slot->input_length;
+    }
+    stats_end(StatsConvert, start, slot->input_length);
+    slot->written = 0;
+    slot->output_offset = pipeline->output_offset;
+    pipeline->output_offset += slot->output_length;
+    slot->state = slot->output_length ? SLOT_CONVERTED : SLOT_FREE;
+}
+
+static void run(Pipeline *pipeline) {
+    Slot *slot;
+    unsigned long long user_data;
+    int result, error;
+    double start;
+
+    for (;;) {
+        while (pipeline->next_free < pipeline->next_read
+                && SLOT(pipeline, pipeline->next_free)->state
+                    == SLOT_FREE) {
+            ++pipeline->next_free;
+        }
+
+        /* start reading into free slots */
+        while (!pipeline->ended && !pipeline->failed && !pipeline->status
+                && pipeline->next_read < pipeline->next_free + SLOT_COUNT) {
+            slot = SLOT(pipeline, pipeline->next_read);
+            slot->sequence = pipeline->next_read++;
+            slot->state = SLOT_READING;
+            slot->end = FALSE;
+            slot->input_length = slot->sequence
+                ? 0 : pipeline->prefix_length;
+            queue_read(pipeline, slot);
+        }
+
+        /* convert the slots that have been read, in order; anything
+            read after the end of the input or an error is dropped */
+        while (pipeline->next_convert < pipeline->next_read) {
+            slot = SLOT(pipeline, pipeline->next_convert);
+            if (slot->state != SLOT_READ) {
+                break;
+            } else if (pipeline->ended || pipeline->failed
+                    || pipeline->status) {
+                slot->state = SLOT_FREE;
+            } else {
+                convert(pipeline, slot);
+            }
+            ++pipeline->next_convert;
+        }
+
+        /* start writing converted slots, one at a time if the output
+            isn't seekable */
+        while (pipeline->next_write < pipeline->next_convert
+                && !pipeline->failed
+                && (pipeline->output_seekable
+                    || !pipeline->writes_in_flight)) {
+            slot = SLOT(pipeline, pipeline->next_write);
+            if (slot->sequence == pipeline->next_write
+                    && slot->state == SLOT_CONVERTED) {
+                slot->state = SLOT_WRITING;
+                queue_write(pipeline, slot);
+            }
+            ++pipeline->next_write;
+        }
+
+        if (!pipeline->in_flight) {
+            if (pipeline->ended || pipeline->failed || pipeline->status) {
+                return;
+            }
+            /* every slot was converted without producing output */
+            continue;
+        }
+        start = stats_clock();
+        error = ring_submit_and_wait(&pipeline->ring);
+        stats_end(StatsWait, start, 0);
+        if (error) {
+            report_error(pipeline, "Unable to submit I/O", error);
+            return;
+        }
+        while (ring_completion(&pipeline->ring, &user_data, &result)) {
+            complete(pipeline, &pipeline->slots[user_data], result);
+        }
+    }
+}
+
+static BOOL pipeline_open(Pipeline *pipeline,
+        FILE *input_file, FILE *output_file,
+        size_t prefix_length, size_t output_size) {
+    off_t input_position, output_position;
+    int flags;
+    size_t i;
+
+    if (!output_file || getenv("HEXTOGGLE_NO_URING")) {
+        return FALSE;
+    }
+    pipeline->input_fd = fileno(input_file);
+    pipeline->output_fd = fileno(output_file);
+
+    /* reads always use offsets, so they can complete in any order */
+    input_position = ftello(input_file);
+    if (input_position < 0 || (size_t)input_position < prefix_length
+            || lseek(pipeline->input_fd, 0, SEEK_CUR) < 0
+            || fflush(output_file)) {
+        return FALSE;
+    }
+    flags = fcntl(pipeline->output_fd, F_GETFL);
+    output_position = ftello(output_file);
+    pipeline->output_seekable = flags >= 0 && !(flags & O_APPEND)
+        && output_position >= 0;
+
+    if (!ring_open(&pipeline->ring, 2 * SLOT_COUNT)) {
+        return FALSE;
+    }
+    pipeline->buffers = (char *)malloc(
+        SLOT_COUNT * (SLOT_INPUT_SIZE + output_size));
+    if (!pipeline->buffers) {
+        ring_close(&pipeline->ring);
+        return FALSE;
+    }
+    for (i = 0; i < SLOT_COUNT; ++i) {
+        pipeline->slots[i].state = SLOT_FREE;
+        pipeline->slots[i].input = pipeline->buffers
+            + i * (SLOT_INPUT_SIZE + output_size);
+        pipeline->slots[i].output = pipeline->slots[i].input
+            + SLOT_INPUT_SIZE;
+    }
+    pipeline->data = NULL;
+    pipeline->input_offset =
+        (unsigned long long)input_position - prefix_length;
+    pipeline->output_offset = pipeline->output_seekable
+        ? (unsigned long long)output_position : 0;
+    pipeline->address = 0;
+    pipeline->prefix_length = prefix_length;
+    pipeline->next_read = 0;
+    pipeline->next_convert = 0;
+    pipeline->next_write = 0;
+    pipeline->next_free = 0;
+    pipeline->in_flight = 0;
+    pipeline->writes_in_flight = 0;
+    pipeline->ended = FALSE;
+    pipeline->failed = FALSE;
+    pipeline->status = 0;
+    return TRUE;
+}
+
+static void pipeline_close(Pipeline *pipeline) {
+    /* leave the file position after the output, as if it had been
+        written sequentially */
+    if (pipeline->output_seekable) {
+        lseek(pipeline->output_fd,
+            (off_t)pipeline->output_offset, SEEK_SET);
+    }
+    ring_close(&pipeline->ring);
+    free(pipeline->buffers);
+}
+
+int uring_to_hex(FILE *input_file,
+        FILE *output_file,
+        const char *prefix,
+        size_t prefix_length) {
+    Pipeline pipeline;
+
+    if (!pipeline_open(&pipeline, input_file, output_file, prefix_length,
+            (size_t)bin_to_hex_size(SLOT_INPUT_SIZE))) {
+        return URING_IO_UNSUPPORTED;
+    }
+    memcpy(pipeline.slots[0].input, prefix, prefix_length);
+    run(&pipeline);
+    pipeline_close(&pipeline);
+    return pipeline.failed ? 1 : 0;
+}
+
+int uring_from_hex(FILE *input_file,
+        FILE *output_file,
+        FromHexData *data) {
+    Pipeline pipeline;
+
+    if (!pipeline_open(&pipeline, input_file, output_file, 0,
+            SLOT_INPUT_SIZE / 2 + 1)) {
+        return URING_IO_UNSUPPORTED;
+    }
+    pipeline.data = data;
+    run(&pipeline);
+    pipeline_close(&pipeline);
+    return pipeline.failed ? 2 : pipeline.status;
+}
+
+#endif /* __linux__ */
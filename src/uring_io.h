@@ -0,0 +1,43 @@
+#ifndef URING_IO_H
+#define URING_IO_H
+
+/* conversions that overlap reading, converting and writing with
+io_uring (Linux) */
+
+#include "hex_to_bin.h"
+
+#include <stdio.h>
+
+/* Returned by the functions below if io_uring is unavailable or the
+files can't be used with it (the input needs to be seekable). Nothing
+has been read or written in that case. */
+enum { URING_IO_UNSUPPORTED = -1 };
+
+/**
+ * Encode `input_file` into `output_file`, whose header has already
+ * been written. `prefix` contains the first `prefix_length` bytes of
+ * input, which were already read.
+ *
+ * Return value: 0 on success, 1 on error, or URING_IO_UNSUPPORTED
+ *
+ * Several reads and writes are kept in flight while one buffer is
+ * being converted. Reads use the offsets of the chunks in the input
+ * file, as do writes if `output_file` is seekable; otherwise only one
+ * write is in flight at a time, so the output stays in order. */
+int uring_to_hex(FILE *input_file,
+    FILE *output_file,
+    const char *prefix,
+    size_t prefix_length);
+
+/**
+ * Decode the rest of `input_file` into `output_file`, continuing from
+ * the decoder state in `data`.
+ *
+ * Return value: 0 on success, 1 if the input is invalid (with `data`
+ *     describing the position of the invalid character), 2 on any other
+ *     error, or URING_IO_UNSUPPORTED */
+int uring_from_hex(FILE *input_file,
+    FILE *output_file,
+    FromHexData *data);
+
+#endif /* URING_IO_H */
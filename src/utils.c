@@ -1,6 +1,18 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
 #include "utils.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#  include <io.h>
+#else
+#  include <sys/types.h>
+#  include <unistd.h>
+#endif
 
 int hex_char_to_int(char ch) {
     switch (ch) {
@@ -60,3 +72,69 @@ char safe_char(char ch) {
         return '.';
     }
 }
+
+BOOL seek_to(FILE *file, unsigned long long offset) {
+#ifdef _MSC_VER
+    return !_fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    return !fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+BOOL get_file_size(FILE *file, unsigned long long *size) {
+#ifdef _MSC_VER
+    __int64 end;
+    if (_fseeki64(file, 0, SEEK_END) || (end = _ftelli64(file)) < 0) {
+        return FALSE;
+    }
+#else
+    off_t end;
+    if (fseeko(file, 0, SEEK_END) || (end = ftello(file)) < 0) {
+        return FALSE;
+    }
+#endif
+    *size = (unsigned long long)end;
+    return TRUE;
+}
+
+BOOL truncate_file(FILE *file, unsigned long long size) {
+    if (fflush(file)) {
+        return FALSE;
+    }
+#ifdef _MSC_VER
+    return !_chsize_s(_fileno(file), (__int64)size);
+#else
+    return !ftruncate(fileno(file), (off_t)size);
+#endif
+}
+
+#ifndef _MSC_VER
+int write_at(int fd, const char *data, size_t length,
+        unsigned long long offset) {
+    ssize_t result;
+    while (length) {
+        result = pwrite(fd, data, length, (off_t)offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result < 0) {
+            return errno;
+        }
+        data += result;
+        length -= (size_t)result;
+        offset += (size_t)result;
+    }
+    return 0;
+}
+#endif
+
+const char *status_code_description(int status) {
+    switch (status) {
+        case EXIT_SUCCESS: return "success";
+        case StatusCodeInvalidArgs: return "invalid arguments";
+        case StatusCodeFailedToOpenFiles: return "failed to open input files";
+        case StatusCodeFailedCleanup: return "failed to clean up files";
+        case StatusCodeInvalidInput: return "invalid input";
+        case StatusCodeAssertionFailed: return "internal assertion failed";
+        default: return "unknown error";
+    }
+}
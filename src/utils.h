@@ -6,6 +6,8 @@
 #  define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#include <stdio.h>
+
 /* Convert a hexadecimal character (i.e. [0-9a-fA-F]) to an integer
 value between 0 and 15 inclusive. Returns -1 on error. */
 int hex_char_to_int(char ch);
@@ -32,4 +34,27 @@ enum StatusCode {
     StatusCodeAssertionFailed
 };
 
+/* Seek to `offset` bytes from the start of `file`, also past 2 GiB.
+Returns FALSE on error. */
+BOOL seek_to(FILE *file, unsigned long long offset);
+
+/* Get the size of the seekable `file`, leaving it at its end.
+Returns FALSE on error. */
+BOOL get_file_size(FILE *file, unsigned long long *size);
+
+/* Flush `file` and cut it off (or extend it with zeros) to `size`
+bytes. Returns FALSE on error. */
+BOOL truncate_file(FILE *file, unsigned long long size);
+
+#ifndef _MSC_VER
+/* Write all of `data` at `offset` of the file descriptor `fd`, without
+moving its position. Returns 0 or an errno value. */
+int write_at(int fd, const char *data, size_t length,
+    unsigned long long offset);
+#endif
+
+/* Describe an exit code (EXIT_SUCCESS or a `StatusCode`), as listed in
+the usage information. */
+const char *status_code_description(int status);
+
 #endif /* UTILS_H */